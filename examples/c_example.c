@@ -24,6 +24,13 @@ struct {
 	uint64_t (*pcm_c_get_cycles)(uint32_t core_id);
 	uint64_t (*pcm_c_get_instr)(uint32_t core_id);
 	uint64_t (*pcm_c_get_core_event)(uint32_t core_id, uint32_t event_id);
+	uint32_t (*pcm_c_get_snapshot_size)();
+	int (*pcm_c_get_snapshot)(uint64_t * buffer, uint32_t size);
+	int (*pcm_c_region_init)();
+	int32_t (*pcm_c_region_id)(const char * name);
+	void (*pcm_c_region_begin)(int32_t id);
+	void (*pcm_c_region_end)(int32_t id);
+	void (*pcm_c_region_dump)();
 } PCM; // lgtm [cpp/short-global-name]
 
 #ifndef PCM_DYNAMIC_LIB
@@ -35,14 +42,30 @@ void pcm_c_stop();
 uint64_t pcm_c_get_cycles(uint32_t);
 uint64_t pcm_c_get_instr(uint32_t);
 uint64_t pcm_c_get_core_event(uint32_t, uint32_t);
+uint32_t pcm_c_get_snapshot_size();
+int pcm_c_get_snapshot(uint64_t *, uint32_t);
+int pcm_c_region_init();
+int32_t pcm_c_region_id(const char *);
+void pcm_c_region_begin(int32_t);
+void pcm_c_region_end(int32_t);
+void pcm_c_region_dump();
 #endif
 
+/* Snapshot layout: see pcm-core.cpp */
+#define PCM_C_SNAPSHOT_HEADER 8
+#define PCM_C_HEADER_NUM_CORES 3
+#define PCM_C_HEADER_NUM_SOCKETS 4
+#define PCM_C_HEADER_CORE_VALUES 5
+#define PCM_C_HEADER_SOCKET_VALUES 6
+
 
 int main(int argc, const char *argv[])
 {
 	int i,a[100],b[100],c[100];
 	uint32_t total = 0;
 	int lcore_id;
+	uint32_t snapshot_size;
+	uint64_t * snapshot;
     int numEvents = argc - 1;
 
 	/* Seed for predictable rand() results */
@@ -67,6 +90,13 @@ int main(int argc, const char *argv[])
 	PCM.pcm_c_get_cycles = (uint64_t (*)(uint32_t)) dlsym(handle, "pcm_c_get_cycles");
 	PCM.pcm_c_get_instr = (uint64_t (*)(uint32_t)) dlsym(handle, "pcm_c_get_instr");
 	PCM.pcm_c_get_core_event = (uint64_t (*)(uint32_t,uint32_t)) dlsym(handle, "pcm_c_get_core_event");
+	PCM.pcm_c_get_snapshot_size = (uint32_t (*)()) dlsym(handle, "pcm_c_get_snapshot_size");
+	PCM.pcm_c_get_snapshot = (int (*)(uint64_t *, uint32_t)) dlsym(handle, "pcm_c_get_snapshot");
+	PCM.pcm_c_region_init = (int (*)()) dlsym(handle, "pcm_c_region_init");
+	PCM.pcm_c_region_id = (int32_t (*)(const char *)) dlsym(handle, "pcm_c_region_id");
+	PCM.pcm_c_region_begin = (void (*)(int32_t)) dlsym(handle, "pcm_c_region_begin");
+	PCM.pcm_c_region_end = (void (*)(int32_t)) dlsym(handle, "pcm_c_region_end");
+	PCM.pcm_c_region_dump = (void (*)()) dlsym(handle, "pcm_c_region_dump");
 #else
 	PCM.pcm_c_build_core_event = pcm_c_build_core_event;
 	PCM.pcm_c_init = pcm_c_init;
@@ -75,11 +105,21 @@ int main(int argc, const char *argv[])
 	PCM.pcm_c_get_cycles = pcm_c_get_cycles;
 	PCM.pcm_c_get_instr = pcm_c_get_instr;
 	PCM.pcm_c_get_core_event = pcm_c_get_core_event;
+	PCM.pcm_c_get_snapshot_size = pcm_c_get_snapshot_size;
+	PCM.pcm_c_get_snapshot = pcm_c_get_snapshot;
+	PCM.pcm_c_region_init = pcm_c_region_init;
+	PCM.pcm_c_region_id = pcm_c_region_id;
+	PCM.pcm_c_region_begin = pcm_c_region_begin;
+	PCM.pcm_c_region_end = pcm_c_region_end;
+	PCM.pcm_c_region_dump = pcm_c_region_dump;
 #endif
 
 	if(PCM.pcm_c_init == NULL || PCM.pcm_c_start == NULL || PCM.pcm_c_stop == NULL ||
 			PCM.pcm_c_get_cycles == NULL || PCM.pcm_c_get_instr == NULL ||
-			PCM.pcm_c_build_core_event == NULL || PCM.pcm_c_get_core_event == NULL)
+			PCM.pcm_c_build_core_event == NULL || PCM.pcm_c_get_core_event == NULL ||
+			PCM.pcm_c_get_snapshot_size == NULL || PCM.pcm_c_get_snapshot == NULL ||
+			PCM.pcm_c_region_init == NULL || PCM.pcm_c_region_id == NULL || PCM.pcm_c_region_begin == NULL ||
+			PCM.pcm_c_region_end == NULL || PCM.pcm_c_region_dump == NULL)
 		return -1;
 
     if (numEvents > 4)
@@ -118,5 +158,39 @@ int main(int argc, const char *argv[])
 		(unsigned long long)PCM.pcm_c_get_core_event(lcore_id,2),
 		(unsigned long long)PCM.pcm_c_get_core_event(lcore_id,3));
 
+	/* the same values for all cores and sockets with a single call */
+	snapshot_size = PCM.pcm_c_get_snapshot_size();
+	snapshot = (uint64_t *) malloc(snapshot_size * sizeof(uint64_t));
+	if (snapshot && PCM.pcm_c_get_snapshot(snapshot, snapshot_size) > 0) {
+		uint64_t num_cores = snapshot[PCM_C_HEADER_NUM_CORES];
+		uint64_t num_sockets = snapshot[PCM_C_HEADER_NUM_SOCKETS];
+		uint64_t core_values = snapshot[PCM_C_HEADER_CORE_VALUES];
+		uint64_t socket_values = snapshot[PCM_C_HEADER_SOCKET_VALUES];
+		const uint64_t * cores = snapshot + PCM_C_SNAPSHOT_HEADER;
+		const uint64_t * sockets = cores + num_cores * core_values;
+		uint64_t core, socket;
+		for (core = 0; core < num_cores; ++core)
+			if (cores[core * core_values])
+				printf("CPU%llu C:%llu I:%llu\n", (unsigned long long)core,
+					(unsigned long long)cores[core * core_values],
+					(unsigned long long)cores[core * core_values + 1]);
+		for (socket = 0; socket < num_sockets; ++socket)
+			printf("S%llu MC read bytes:%llu write bytes:%llu\n", (unsigned long long)socket,
+				(unsigned long long)sockets[socket * socket_values],
+				(unsigned long long)sockets[socket * socket_values + 1]);
+	}
+	free(snapshot);
+
+	/* per-region statistics read with rdpmc (needs "echo 2 > /sys/bus/event_source/devices/cpu/rdpmc") */
+	if (PCM.pcm_c_region_init() == 0) {
+		int32_t region = PCM.pcm_c_region_id("compute");
+		for (i = 0; i < 10000; i++) {
+			PCM.pcm_c_region_begin(region);
+			c[i%100] = 4 * a[i%100] + b[i%100];
+			PCM.pcm_c_region_end(region);
+		}
+		PCM.pcm_c_region_dump();
+	}
+
 	return 0;
 }
@@ -176,6 +176,23 @@ ServerBW::ServerBW(const uint32 numIMC, const uint32 root_segment_ubox0, const u
     }
 }
 
+ServerBW::Counters ServerBW::readCounters()
+{
+    // the four counters are adjacent registers starting at PCM_SERVER_IMC_DRAM_DATA_READS
+    static_assert(size_t(PCM_SERVER_IMC_PMM_DATA_WRITES - PCM_SERVER_IMC_DRAM_DATA_READS) == (NumCounters - 1) * sizeof(uint64), "unexpected register layout");
+    Counters result{};
+    uint64 block[NumCounters];
+    for (auto & mmio : mmioRanges)
+    {
+        mmio->readBlock64(PCM_SERVER_IMC_DRAM_DATA_READS, block, NumCounters);
+        for (size_t i = 0; i < NumCounters; ++i)
+        {
+            result[i] += block[i];
+        }
+    }
+    return result;
+}
+
 uint64 ServerBW::getImcReads()
 {
     uint64 result = 0;
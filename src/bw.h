@@ -72,8 +72,22 @@ class ServerBW
 
     ServerBW();
 public:
+    enum Counter
+    {
+        ImcReads = 0,
+        ImcWrites,
+        PMMReads,
+        PMMWrites,
+        NumCounters
+    };
+    typedef std::array<uint64, NumCounters> Counters;
+
     ServerBW(const uint32 numIMC, const uint32 root_segment_ubox0, const uint32 root_bus_ubox0);
 
+    //! \brief Reads all free-running counters of all memory controllers, one block read per controller
+    //! \return the counters summed over the memory controllers
+    Counters readCounters();
+
     uint64 getImcReads();
     uint64 getImcWrites();
     uint64 getPMMReads();
@@ -69,6 +69,7 @@
 #include <algorithm>
 #include <thread>
 #include <future>
+#include <iomanip>
 #include <functional>
 #include <queue>
 #include <condition_variable>
@@ -1271,54 +1272,66 @@ bool PCM::discoverSystemTopology()
     TopologyEntry entry;
 
 #ifdef __linux__
-    num_cores = readMaxFromSysFS("/sys/devices/system/cpu/present");
-    if(num_cores == -1)
+    if (const auto simulated = SimulatedHardware::get())
     {
-      std::cerr << "Cannot read number of present cores\n";
-      return false;
+        simulated->getTopology(topology);
+        num_cores = num_online_cores = (int32)topology.size();
+        for (const auto & e : topology)
+        {
+            socketIdMap[e.socket] = 0;
+        }
     }
-    ++num_cores;
-
-    // open /proc/cpuinfo
-    FILE * f_cpuinfo = fopen("/proc/cpuinfo", "r");
-    if (!f_cpuinfo)
+    else
     {
-        std::cerr << "Cannot open /proc/cpuinfo file.\n";
-        return false;
-    }
+        num_cores = readMaxFromSysFS("/sys/devices/system/cpu/present");
+        if(num_cores == -1)
+        {
+          std::cerr << "Cannot read number of present cores\n";
+          return false;
+        }
+        ++num_cores;
 
-    // map with key=pkg_apic_id (not necessarily zero based or sequential) and
-    // associated value=socket_id that should be 0 based and sequential
-    std::map<int, int> found_pkg_ids;
-    topology.resize(num_cores);
-    char buffer[1024];
-    while (0 != fgets(buffer, 1024, f_cpuinfo))
-    {
-        if (strncmp(buffer, "processor", sizeof("processor") - 1) == 0)
+        // open /proc/cpuinfo
+        FILE * f_cpuinfo = fopen("/proc/cpuinfo", "r");
+        if (!f_cpuinfo)
         {
-            pcm_sscanf(buffer) >> s_expect("processor\t: ") >> entry.os_id;
-            //std::cout << "os_core_id: " << entry.os_id << "\n";
-            try {
-                TemporalThreadAffinity _(entry.os_id);
+            std::cerr << "Cannot open /proc/cpuinfo file.\n";
+            return false;
+        }
+
+        // map with key=pkg_apic_id (not necessarily zero based or sequential) and
+        // associated value=socket_id that should be 0 based and sequential
+        std::map<int, int> found_pkg_ids;
+        topology.resize(num_cores);
+        char buffer[1024];
+        while (0 != fgets(buffer, 1024, f_cpuinfo))
+        {
+            if (strncmp(buffer, "processor", sizeof("processor") - 1) == 0)
+            {
+                pcm_sscanf(buffer) >> s_expect("processor\t: ") >> entry.os_id;
+                //std::cout << "os_core_id: " << entry.os_id << "\n";
+                try {
+                    TemporalThreadAffinity _(entry.os_id);
+
+                    populateEntry(entry);
+                    if (populateHybridEntry(entry, entry.os_id) == false)
+                    {
+                        return false;
+                    }
 
-                populateEntry(entry);
-                if (populateHybridEntry(entry, entry.os_id) == false)
+                    topology[entry.os_id] = entry;
+                    socketIdMap[entry.socket] = 0;
+                    ++num_online_cores;
+                }
+                catch (std::exception &)
                 {
-                    return false;
+                    std::cerr << "Marking core " << entry.os_id << " offline\n";
                 }
-
-                topology[entry.os_id] = entry;
-                socketIdMap[entry.socket] = 0;
-                ++num_online_cores;
-            }
-            catch (std::exception &)
-            {
-                std::cerr << "Marking core " << entry.os_id << " offline\n";
             }
         }
+        //std::cout << std::flush;
+        fclose(f_cpuinfo);
     }
-    //std::cout << std::flush;
-    fclose(f_cpuinfo);
 
 #elif defined(__FreeBSD__) || defined(__DragonFly__)
 
@@ -1561,6 +1574,46 @@ void PCM::printSystemTopology() const
     }
 }
 
+class CoreTaskQueue
+{
+    std::queue<std::packaged_task<void()> > wQueue;
+    std::mutex m;
+    std::condition_variable condVar;
+    std::thread worker;
+    CoreTaskQueue() = delete;
+    CoreTaskQueue(CoreTaskQueue &) = delete;
+    CoreTaskQueue & operator = (CoreTaskQueue &) = delete;
+public:
+    CoreTaskQueue(int32 core) :
+        worker([=]() {
+        try {
+            TemporalThreadAffinity tempThreadAffinity(core, false);
+            std::unique_lock<std::mutex> lock(m);
+            while (1) {
+                while (wQueue.empty()) {
+                    condVar.wait(lock);
+                }
+                while (!wQueue.empty()) {
+                    wQueue.front()();
+                    wQueue.pop();
+                }
+            }
+        }
+        catch (const std::exception & e)
+        {
+            std::cerr << "PCM Error. Exception in CoreTaskQueue worker function: " << e.what() << "\n";
+        }
+
+        })
+    {}
+    void push(std::packaged_task<void()> & task)
+    {
+        std::unique_lock<std::mutex> lock(m);
+        wQueue.push(std::move(task));
+        condVar.notify_one();
+    }
+};
+
 bool PCM::initMSR()
 {
 #ifdef __APPLE__
@@ -1571,16 +1624,30 @@ bool PCM::initMSR()
 #else
     try
     {
+        // the core task queue workers open the handles of their cores in parallel
+        MSR.resize(num_cores);
+        std::vector<std::future<void> > asyncCoreResults;
         for (int i = 0; i < (int)num_cores; ++i)
         {
             if ( isCoreOnline( (int32)i ) ) {
-                MSR.push_back(std::make_shared<SafeMsrHandle>(i));
-                systemTopology->addMSRHandleToOSThread( MSR.back(), (uint32)i );
+                std::packaged_task<void()> task([this, i]() -> void
+                    {
+                        MSR[i] = std::make_shared<SafeMsrHandle>(i);
+                    });
+                asyncCoreResults.push_back(task.get_future());
+                coreTaskQueues[i]->push(task);
             } else { // the core is offlined, assign an invalid MSR handle
-                MSR.push_back(std::make_shared<SafeMsrHandle>());
-                systemTopology->addMSRHandleToOSThread( MSR.back(), (uint32)i );
+                MSR[i] = std::make_shared<SafeMsrHandle>();
             }
         }
+        for (auto & ar : asyncCoreResults)
+            ar.wait(); // all tasks must finish before MSR can be cleared on a failure
+        for (auto & ar : asyncCoreResults)
+            ar.get(); // rethrows the exception of a failed open
+        for (int i = 0; i < (int)num_cores; ++i)
+        {
+            systemTopology->addMSRHandleToOSThread( MSR[i], (uint32)i );
+        }
     }
     catch (...)
     {
@@ -2851,6 +2918,10 @@ bool keepNMIWatchdogEnabled()
 
 bool isNMIWatchdogEnabled(const bool silent)
 {
+    if (SimulatedHardware::get())
+    {
+        return false;
+    }
     const auto watchdog = readSysFS(PCM_NMI_WATCHDOG_PATH, silent);
     if (watchdog.length() == 0)
     {
@@ -2877,46 +2948,6 @@ void enableNMIWatchdog(const bool silent)
 }
 #endif
 
-class CoreTaskQueue
-{
-    std::queue<std::packaged_task<void()> > wQueue;
-    std::mutex m;
-    std::condition_variable condVar;
-    std::thread worker;
-    CoreTaskQueue() = delete;
-    CoreTaskQueue(CoreTaskQueue &) = delete;
-    CoreTaskQueue & operator = (CoreTaskQueue &) = delete;
-public:
-    CoreTaskQueue(int32 core) :
-        worker([=]() {
-        try {
-            TemporalThreadAffinity tempThreadAffinity(core, false);
-            std::unique_lock<std::mutex> lock(m);
-            while (1) {
-                while (wQueue.empty()) {
-                    condVar.wait(lock);
-                }
-                while (!wQueue.empty()) {
-                    wQueue.front()();
-                    wQueue.pop();
-                }
-            }
-        }
-        catch (const std::exception & e)
-        {
-            std::cerr << "PCM Error. Exception in CoreTaskQueue worker function: " << e.what() << "\n";
-        }
-
-        })
-    {}
-    void push(std::packaged_task<void()> & task)
-    {
-        std::unique_lock<std::mutex> lock(m);
-        wQueue.push(std::move(task));
-        condVar.notify_one();
-    }
-};
-
 std::ofstream* PCM::outfile = nullptr;       // output file stream
 std::streambuf* PCM::backup_ofile = nullptr; // backup of original output = cout
 std::streambuf* PCM::backup_ofile_cerr = nullptr; // backup of original output = cerr
@@ -3018,15 +3049,23 @@ PCM::PCM() :
     }
 #endif
 
+    startupPhaseStart = std::chrono::steady_clock::now();
+
     if(!detectModel()) return;
 
     if(!checkModel()) return;
 
     initCStateSupportTables();
+    endStartupPhase("CPU model detection");
 
     if(!discoverSystemTopology()) return;
+    endStartupPhase("topology discovery");
+
+    initCoreTaskQueues();
+    endStartupPhase("core task queues");
 
     if(!initMSR()) return;
+    endStartupPhase("MSR handles");
 
     readCoreCounterConfig(true);
 
@@ -3037,6 +3076,7 @@ PCM::PCM() :
     if(!detectNominalFrequency()) return;
 
     showSpecControlMSRs();
+    endStartupPhase("core PMU configuration");
 
 #ifndef PCM_DEBUG_TOPOLOGY
     if (safe_getenv("PCM_PRINT_TOPOLOGY") == "1")
@@ -3046,6 +3086,7 @@ PCM::PCM() :
     }
 
     initEnergyMonitoring();
+    endStartupPhase("energy monitoring");
 
 #ifndef PCM_SILENT
     std::cerr << "\n";
@@ -3054,10 +3095,13 @@ PCM::PCM() :
     uncorePMUDiscovery = std::make_shared<UncorePMUDiscovery>();
 
     initUncoreObjects();
+    endStartupPhase("uncore discovery");
 
     initRDT();
 
     readCPUMicrocodeLevel();
+    endStartupPhase("RDT and microcode");
+    numConstructorPhases = startupPhaseTimes.size();
 
 #ifdef PCM_USE_PERF
     canUsePerf = true;
@@ -3065,14 +3109,41 @@ PCM::PCM() :
     std::fill(perfTopDownPos.begin(), perfTopDownPos.end(), 0);
 #endif
 
+#ifndef PCM_SILENT
+    std::cerr << "\n";
+#endif
+}
+
+void PCM::initCoreTaskQueues()
+{
+    // created before the MSR handles: the workers open the handles and program the PMUs of their cores
     for (int32 i = 0; i < num_cores; ++i)
     {
         coreTaskQueues.push_back(std::make_shared<CoreTaskQueue>(i));
     }
+    CounterWidthExtender::setCoreTaskQueues(coreTaskQueues);
+}
 
-#ifndef PCM_SILENT
-    std::cerr << "\n";
-#endif
+void PCM::endStartupPhase(const char * name)
+{
+    const auto now = std::chrono::steady_clock::now();
+    startupPhaseTimes.push_back(std::make_pair(std::string(name), std::chrono::duration<double>(now - startupPhaseStart).count()));
+    startupPhaseStart = now;
+}
+
+void PCM::printStartupPhaseTimes(std::ostream & out) const
+{
+    double total = 0.;
+    out << "PCM startup phases:\n";
+    for (const auto & phase : startupPhaseTimes)
+    {
+        out << "  " << std::left << std::setw(28) << phase.first << std::right << std::fixed << std::setprecision(3)
+            << phase.second * 1000. << " ms\n";
+        total += phase.second;
+    }
+    out << "  " << std::left << std::setw(28) << "total" << std::right << total * 1000. << " ms\n";
+    out.unsetf(std::ios_base::floatfield);
+    out << std::setprecision(6);
 }
 
 void PCM::printDetailedSystemTopology(const int detailLevel)
@@ -3361,13 +3432,24 @@ PCM::ErrorCode PCM::program(const PCM::ProgramMode mode_, const void * parameter
 
     if (MSR.empty()) return PCM::MSRAccessDenied;
 
+    startupPhaseTimes.resize((std::min)(startupPhaseTimes.size(), numConstructorPhases));
+    startupPhaseStart = std::chrono::steady_clock::now();
+    auto printStartupPhases = [&]() {
+        if (safe_getenv("PCM_PRINT_STARTUP_TIMES") == "1") printStartupPhaseTimes(std::cerr);
+    };
+
     ExtendedCustomCoreEventDescription * pExtDesc = (ExtendedCustomCoreEventDescription *)parameter_;
 
 #ifdef PCM_USE_PERF
     closePerfHandles(silent);
     if (!silent) std::cerr << "Trying to use Linux perf events...\n";
     const char * no_perf_env = std::getenv("PCM_NO_PERF");
-    if (no_perf_env != NULL && std::string(no_perf_env) == std::string("1"))
+    if (SimulatedHardware::get())
+    {
+        canUsePerf = false;
+        if (!silent) std::cerr << "Linux perf events can not be used with simulated hardware (PCM_SIMULATE). Using direct PMU programming...\n";
+    }
+    else if (no_perf_env != NULL && std::string(no_perf_env) == std::string("1"))
     {
         canUsePerf = false;
         if (!silent) std::cerr << "Usage of Linux perf events is disabled through PCM_NO_PERF environment variable. Using direct PMU programming...\n";
@@ -3753,6 +3835,8 @@ PCM::ErrorCode PCM::program(const PCM::ProgramMode mode_, const void * parameter
     core_global_ctrl_value = 0ULL;
     isHWTMAL1Supported(); // ínit value to prevent MT races
 
+    endStartupPhase("program: preparation");
+
     std::vector<std::future<void> > asyncCoreResults;
     std::vector<PCM::ErrorCode> programmingStatuses(num_cores, PCM::Success);
 
@@ -3782,6 +3866,7 @@ PCM::ErrorCode PCM::program(const PCM::ProgramMode mode_, const void * parameter
     }
 
     programmed_core_pmu = true;
+    endStartupPhase("program: core PMUs");
 
     if (canUsePerf && !silent)
     {
@@ -3790,6 +3875,7 @@ PCM::ErrorCode PCM::program(const PCM::ProgramMode mode_, const void * parameter
 
     if (EXT_CUSTOM_CORE_EVENTS == mode_ && pExtDesc && pExtDesc->defaultUncoreProgramming == false)
     {
+        printStartupPhases();
         return PCM::Success;
     }
 
@@ -3828,9 +3914,12 @@ PCM::ErrorCode PCM::program(const PCM::ProgramMode mode_, const void * parameter
             programBecktonUncore(i);
         }
     }
+    endStartupPhase("program: uncore PMUs");
 
     if (!silent) reportQPISpeed();
 
+    printStartupPhases();
+
     return PCM::Success;
 }
 
@@ -5190,6 +5279,41 @@ uint64 PCM::getInvariantTSC_Fast(uint32 core)
     return 0ULL;
 }
 
+double PCM::getDRAMJoulesPerEnergyUnit() const
+{
+    if (PCM::HASWELLX == cpu_model
+        || PCM::BDX_DE == cpu_model
+        || PCM::BDX == cpu_model
+        || PCM::SKX == cpu_model
+        || PCM::ICX == cpu_model
+        || PCM::SRF == cpu_model
+        || PCM::KNL == cpu_model
+        ) {
+/* as described in sections 5.3.2 (DRAM_POWER_INFO) and 5.3.3 (DRAM_ENERGY_STATUS) of
+ * Volume 2 (Registers) of
+ * Intel Xeon E5-1600 v3 and Intel Xeon E5-2600 v3 (Haswell-EP) Datasheet (Ref 330784-001, Sept.2014)
+ * ENERGY_UNIT for DRAM domain is fixed to 15.3 uJ for server HSX, BDW and KNL processors.
+ */
+        return 0.0000153;
+    } else {
+/* for all other processors (including Haswell client/mobile SKUs) the ENERGY_UNIT for DRAM domain
+ * should be read from PACKAGE_POWER_SKU register (usually value around ~61uJ)
+ */
+        return getJoulesPerEnergyUnit();
+    }
+}
+
+bool PCM::getEnergyStatus(const uint32 socket, uint64 & packageEnergy, uint64 & dramEnergy)
+{
+    if (socket >= (uint32)energy_status.size())
+    {
+        return false;
+    }
+    packageEnergy = energy_status[socket]->read();
+    dramEnergy = (socket < (uint32)dram_energy_status.size()) ? dram_energy_status[socket]->read() : 0ULL;
+    return true;
+}
+
 SystemCounterState getSystemCounterState()
 {
     PCM * inst = PCM::getInstance();
@@ -5342,6 +5466,7 @@ void BasicCounterState::readAndAggregate(std::shared_ptr<SafeMsrHandle> msr)
     {
         msr->write(IA32_CR_PERF_GLOBAL_CTRL, 0ULL); // freeze
     }
+    CoreReadTSC.add(RDTSC()); // the thread runs on core_id here
 
     const int32 core_gen_counter_num_max = m->getMaxCustomCoreEvents();
     uint64 overflows = 0;
@@ -6019,6 +6144,11 @@ PCM::ErrorCode PCM::program(const RawPMUConfigs& curPMUConfigs_, const bool sile
                         }
                         PMTRegisterLocations[c.first] = locations;
                     }
+                    // the telemetry arrays of a UID are shared by all its events: load() reads only the qwords of the programmed events
+                    for (auto & t : PMTRegisterLocations[c.first])
+                    {
+                        t->require(c.first[PMTEventPosition::offset]);
+                    }
                 }
             };
             addLocations(pmtConfig.programmable);
@@ -6266,12 +6396,13 @@ void PCM::readAndAggregateUncoreMCCounters(const uint32 socket, CounterStateType
     const bool ReadMCStatsFromServerBW = (socket < serverBW.size());
     if (ReadMCStatsFromServerBW)
     {
-        result.UncMCNormalReads += serverBW[socket]->getImcReads();
-        result.UncMCFullWrites += serverBW[socket]->getImcWrites();
+        const auto counters = serverBW[socket]->readCounters();
+        result.UncMCNormalReads += counters[ServerBW::ImcReads];
+        result.UncMCFullWrites += counters[ServerBW::ImcWrites];
         if (PMMTrafficMetricsAvailable())
         {
-            result.UncPMMReads += serverBW[socket]->getPMMReads();
-            result.UncPMMWrites += serverBW[socket]->getPMMWrites();
+            result.UncPMMReads += counters[ServerBW::PMMReads];
+            result.UncPMMWrites += counters[ServerBW::PMMWrites];
         }
     }
 
@@ -6710,53 +6841,107 @@ void PCM::getAllCounterStates(SystemCounterState & systemState, std::vector<Sock
 
     std::vector<std::future<void> > asyncCoreResults;
 
-    for (int32 core = 0; core < num_cores; ++core)
+    // with the read barrier all tasks wait for a common TSC deadline placed after the expected end of the dispatch
+    const uint64 dispatchStartTSC = RDTSC();
+    const uint64 readDeadline = readBarrier ? (dispatchStartTSC + getReadBarrierLeadTicks()) : 0ULL;
+    auto waitForReadDeadline = [this, readDeadline]()
     {
-        // read core counters
-        if (isCoreOnline(core))
+        if (readDeadline == 0ULL) return;
+        if (RDTSC() > readDeadline)
         {
-            std::packaged_task<void()> task([this,&coreStates,&socketStates,core,readAndAggregateSocketUncoreCounters]() -> void
-                {
-                    coreStates[core].readAndAggregate(MSR[core]);
-                    if (readAndAggregateSocketUncoreCounters)
+            ++readBarrierMisses;
+            return;
+        }
+        while (RDTSC() < readDeadline) { }
+    };
+    // the read of each unit group is time stamped, so the read skew includes the time the reads take
+    auto readSocketUncore = [this, &socketStates](const uint32 s, const int32 refCore)
+    {
+        auto & readTSC = socketStates[s].UncoreReadTSC;
+        readTSC.add(RDTSC());
+        readAndAggregateUncoreMCCounters(s, socketStates[s]);
+        readTSC.add(RDTSC());
+        readAndAggregateEnergyCounters(s, socketStates[s]);
+        readTSC.add(RDTSC());
+        readPackageThermalHeadroom(s, socketStates[s]);
+        readTSC.add(RDTSC());
+        readMSRs(MSR[refCore], packageMSRConfig, socketStates[s]);
+        readTSC.add(RDTSC());
+    };
+
+    {
+        OverheadScope dispatchOverhead(OverheadStats::DispatchPhase);
+        for (int32 core = 0; core < num_cores; ++core)
+        {
+            // read core counters
+            if (isCoreOnline(core))
+            {
+                std::packaged_task<void()> task([this,&coreStates,&socketStates,core,readAndAggregateSocketUncoreCounters,&waitForReadDeadline,&readSocketUncore]() -> void
                     {
-                        socketStates[topology[core].socket].UncoreCounterState::readAndAggregate(MSR[core]); // read package C state counters
+                        waitForReadDeadline();
+                        coreStates[core].readAndAggregate(MSR[core]);
+                        if (readAndAggregateSocketUncoreCounters)
+                        {
+                            socketStates[topology[core].socket].UncoreCounterState::readAndAggregate(MSR[core]); // read package C state counters
+                        }
+                        readMSRs(MSR[core], threadMSRConfig, coreStates[core]);
+                        for (uint32 s = 0; s < (uint32)num_sockets && readAndAggregateSocketUncoreCounters; ++s)
+                        {
+                            if (socketRefCore[s] == core)
+                            {
+                                // right after the core read at the shared deadline
+                                readSocketUncore(s, core);
+                            }
+                        }
                     }
-                    readMSRs(MSR[core], threadMSRConfig, coreStates[core]);
-                }
-            );
+                );
+                asyncCoreResults.push_back(task.get_future());
+                coreTaskQueues[core]->push(task);
+            }
+            // std::cout << "DEBUG2: " << core << " " << coreStates[core].InstRetiredAny << " \n";
+        }
+        // std::cout << std::flush;
+        for (uint32 s = 0; s < (uint32)num_sockets && readAndAggregateSocketUncoreCounters; ++s)
+        {
+            int32 refCore = socketRefCore[s];
+            if (refCore >= 0 && isCoreOnline(refCore))
+            {
+                continue; // read by the task of the reference core
+            }
+            if (refCore<0) refCore = 0;
+            std::packaged_task<void()> task([s, refCore, &waitForReadDeadline, &readSocketUncore]() -> void
+                {
+                    waitForReadDeadline();
+                    readSocketUncore(s, refCore);
+                } );
             asyncCoreResults.push_back(task.get_future());
-            coreTaskQueues[core]->push(task);
+            coreTaskQueues[refCore]->push(task);
         }
-        // std::cout << "DEBUG2: " << core << " " << coreStates[core].InstRetiredAny << " \n";
     }
-    // std::cout << std::flush;
-    for (uint32 s = 0; s < (uint32)num_sockets && readAndAggregateSocketUncoreCounters; ++s)
+    if (readBarrier)
     {
-        int32 refCore = socketRefCore[s];
-        if (refCore<0) refCore = 0;
-        std::packaged_task<void()> task([this, s, &socketStates, refCore]() -> void
-            {
-                readAndAggregateUncoreMCCounters(s, socketStates[s]);
-                readAndAggregateEnergyCounters(s, socketStates[s]);
-                readPackageThermalHeadroom(s, socketStates[s]);
-                readMSRs(MSR[refCore], packageMSRConfig, socketStates[s]);
-            } );
-        asyncCoreResults.push_back(task.get_future());
-        coreTaskQueues[refCore]->push(task);
+        updateReadBarrierLeadTicks(RDTSC() - dispatchStartTSC);
     }
 
     if (readAndAggregateSocketUncoreCounters)
     {
+        waitForReadDeadline();
+        auto & readTSC = systemState.UncoreReadTSC;
+        readTSC.add(RDTSC());
         readQPICounters(systemState);
+        readTSC.add(RDTSC());
         readPCICFGRegisters(systemState);
+        readTSC.add(RDTSC());
         readMMIORegisters(systemState);
+        readTSC.add(RDTSC());
         readPMTRegisters(systemState);
+        readTSC.add(RDTSC());
     }
 
     for (auto & ar : asyncCoreResults)
         ar.wait();
 
+    OverheadScope aggregationOverhead(OverheadStats::AggregationPhase);
     for (int32 core = 0; core < num_cores; ++core)
     {   // aggregate core counters into sockets
         if(isCoreOnline(core))
@@ -6770,6 +6955,20 @@ void PCM::getAllCounterStates(SystemCounterState & systemState, std::vector<Sock
     }
 }
 
+uint64 PCM::getReadBarrierLeadTicks() const
+{
+    const uint64 ticksPerUs = (std::max)(getNominalFrequency() / 1000000ULL, 1ULL);
+    // before the first measurement of the dispatch time
+    return readBarrierLeadTicks ? readBarrierLeadTicks : 200ULL * ticksPerUs;
+}
+
+void PCM::updateReadBarrierLeadTicks(const uint64 dispatchTicks)
+{
+    const uint64 ticksPerUs = (std::max)(getNominalFrequency() / 1000000ULL, 1ULL);
+    // twice the last dispatch time plus a margin for the wake up of the workers
+    readBarrierLeadTicks = (std::max)(2ULL * dispatchTicks + 10ULL * ticksPerUs, 20ULL * ticksPerUs);
+}
+
 void PCM::getUncoreCounterStates(SystemCounterState & systemState, std::vector<SocketCounterState> & socketStates)
 {
     // clear and zero-initialize all inputs
@@ -6893,70 +7092,99 @@ bool PCM::isSomeCoreOfflined()
     return !(getNumOnlineCores() == max_num_lcores);
 }
 
-ServerUncoreCounterState PCM::getServerUncoreCounterState(uint32 socket)
+ServerUncoreCounterState PCM::getServerUncoreCounterState(uint32 socket, const uint64 unitMask)
 {
     ServerUncoreCounterState result;
-    if (socket < serverBW.size() && serverBW[socket].get())
+    readServerUncoreCounterState(socket, result, unitMask);
+    return result;
+}
+
+void PCM::readServerUncoreCounterState(uint32 socket, ServerUncoreCounterState & result, const uint64 unitMask)
+{
+    auto selected = [&unitMask](const uint64 units) { return (unitMask & units) != 0; };
+    // time stamped before the first and after each unit group, see getReadSkewUs
+    result.UncoreReadTSC.add(RDTSC());
+    if (selected(FREE_RUNNING_UNITS) && socket < serverBW.size() && serverBW[socket].get())
     {
-        result.freeRunningCounter[ServerUncoreCounterState::ImcReads] = serverBW[socket]->getImcReads();
-        result.freeRunningCounter[ServerUncoreCounterState::ImcWrites] = serverBW[socket]->getImcWrites();
-        result.freeRunningCounter[ServerUncoreCounterState::PMMReads] = serverBW[socket]->getPMMReads();
-        result.freeRunningCounter[ServerUncoreCounterState::PMMWrites] = serverBW[socket]->getPMMWrites();
+        const auto counters = serverBW[socket]->readCounters();
+        result.freeRunningCounter[ServerUncoreCounterState::ImcReads] = counters[ServerBW::ImcReads];
+        result.freeRunningCounter[ServerUncoreCounterState::ImcWrites] = counters[ServerBW::ImcWrites];
+        result.freeRunningCounter[ServerUncoreCounterState::PMMReads] = counters[ServerBW::PMMReads];
+        result.freeRunningCounter[ServerUncoreCounterState::PMMWrites] = counters[ServerBW::PMMWrites];
+        result.UncoreReadTSC.add(RDTSC());
     }
-    if(serverUncorePMUs.size() && serverUncorePMUs[socket].get())
+    if (selected(XPI_UNITS | M3UPI_UNITS | MC_UNITS | EDC_UNITS | M2M_UNITS | HA_UNITS)
+        && serverUncorePMUs.size() && serverUncorePMUs[socket].get())
     {
         serverUncorePMUs[socket]->freezeCounters();
-        for(uint32 port=0;port < (uint32)serverUncorePMUs[socket]->getNumQPIPorts();++port)
         {
-            assert(port < result.xPICounter.size());
-            for (uint32 cnt = 0; cnt < ServerUncoreCounterState::maxCounters; ++cnt)
-                result.xPICounter[port][cnt] = serverUncorePMUs[socket]->getQPILLCounter(port, cnt);
-            assert(port < result.M3UPICounter.size());
-            for (uint32 cnt = 0; cnt < ServerUncoreCounterState::maxCounters; ++cnt)
-                result.M3UPICounter[port][cnt] = serverUncorePMUs[socket]->getM3UPICounter(port, cnt);
-        }
-        for (uint32 channel = 0; channel < (uint32)serverUncorePMUs[socket]->getNumMCChannels(); ++channel)
+            ServerUncorePMUs::CounterBatchScope batch(*serverUncorePMUs[socket], unitMask);
+            for(uint32 port=0;port < (uint32)serverUncorePMUs[socket]->getNumQPIPorts();++port)
+            {
+                if (selected(XPI_UNITS))
+                {
+                    assert(port < result.xPICounter.size());
+                    for (uint32 cnt = 0; cnt < ServerUncoreCounterState::maxCounters; ++cnt)
+                        result.xPICounter[port][cnt] = serverUncorePMUs[socket]->getQPILLCounter(port, cnt);
+                }
+                if (selected(M3UPI_UNITS))
+                {
+                    assert(port < result.M3UPICounter.size());
+                    for (uint32 cnt = 0; cnt < ServerUncoreCounterState::maxCounters; ++cnt)
+                        result.M3UPICounter[port][cnt] = serverUncorePMUs[socket]->getM3UPICounter(port, cnt);
+                }
+            }
+            for (uint32 channel = 0; selected(MC_UNITS) && channel < (uint32)serverUncorePMUs[socket]->getNumMCChannels(); ++channel)
+            {
+                assert(channel < result.DRAMClocks.size());
+                result.DRAMClocks[channel] = serverUncorePMUs[socket]->getDRAMClocks(channel);
+                assert(channel < result.MCCounter.size());
+                for (uint32 cnt = 0; cnt < ServerUncoreCounterState::maxCounters; ++cnt)
+                    result.MCCounter[channel][cnt] = serverUncorePMUs[socket]->getMCCounter(channel, cnt);
+            }
+            for (uint32 channel = 0; selected(EDC_UNITS) && channel < (uint32)serverUncorePMUs[socket]->getNumEDCChannels(); ++channel)
+            {
+                assert(channel < result.HBMClocks.size());
+                result.HBMClocks[channel] = serverUncorePMUs[socket]->getHBMClocks(channel);
+                assert(channel < result.EDCCounter.size());
+                for (uint32 cnt = 0; cnt < ServerUncoreCounterState::maxCounters; ++cnt)
+                    result.EDCCounter[channel][cnt] = serverUncorePMUs[socket]->getEDCCounter(channel, cnt);
+            }
+        for (uint32 controller = 0; controller < (uint32)serverUncorePMUs[socket]->getNumMC(); ++controller)
         {
-            assert(channel < result.DRAMClocks.size());
-            result.DRAMClocks[channel] = serverUncorePMUs[socket]->getDRAMClocks(channel);
-            assert(channel < result.MCCounter.size());
-            for (uint32 cnt = 0; cnt < ServerUncoreCounterState::maxCounters; ++cnt)
-                result.MCCounter[channel][cnt] = serverUncorePMUs[socket]->getMCCounter(channel, cnt);
+          if (selected(M2M_UNITS))
+          {
+              assert(controller < result.M2MCounter.size());
+              for (uint32 cnt = 0; cnt < ServerUncoreCounterState::maxCounters; ++cnt)
+                  result.M2MCounter[controller][cnt] = serverUncorePMUs[socket]->getM2MCounter(controller, cnt);
+          }
+          if (selected(HA_UNITS))
+          {
+              assert(controller < result.HACounter.size());
+              for (uint32 cnt = 0; cnt < ServerUncoreCounterState::maxCounters; ++cnt)
+                  result.HACounter[controller][cnt] = serverUncorePMUs[socket]->getHACounter(controller, cnt);
+          }
         }
-        for (uint32 channel = 0; channel < (uint32)serverUncorePMUs[socket]->getNumEDCChannels(); ++channel)
-        {
-            assert(channel < result.HBMClocks.size());
-            result.HBMClocks[channel] = serverUncorePMUs[socket]->getHBMClocks(channel);
-            assert(channel < result.EDCCounter.size());
-            for (uint32 cnt = 0; cnt < ServerUncoreCounterState::maxCounters; ++cnt)
-                result.EDCCounter[channel][cnt] = serverUncorePMUs[socket]->getEDCCounter(channel, cnt);
         }
-    for (uint32 controller = 0; controller < (uint32)serverUncorePMUs[socket]->getNumMC(); ++controller)
-    {
-      assert(controller < result.M2MCounter.size());
-      for (uint32 cnt = 0; cnt < ServerUncoreCounterState::maxCounters; ++cnt)
-          result.M2MCounter[controller][cnt] = serverUncorePMUs[socket]->getM2MCounter(controller, cnt);
-      assert(controller < result.HACounter.size());
-      for (uint32 cnt = 0; cnt < ServerUncoreCounterState::maxCounters; ++cnt)
-          result.HACounter[controller][cnt] = serverUncorePMUs[socket]->getHACounter(controller, cnt);
-    }
+        result.UncoreReadTSC.add(RDTSC());
         serverUncorePMUs[socket]->unfreezeCounters();
     }
-    if (MSR.size())
+    const uint64 msrUnits = ~(FREE_RUNNING_UNITS | XPI_UNITS | M3UPI_UNITS | MC_UNITS | EDC_UNITS | M2M_UNITS | HA_UNITS | ENERGY_UNITS);
+    if (MSR.size() && selected(msrUnits))
     {
         uint32 refCore = socketRefCore[socket];
         TemporalThreadAffinity tempThreadAffinity(refCore);
 
-        readUncoreCounterValues(result, socket);
+        readUncoreCounterValues(result, socket, unitMask);
 
-        for (uint32 stack = 0; socket < iioPMUs.size() && stack < iioPMUs[socket].size() && stack < ServerUncoreCounterState::maxIIOStacks; ++stack)
+        for (uint32 stack = 0; selected(IIO_UNITS) && socket < iioPMUs.size() && stack < iioPMUs[socket].size() && stack < ServerUncoreCounterState::maxIIOStacks; ++stack)
         {
             for (int i = 0; i < ServerUncoreCounterState::maxCounters && size_t(i) < iioPMUs[socket][stack].size(); ++i)
             {
                 result.IIOCounter[stack][i] = *(iioPMUs[socket][stack].counterValue[i]);
             }
         }
-        for (uint32 stack = 0; socket < irpPMUs.size() && stack < irpPMUs[socket].size() && stack < ServerUncoreCounterState::maxIIOStacks; ++stack)
+        for (uint32 stack = 0; selected(IRP_UNITS) && socket < irpPMUs.size() && stack < irpPMUs[socket].size() && stack < ServerUncoreCounterState::maxIIOStacks; ++stack)
         {
             for (int i = 0; i < ServerUncoreCounterState::maxCounters && size_t(i) < irpPMUs[socket][stack].size(); ++i)
             {
@@ -6967,9 +7195,12 @@ ServerUncoreCounterState PCM::getServerUncoreCounterState(uint32 socket)
             }
         }
 
-        result.UncClocks = getUncoreClocks(socket);
+        if (selected(UNCORE_CLOCK_UNITS))
+        {
+            result.UncClocks = getUncoreClocks(socket);
+        }
 
-        for (size_t p = 0; p < getNumCXLPorts(socket); ++p)
+        for (size_t p = 0; selected(CXL_UNITS) && p < getNumCXLPorts(socket); ++p)
         {
             for (int i = 0; i < ServerUncoreCounterState::maxCounters && socket < cxlPMUs.size() && size_t(i) < cxlPMUs[socket][p].first.size(); ++i)
             {
@@ -6980,18 +7211,28 @@ ServerUncoreCounterState PCM::getServerUncoreCounterState(uint32 socket)
                 result.CXLDPCounter[p][i] = *cxlPMUs[socket][p].second.counterValue[i];
             }
         }
-        uint64 val=0;
-        //MSR[refCore]->read(MSR_PKG_ENERGY_STATUS,&val);
-        //std::cout << "Energy status: " << val << "\n";
-        MSR[refCore]->read(MSR_PACKAGE_THERM_STATUS,&val);
-        result.PackageThermalHeadroom = extractThermalHeadroom(val);
-        result.InvariantTSC = getInvariantTSC_Fast(refCore);
-        readAndAggregatePackageCStateResidencies(MSR[refCore], result);
+        if (selected(PACKAGE_UNITS))
+        {
+            uint64 val=0;
+            //MSR[refCore]->read(MSR_PKG_ENERGY_STATUS,&val);
+            //std::cout << "Energy status: " << val << "\n";
+            MSR[refCore]->read(MSR_PACKAGE_THERM_STATUS,&val);
+            result.PackageThermalHeadroom = extractThermalHeadroom(val);
+            result.InvariantTSC = getInvariantTSC_Fast(refCore);
+            std::fill(result.CStateResidency, result.CStateResidency + PCM::MAX_C_STATE + 1, 0ULL);
+            readAndAggregatePackageCStateResidencies(MSR[refCore], result);
+        }
+        result.UncoreReadTSC.add(RDTSC());
     }
     // std::cout << std::flush;
-    readAndAggregateEnergyCounters(socket, result);
-
-    return result;
+    if (selected(ENERGY_UNITS))
+    {
+        result.PackageEnergyStatus = 0;
+        result.DRAMEnergyStatus = 0;
+        std::fill(result.PPEnergyStatus, result.PPEnergyStatus + PCM::MAX_PP + 1, 0ULL);
+        readAndAggregateEnergyCounters(socket, result);
+        result.UncoreReadTSC.add(RDTSC());
+    }
 }
 
 #ifndef _MSC_VER
@@ -8855,6 +9096,10 @@ void ServerUncorePMUs::cleanupQPIHandles()
         if (!i->valid())
         {
             xpiPMUs.erase(i);
+            for (auto & batch : counterBatches)
+            {
+                batch.second.planned = false; // plan the batch again without the registers of the link
+            }
             cleanupQPIHandles();
             return;
         }
@@ -9256,6 +9501,48 @@ void ServerUncorePMUs::unfreezeCounters()
     }
 }
 
+ServerUncorePMUs::CounterBatchScope::CounterBatchScope(ServerUncorePMUs & pmus_, const uint64 unitMask) :
+    pmus(pmus_),
+    lock(pmus_.counterBatchMutex)
+{
+    const std::pair<uint64, UncorePMUVector *> units[] = {
+        { PCM::XPI_UNITS, &pmus.xpiPMUs },
+        { PCM::M3UPI_UNITS, &pmus.m3upiPMUs },
+        { PCM::MC_UNITS, &pmus.imcPMUs },
+        { PCM::EDC_UNITS, &pmus.edcPMUs },
+        { PCM::M2M_UNITS, &pmus.m2mPMUs },
+        { PCM::HA_UNITS, &pmus.haPMUs }
+    };
+    for (const auto & unit : units)
+    {
+        if ((unitMask & unit.first) == 0)
+        {
+            continue;
+        }
+        CounterBatch & batch = pmus.counterBatches[unit.first];
+        if (batch.planned == false)
+        {
+            std::vector<std::shared_ptr<HWRegister> > regs;
+            for (auto & pmu : *unit.second)
+            {
+                regs.insert(regs.end(), pmu.counterValue.begin(), pmu.counterValue.end());
+                regs.push_back(pmu.fixedCounterValue);
+            }
+            batch.registers.build(regs);
+            batch.planned = true;
+        }
+        batch.registers.read();
+    }
+}
+
+ServerUncorePMUs::CounterBatchScope::~CounterBatchScope()
+{
+    for (auto & batch : pmus.counterBatches)
+    {
+        batch.second.registers.invalidate();
+    }
+}
+
 uint64 ServerUncorePMUs::getQPIClocks(uint32 port)
 {
     return getQPILLCounter(port, ServerUncoreCounterState::EventPosition::xPI_CLOCKTICKS);
@@ -10464,24 +10751,247 @@ void PCM::initCHARequestEvents(uint64 * config)
     }
 }
 
-CounterWidthExtender::CounterWidthExtender(AbstractRawCounter * raw_counter_, uint64 counter_width_, uint32 watchdog_delay_ms_) : raw_counter(raw_counter_), counter_width(counter_width_), watchdog_delay_ms(watchdog_delay_ms_)
+/*
+    Overflow tracking for all CounterWidthExtender instances: a single thread keeps the deadlines
+    of all registered extenders in a heap. When the earliest deadline expires it also takes all
+    extenders that are due soon (within 1/8 of their period), so extenders with the same period
+    share one wakeup. The reads are grouped by core and run on the core task queue workers
+    without holding the service lock, so add() and remove() never wait for a batch of reads.
+*/
+class CounterWidthExtenderService
 {
-    last_raw_value = (*raw_counter)();
-    extended_value = last_raw_value;
-    //std::cout << "Initial Value " << extended_value << "\n";
-    UpdateThread = new std::thread(
-        [&]() {
+    typedef std::chrono::steady_clock Clock;
+    enum ReadState
+    {
+        Idle,
+        Reading,
+        Removed
+    };
+    struct Extender
+    {
+        CounterWidthExtender * extender;
+        int32 core;
+        Clock::duration period;
+        // shared with the queued reads: an extender is read only if it moves from Idle to Reading
+        std::shared_ptr<std::atomic<int> > state;
+    };
+    struct Deadline
+    {
+        Clock::time_point time;
+        uint64 id;
+        bool operator > (const Deadline & other) const { return time > other.time; }
+    };
+    std::mutex m;
+    std::condition_variable condVar;
+    std::condition_variable readDone;
+    std::priority_queue<Deadline, std::vector<Deadline>, std::greater<Deadline> > deadlines;
+    std::unordered_map<uint64, Extender> extenders;
+    std::vector<std::shared_ptr<CoreTaskQueue> > coreTaskQueues;
+    uint64 nextId = 1;
+    bool started = false;
+
+    CounterWidthExtenderService() = default;
+    CounterWidthExtenderService(const CounterWidthExtenderService &) = delete;
+    CounterWidthExtenderService & operator = (const CounterWidthExtenderService &) = delete;
+
+    static bool onCoreTaskQueue(const std::vector<std::shared_ptr<CoreTaskQueue> > & queues, const int32 core)
+    {
+        return core >= 0 && core < (int32)queues.size() && queues[core].get();
+    }
+
+    void finishRead(const Extender & e)
+    {
+        e.state->store(Idle);
+        {
+            // a remove() that saw Reading is either not waiting yet or already waiting
+            std::lock_guard<std::mutex> _(m);
+        }
+        readDone.notify_all();
+    }
+
+    void readAll(const std::vector<Extender> & batch)
+    {
+        for (const auto & e : batch)
+        {
+            int expected = Idle;
+            if (e.state->compare_exchange_strong(expected, Reading) == false)
+            {
+                // removed after the batch was built
+                continue;
+            }
+            try {
+                /* uint64 dummy = */ e.extender->read();
+            }
+            catch (...)
+            {
+                finishRead(e);
+                throw;
+            }
+            finishRead(e);
+        }
+    }
+
+    void run()
+    {
+        std::unordered_map<int32, std::vector<Extender> > batches;
+        std::vector<std::shared_ptr<CoreTaskQueue> > queues;
+        std::vector<std::future<void> > pending;
+        std::unique_lock<std::mutex> lock(m);
         while (1)
         {
-            MySleepMs(static_cast<int>(this->watchdog_delay_ms));
-            /* uint64 dummy = */ this->read();
+            if (deadlines.empty())
+            {
+                condVar.wait(lock);
+                continue;
+            }
+            const auto first = deadlines.top().time;
+            if (Clock::now() < first)
+            {
+                // woken up earlier if an extender with an earlier deadline is added
+                condVar.wait_until(lock, first);
+                continue;
+            }
+            const auto now = Clock::now();
+            for (auto & b : batches)
+            {
+                b.second.clear();
+            }
+            while (!deadlines.empty())
+            {
+                const auto d = deadlines.top();
+                const auto e = extenders.find(d.id);
+                if (e == extenders.end())
+                {
+                    // unregistered
+                    deadlines.pop();
+                    continue;
+                }
+                if (d.time > now + e->second.period / 8)
+                {
+                    break;
+                }
+                deadlines.pop();
+                batches[e->second.core].push_back(e->second);
+                deadlines.push(Deadline{now + e->second.period, d.id});
+            }
+            queues = coreTaskQueues;
+            lock.unlock();
+            pending.clear();
+            for (auto & b : batches)
+            {
+                if (!b.second.empty() && onCoreTaskQueue(queues, b.first))
+                {
+                    const auto & batch = b.second;
+                    std::packaged_task<void()> task([this, &batch]() { readAll(batch); });
+                    pending.push_back(task.get_future());
+                    queues[b.first]->push(task);
+                }
+            }
+            try {
+                for (auto & b : batches)
+                {
+                    if (!onCoreTaskQueue(queues, b.first))
+                    {
+                        readAll(b.second);
+                    }
+                }
+            }
+            catch (const std::exception & e)
+            {
+                std::cerr << "PCM Error. Exception in CounterWidthExtenderService: " << e.what() << "\n";
+            }
+            for (auto & f : pending)
+            {
+                try {
+                    f.get();
+                }
+                catch (const std::exception & e)
+                {
+                    std::cerr << "PCM Error. Exception in CounterWidthExtenderService: " << e.what() << "\n";
+                }
+            }
+            lock.lock();
         }
     }
-    );
+
+public:
+    static CounterWidthExtenderService & getInstance()
+    {
+        // never destroyed: the service thread runs until the process exits
+        static CounterWidthExtenderService * instance = new CounterWidthExtenderService();
+        return *instance;
+    }
+
+    uint64 add(CounterWidthExtender * extender)
+    {
+        int32 core = -1;
+        try {
+            core = extender->getCore();
+        }
+        catch (const std::exception &)
+        {
+            // offline core: read from the service thread
+        }
+        const auto period = std::chrono::duration_cast<Clock::duration>(std::chrono::milliseconds(extender->getWatchdogDelayMs()));
+        std::unique_lock<std::mutex> lock(m);
+        const uint64 id = nextId++;
+        extenders[id] = Extender{extender, core, period, std::make_shared<std::atomic<int> >(Idle)};
+        const Deadline deadline{Clock::now() + period, id};
+        const bool earliest = deadlines.empty() || deadline.time < deadlines.top().time;
+        deadlines.push(deadline);
+        if (!started)
+        {
+            std::thread(&CounterWidthExtenderService::run, this).detach();
+            started = true;
+        }
+        else if (earliest)
+        {
+            condVar.notify_one();
+        }
+        return id;
+    }
+
+    //! returns after an ongoing read of the extender has finished; queued reads skip it afterwards
+    void remove(const uint64 id)
+    {
+        std::unique_lock<std::mutex> lock(m);
+        const auto e = extenders.find(id);
+        if (e == extenders.end())
+        {
+            return;
+        }
+        const auto state = e->second.state;
+        extenders.erase(e);
+        // the stale deadline is dropped when it reaches the top of the heap
+        readDone.wait(lock, [&state]() {
+            int expected = Idle;
+            return state->compare_exchange_strong(expected, Removed);
+        });
+    }
+
+    void setCoreTaskQueues(const std::vector<std::shared_ptr<CoreTaskQueue> > & queues)
+    {
+        std::unique_lock<std::mutex> lock(m);
+        coreTaskQueues = queues;
+    }
+};
+
+void CounterWidthExtender::setCoreTaskQueues(const std::vector<std::shared_ptr<CoreTaskQueue> > & queues)
+{
+    CounterWidthExtenderService::getInstance().setCoreTaskQueues(queues);
+}
+
+CounterWidthExtender::CounterWidthExtender(AbstractRawCounter * raw_counter_, uint64 counter_width_, uint32 watchdog_delay_ms_) : raw_counter(raw_counter_), counter_width(counter_width_), watchdog_delay_ms(watchdog_delay_ms_)
+{
+    const uint64 initial_value = (*raw_counter)();
+    last_raw_value = initial_value;
+    extended_value = initial_value;
+    //std::cout << "Initial Value " << initial_value << "\n";
+    serviceId = CounterWidthExtenderService::getInstance().add(this);
 }
 CounterWidthExtender::~CounterWidthExtender()
 {
-    deleteAndNullify(UpdateThread);
+    CounterWidthExtenderService::getInstance().remove(serviceId);
     deleteAndNullify(raw_counter);
 }
 
@@ -10539,6 +11049,103 @@ uint32 UncorePMU::getCPUModel()
     return cpu_model_;
 }
 
+void PCICFGReadBatch::build(const std::vector<std::shared_ptr<HWRegister> > & regs)
+{
+    clear();
+    struct Entry
+    {
+        std::shared_ptr<HWRegister> reg;
+        PciHandleType * handle;
+        uint64 offset;
+        uint32 size;
+    };
+    std::vector<Entry> entries;
+    std::map<PciHandleType *, std::shared_ptr<PciHandleType> > handles;
+    for (const auto & reg : regs)
+    {
+        if (reg.get() == nullptr) continue;
+        if (auto r64 = dynamic_cast<PCICFGRegister64 *>(reg.get()))
+        {
+            if (r64->batch || r64->offset % sizeof(uint32)) continue;
+            entries.push_back(Entry{reg, r64->handle.get(), (uint64)r64->offset, (uint32)sizeof(uint64)});
+            handles[r64->handle.get()] = r64->handle;
+        }
+        else if (auto r32 = dynamic_cast<PCICFGRegister32 *>(reg.get()))
+        {
+            if (r32->batch || r32->offset % sizeof(uint32)) continue;
+            entries.push_back(Entry{reg, r32->handle.get(), (uint64)r32->offset, (uint32)sizeof(uint32)});
+            handles[r32->handle.get()] = r32->handle;
+        }
+    }
+    std::sort(entries.begin(), entries.end(), [](const Entry & a, const Entry & b)
+    {
+        return (a.handle != b.handle) ? (std::less<PciHandleType *>()(a.handle, b.handle)) : (a.offset < b.offset);
+    });
+    size_t bufferSize = 0;
+    for (const auto & e : entries)
+    {
+        if (runs.empty() || runs.back().handle.get() != e.handle || e.offset > runs.back().offset + runs.back().size + MaxGap)
+        {
+            runs.push_back(Run{handles[e.handle], e.offset, e.size, bufferSize});
+        }
+        else
+        {
+            Run & run = runs.back();
+            run.size = (std::max)(run.size, (uint32)(e.offset + e.size - run.offset));
+        }
+        registers.push_back(e.reg);
+        const size_t pos = runs.back().bufferPos + (size_t)(e.offset - runs.back().offset);
+        if (auto r64 = dynamic_cast<PCICFGRegister64 *>(e.reg.get()))
+        {
+            r64->batch = this;
+            r64->batchPos = pos;
+        }
+        else if (auto r32 = dynamic_cast<PCICFGRegister32 *>(e.reg.get()))
+        {
+            r32->batch = this;
+            r32->batchPos = pos;
+        }
+        // keep the runs 8 byte aligned in the buffer
+        bufferSize = runs.back().bufferPos + ((runs.back().size + sizeof(uint64) - 1) / sizeof(uint64)) * sizeof(uint64);
+    }
+    buffer.resize(bufferSize / sizeof(uint64));
+}
+
+void PCICFGReadBatch::clear()
+{
+    invalidate();
+    for (auto & reg : registers)
+    {
+        if (auto r64 = dynamic_cast<PCICFGRegister64 *>(reg.get()))
+        {
+            r64->batch = nullptr;
+        }
+        else if (auto r32 = dynamic_cast<PCICFGRegister32 *>(reg.get()))
+        {
+            r32->batch = nullptr;
+        }
+    }
+    registers.clear();
+    runs.clear();
+    buffer.clear();
+}
+
+bool PCICFGReadBatch::read()
+{
+    invalidate();
+    char * data = (char *)buffer.data();
+    for (const auto & run : runs)
+    {
+        OverheadScope overhead(OverheadStats::PCICFGAccess);
+        if (run.handle->readBlock(run.offset, data + run.bufferPos, run.size) != (int32)run.size)
+        {
+            return false;
+        }
+    }
+    owner.store(std::this_thread::get_id());
+    return true;
+}
+
 void UncorePMU::cleanup()
 {
     for (auto& cc: counterControl)
@@ -26,6 +26,7 @@
 #include "types.h"
 #include "topologyentry.h"
 #include "msr.h"
+#include "overhead_stats.h"
 #include "pci.h"
 #include "tpmi.h"
 #include "pmt.h"
@@ -41,6 +42,10 @@
 #include <memory>
 #include <map>
 #include <unordered_map>
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <chrono>
 #include <string.h>
 #include <assert.h>
 
@@ -99,10 +104,63 @@ public:
     virtual ~HWRegister() {}
 };
 
+/*! \brief Reads the PCICFG counter registers of several PMUs with one block read per contiguous register run
+
+    build() groups the registers by PCI function and merges registers at adjacent (or nearly adjacent)
+    offsets into runs. Between read() and invalidate() the attached registers return the values
+    fetched by read() on the calling thread instead of accessing the configuration space one by one.
+*/
+class PCICFGReadBatch
+{
+    struct Run
+    {
+        std::shared_ptr<PciHandleType> handle;
+        uint64 offset;
+        uint32 size;
+        size_t bufferPos;
+    };
+    std::vector<Run> runs;
+    std::vector<std::shared_ptr<HWRegister> > registers; // attached registers
+    std::vector<uint64> buffer;
+    std::atomic<std::thread::id> owner; // thread of the active batch read
+    PCICFGReadBatch(const PCICFGReadBatch &) = delete;
+    PCICFGReadBatch & operator = (const PCICFGReadBatch &) = delete;
+public:
+    enum { MaxGap = 32 }; // max bytes of unused registers read to merge two runs
+    PCICFGReadBatch() { }
+    ~PCICFGReadBatch() { clear(); }
+    //! \brief Plans the block reads for the PCICFGRegister64/32 registers in regs (other registers are ignored)
+    void build(const std::vector<std::shared_ptr<HWRegister> > & regs);
+    //! \brief Detaches all registers
+    void clear();
+    //! \brief Reads all runs and activates the batch for the calling thread
+    //! \return false if a block read failed, then the registers are read individually
+    bool read();
+    void invalidate() { owner.store(std::thread::id()); }
+    bool isActive() const { return owner.load(std::memory_order_relaxed) == std::this_thread::get_id(); }
+    uint64 get64(const size_t pos) const
+    {
+        uint64 value = 0;
+        memcpy(&value, ((const char *)buffer.data()) + pos, sizeof(uint64));
+        return value;
+    }
+    uint32 get32(const size_t pos) const
+    {
+        uint32 value = 0;
+        memcpy(&value, ((const char *)buffer.data()) + pos, sizeof(uint32));
+        return value;
+    }
+    size_t getNumRuns() const { return runs.size(); }
+    size_t getNumRegisters() const { return registers.size(); }
+};
+
 class PCICFGRegister64 : public HWRegister
 {
+    friend class PCICFGReadBatch;
     std::shared_ptr<PciHandleType> handle;
     size_t offset;
+    const PCICFGReadBatch * batch = nullptr;
+    size_t batchPos = 0;
 public:
     PCICFGRegister64(const std::shared_ptr<PciHandleType> & handle_, size_t offset_) :
         handle(handle_),
@@ -118,6 +176,11 @@ public:
     }
     operator uint64 ()  override
     {
+        if (batch && batch->isActive())
+        {
+            return batch->get64(batchPos);
+        }
+        OverheadScope overhead(OverheadStats::PCICFGAccess);
         uint64 result = 0;
         handle->read64(offset, &result);
         return result;
@@ -126,8 +189,11 @@ public:
 
 class PCICFGRegister32 : public HWRegister
 {
+    friend class PCICFGReadBatch;
     std::shared_ptr<PciHandleType> handle;
     size_t offset;
+    const PCICFGReadBatch * batch = nullptr;
+    size_t batchPos = 0;
 public:
     PCICFGRegister32(const std::shared_ptr<PciHandleType> & handle_, size_t offset_) :
         handle(handle_),
@@ -140,6 +206,11 @@ public:
     }
     operator uint64 () override
     {
+        if (batch && batch->isActive())
+        {
+            return batch->get32(batchPos);
+        }
+        OverheadScope overhead(OverheadStats::PCICFGAccess);
         uint32 result = 0;
         handle->read32(offset, &result);
         return result;
@@ -163,6 +234,7 @@ public:
     }
     operator uint64 () override
     {
+        OverheadScope overhead(OverheadStats::MMIOAccess);
         const uint64 val = handle->read64(offset);
         // std::cout << std::hex << "MMIORegister64 read " << val << " from offset " << offset << std::dec << std::endl;
         return val;
@@ -186,6 +258,7 @@ public:
     }
     operator uint64 () override
     {
+        OverheadScope overhead(OverheadStats::MMIOAccess);
         const uint64 val = (uint64)handle->read32(offset);
         // std::cout << std::hex << "MMIORegister32 read " << val << " from offset " << offset << std::dec << std::endl;
         return val;
@@ -371,6 +444,13 @@ class ServerUncorePMUs
     UncorePMUVector haPMUs;
     UncorePMUVector hbm_m2mPMUs;
     std::vector<UncorePMUVector*> allPMUs{ &imcPMUs, &edcPMUs, &xpiPMUs, &m3upiPMUs , &m2mPMUs, &haPMUs, &hbm_m2mPMUs };
+    struct CounterBatch
+    {
+        PCICFGReadBatch registers; // block reads of the counter registers, planned on first use
+        bool planned = false;
+    };
+    std::map<uint64, CounterBatch> counterBatches; // one per PCM::ServerUncoreUnits bit
+    std::mutex counterBatchMutex;
     std::vector<uint64> qpi_speed;
     std::vector<uint32> num_imc_channels; // number of memory channels in each memory controller
     std::vector<std::pair<uint32, uint32> > XPIRegisterLocation; // (device, function)
@@ -531,6 +611,19 @@ public:
     void freezeCounters();
     //! \brief Unfreezes event counting
     void unfreezeCounters();
+    //! \brief Reads the counter registers of the units selected by a PCM::ServerUncoreUnits mask with block
+    //!        reads; while the object exists the counter getters of the calling thread return these values
+    //!        (create it with frozen counters)
+    class CounterBatchScope
+    {
+        ServerUncorePMUs & pmus;
+        std::lock_guard<std::mutex> lock;
+        CounterBatchScope(const CounterBatchScope &) = delete;
+        CounterBatchScope & operator = (const CounterBatchScope &) = delete;
+    public:
+        CounterBatchScope(ServerUncorePMUs & pmus_, const uint64 unitMask);
+        ~CounterBatchScope();
+    };
 
     //! \brief Measures/computes the maximum theoretical QPI link bandwidth speed in GByte/seconds
     uint64 computeQPISpeed(const uint32 ref_core, const int cpumodel);
@@ -668,6 +761,32 @@ public:
         PCIE_GEN5x8_PMU_ID,
         INVALID_PMU_ID
     };
+    //! \brief Unit selection mask for getServerUncoreCounterState/readServerUncoreCounterState
+    enum ServerUncoreUnits : uint64
+    {
+        FREE_RUNNING_UNITS = 1ULL << 0,   // IMC/PMM free-running bandwidth counters
+        XPI_UNITS = 1ULL << 1,            // QPI/UPI link layer
+        M3UPI_UNITS = 1ULL << 2,
+        MC_UNITS = 1ULL << 3,             // IMC channel counters and DRAM clocks
+        EDC_UNITS = 1ULL << 4,            // EDC channel counters and HBM clocks
+        M2M_UNITS = 1ULL << 5,
+        HA_UNITS = 1ULL << 6,
+        IIO_UNITS = 1ULL << 7,
+        IRP_UNITS = 1ULL << 8,
+        CXL_UNITS = 1ULL << 9,
+        UNCORE_CLOCK_UNITS = 1ULL << 10,
+        PACKAGE_UNITS = 1ULL << 11,       // thermal headroom, invariant TSC, package C-state residencies
+        ENERGY_UNITS = 1ULL << 12,
+        GENERIC_UNCORE_PMU_UNITS_SHIFT = 32, // one bit per UncorePMUIDs entry starting from this position
+        CBO_UNITS = 1ULL << (GENERIC_UNCORE_PMU_UNITS_SHIFT + CBO_PMU_ID),
+        CHA_UNITS = CBO_UNITS,
+        ALL_SERVER_UNCORE_UNITS = ~0ULL
+    };
+    //! \brief Returns the unit mask bit selecting all units of the generic uncore PMU type pmu_id
+    static uint64 genericUncorePMUUnits(const int pmu_id)
+    {
+        return 1ULL << (GENERIC_UNCORE_PMU_UNITS_SHIFT + pmu_id);
+    }
 private:
     std::unordered_map<std::string, int> strToUncorePMUID_ {
         {"pciex8", PCIE_GEN5x8_PMU_ID},
@@ -748,7 +867,7 @@ private:
     }
 
     template <class T>
-    void readUncoreCounterValues(T& result, const size_t socket) const
+    void readUncoreCounterValues(T& result, const size_t socket, const uint64 unitMask = ALL_SERVER_UNCORE_UNITS) const
     {
         if (socket < uncorePMUs.size())
         {
@@ -760,6 +879,10 @@ private:
                 for (auto pmuIter = uncorePMUs[socket][die].begin(); pmuIter != uncorePMUs[socket][die].end(); ++pmuIter)
                 {
                     const auto & pmu_id = pmuIter->first;
+                    if ((unitMask & genericUncorePMUUnits(pmu_id)) == 0)
+                    {
+                        continue;
+                    }
                     result.Counters[die][pmu_id].resize(pmuIter->second.size());
                     for (size_t unit = 0; unit < pmuIter->second.size(); ++unit)
                     {
@@ -840,6 +963,17 @@ private:
 
     std::vector<std::shared_ptr<CoreTaskQueue> > coreTaskQueues;
 
+    std::vector<std::pair<std::string, double> > startupPhaseTimes; // seconds per initialization phase
+    std::chrono::steady_clock::time_point startupPhaseStart;
+    size_t numConstructorPhases = 0; // the phases of program() follow
+    void endStartupPhase(const char * name); // records the time since the end of the previous phase
+
+    bool readBarrier = false;
+    uint64 readBarrierLeadTicks = 0; // TSC ticks between the start of the dispatch and the read deadline
+    std::atomic<uint64> readBarrierMisses{0};
+    uint64 getReadBarrierLeadTicks() const;
+    void updateReadBarrierLeadTicks(const uint64 dispatchTicks);
+
     bool L2CacheHitRatioAvailable;
     bool L3CacheHitRatioAvailable;
     bool L3CacheMissesAvailable;
@@ -1173,6 +1307,7 @@ private:
     bool discoverSystemTopology();
     void printSystemTopology() const;
     bool initMSR();
+    void initCoreTaskQueues();
     bool detectNominalFrequency();
     void showSpecControlMSRs();
     void initEnergyMonitoring();
@@ -1447,6 +1582,14 @@ public:
     */
     void checkError(const ErrorCode code);
 
+    /*! \brief Returns the durations of the initialization phases of PCM and of the last program() call
+        \return (phase name, seconds) pairs in the order of the phases
+    */
+    const std::vector<std::pair<std::string, double> > & getStartupPhaseTimes() const { return startupPhaseTimes; }
+
+    //! \brief Prints the durations of the initialization phases (printed by program() if PCM_PRINT_STARTUP_TIMES=1)
+    void printStartupPhaseTimes(std::ostream & out) const;
+
     /*! \brief Programs uncore latency counters on microarchitectures codename SandyBridge-EP and later Xeon uarch
         \param enable_pmm enables DDR/PMM. See possible profile values in pcm-latency.cpp example
 
@@ -1670,9 +1813,20 @@ public:
 
     /*! \brief Reads the power/energy counter state of a socket (works only on microarchitecture codename SandyBridge-EP)
         \param socket socket id
+        \param unitMask units to read (bitwise OR of ServerUncoreUnits), units not selected are left zero
         \return State of power counters in the socket
     */
-    ServerUncoreCounterState getServerUncoreCounterState(uint32 socket);
+    ServerUncoreCounterState getServerUncoreCounterState(uint32 socket, const uint64 unitMask = ALL_SERVER_UNCORE_UNITS);
+
+    /*! \brief Re-reads selected units of a server uncore counter state in place
+        \param socket socket id
+        \param result counter state to update, values of the units not selected are kept
+        \param unitMask units to read (bitwise OR of ServerUncoreUnits)
+
+        Cheaper than getServerUncoreCounterState when only a few units are needed (e.g. CHA counters
+        for event multiplexing) because the remaining PCI/MMIO/MSR registers are not accessed.
+    */
+    void readServerUncoreCounterState(uint32 socket, ServerUncoreCounterState & result, const uint64 unitMask = ALL_SERVER_UNCORE_UNITS);
 
     /*! \brief Cleanups resources and stops performance counting
 
@@ -1697,6 +1851,18 @@ public:
     */
     void getAllCounterStates(SystemCounterState & systemState, std::vector<SocketCounterState> & socketStates, std::vector<CoreCounterState> & coreStates, const bool readAndAggregateSocketUncoreCounters = true);
 
+    /*! \brief Enables or disables the read barrier of getAllCounterStates
+
+        With the barrier all core and socket read tasks spin until a common TSC deadline before
+        reading the counters, so the read skew across cores (see getReadSkewUs) is bounded by the
+        wake up and read jitter of the tasks instead of their dispatch order. The deadline is
+        placed after the expected dispatch time, measured on the previous calls.
+    */
+    void setReadBarrier(const bool enable) { readBarrier = enable; }
+    bool getReadBarrier() const { return readBarrier; }
+    //! \brief Returns the number of read tasks that arrived after the barrier deadline
+    uint64 getReadBarrierMisses() const { return readBarrierMisses.load(); }
+
     /*! \brief Reads uncore counter states (including system and sockets) but no core counters
 
     \param systemState system counter state (return parameter)
@@ -1816,6 +1982,18 @@ public:
     */
     int32 getMaxCustomCoreEvents();
 
+    //! \brief Returns the number of general-purpose core counters used by the current core event programming
+    uint32 getNumUsedCoreGenCounters() const { return core_gen_counter_num_used; }
+
+    //! \brief Returns the width of the general-purpose core counters in bits
+    uint32 getCoreGenCounterWidth() const { return core_gen_counter_width; }
+
+    //! \brief Returns the width of the fixed core counters in bits
+    uint32 getCoreFixedCounterWidth() const { return core_fixed_counter_width; }
+
+    //! \brief Returns true if core counters are programmed through Linux perf (the kernel assigns the counter indices)
+    bool usesPerfForCoreCounters() const { return canUsePerf; }
+
     /*! \brief Returns cpu model id number from cpuid instruction
     */
     static int getCPUModelFromCPUID();
@@ -2201,6 +2379,17 @@ public:
     //! \brief Returns how many joules are in an internal processor energy unit
     double getJoulesPerEnergyUnit() const { return joulesPerEnergyUnit; }
 
+    //! \brief Returns how many joules are in an energy unit of the DRAM power domain
+    double getDRAMJoulesPerEnergyUnit() const;
+
+    //! \brief Returns the core used to access the per-socket MSRs of the socket
+    int32 getSocketRefCore(const uint32 socket) const { return socket < socketRefCore.size() ? socketRefCore[socket] : -1; }
+
+    //! \brief Reads the 64-bit extended package and DRAM energy counters of a socket
+    //!        (in energy units, DRAM counter is 0 if not available)
+    //! \return false if the package energy counter is not available
+    bool getEnergyStatus(const uint32 socket, uint64 & packageEnergy, uint64 & dramEnergy);
+
     //! \brief Returns thermal specification power of the package domain in Watt
     int32 getPackageThermalSpecPower() const { return pkgThermalSpecPower; }
 
@@ -2816,6 +3005,25 @@ public:
     ~PCM();
 };
 
+//! \brief Range of the time stamp counter values at which the counters of a state were read
+struct ReadTSCRange
+{
+    uint64 first = 0; // 0: no read recorded
+    uint64 last = 0;
+    void add(const uint64 tsc)
+    {
+        first = (first == 0) ? tsc : (std::min)(first, tsc);
+        last = (std::max)(last, tsc);
+    }
+    void merge(const ReadTSCRange & o)
+    {
+        if (o.first) add(o.first);
+        if (o.last) add(o.last);
+    }
+    bool valid() const { return first != 0; }
+    uint64 spread() const { return last - first; }
+};
+
 //! \brief Basic core counter state
 //!
 //! Intended only for derivation, but not for the direct use
@@ -2937,6 +3145,7 @@ protected:
     uint64 FrontendBoundSlots, BadSpeculationSlots, BackendBoundSlots, RetiringSlots, AllSlotsRaw;
     uint64 MemBoundSlots, FetchLatSlots, BrMispredSlots, HeavyOpsSlots;
     std::unordered_map<uint64, uint64> MSRValues;
+    ReadTSCRange CoreReadTSC; // when the core counters were read
 
 public:
     BasicCounterState() :
@@ -2974,6 +3183,7 @@ public:
             Event[i] += o.Event[i];
         }
         InvariantTSC += o.InvariantTSC;
+        CoreReadTSC.merge(o.CoreReadTSC);
         for (int i = 0; i <= (int)PCM::MAX_C_STATE; ++i)
             CStateResidency[i] += o.CStateResidency[i];
         // ThermalHeadroom is not accumulative
@@ -3009,6 +3219,9 @@ public:
 
     //! Returns current thermal headroom below TjMax
     int32 getThermalHeadroom() const { return ThermalHeadroom; }
+
+    //! Returns the range of TSC values at which the core counters were read (over all aggregated cores)
+    const ReadTSCRange & getCoreReadTSC() const { return CoreReadTSC; }
 };
 
 inline uint64 RDTSC()
@@ -3057,6 +3270,28 @@ int32 getThermalHeadroom(const CounterStateType & /* before */, const CounterSta
     return after.getThermalHeadroom();
 }
 
+/*! \brief Returns the time between the first and the last counter read of a sample in microseconds
+    \param range TSC range of the reads, e.g. state.getCoreReadTSC() or state.getUncoreReadTSC()
+    \return read skew in microseconds or 0 if no reads were recorded
+*/
+inline double getReadSkewUs(const ReadTSCRange & range)
+{
+    const uint64 freq = PCM::getInstance()->getNominalFrequency();
+    if (!range.valid() || freq == 0) return 0.;
+    return double(range.spread()) * 1e6 / double(freq);
+}
+
+/*! \brief Returns the read skew of all core and uncore counters of a sample in microseconds
+    \param state system or socket counter state filled by PCM::getAllCounterStates
+*/
+template <class CounterStateType>
+double getReadSkewUs(const CounterStateType & state)
+{
+    ReadTSCRange range = state.getCoreReadTSC();
+    range.merge(state.getUncoreReadTSC());
+    return getReadSkewUs(range);
+}
+
 /*! \brief Returns the ratio of QPI cycles in power saving half-lane mode
     \param port QPI port number
     \param before CPU counter state before the experiment
@@ -3368,30 +3603,7 @@ double getDRAMConsumedJoules(const CounterStateType & before, const CounterState
 {
     PCM * m = PCM::getInstance();
     if (!m) return -1.;
-    double dram_joules_per_energy_unit = 0.;
-    const auto cpu_model = m->getCPUModel();
-
-    if (PCM::HASWELLX == cpu_model
-        || PCM::BDX_DE == cpu_model
-        || PCM::BDX == cpu_model
-        || PCM::SKX == cpu_model
-        || PCM::ICX == cpu_model
-        || PCM::SRF == cpu_model
-        || PCM::KNL == cpu_model
-        ) {
-/* as described in sections 5.3.2 (DRAM_POWER_INFO) and 5.3.3 (DRAM_ENERGY_STATUS) of
- * Volume 2 (Registers) of
- * Intel Xeon E5-1600 v3 and Intel Xeon E5-2600 v3 (Haswell-EP) Datasheet (Ref 330784-001, Sept.2014)
- * ENERGY_UNIT for DRAM domain is fixed to 15.3 uJ for server HSX, BDW and KNL processors.
- */
-        dram_joules_per_energy_unit = 0.0000153;
-    } else {
-/* for all other processors (including Haswell client/mobile SKUs) the ENERGY_UNIT for DRAM domain
- * should be read from PACKAGE_POWER_SKU register (usually value around ~61uJ)
- */
-        dram_joules_per_energy_unit = m->getJoulesPerEnergyUnit();
-    }
-    return double(getDRAMConsumedEnergy(before, after)) * dram_joules_per_energy_unit;
+    return double(getDRAMConsumedEnergy(before, after)) * m->getDRAMJoulesPerEnergyUnit();
 }
 
 //! \brief Basic uncore counter state
@@ -3505,6 +3717,7 @@ protected:
     uint64 TORInsertsIAMiss;
     uint64 UncClocks;
     uint64 CStateResidency[PCM::MAX_C_STATE + 1];
+    ReadTSCRange UncoreReadTSC; // when the uncore counters were read
     void readAndAggregate(std::shared_ptr<SafeMsrHandle>);
 
 public:
@@ -3559,8 +3772,12 @@ public:
         UncClocks += o.UncClocks;
         for (int i = 0; i <= (int)PCM::MAX_C_STATE; ++i)
             CStateResidency[i] += o.CStateResidency[i];
+        UncoreReadTSC.merge(o.UncoreReadTSC);
         return *this;
     }
+
+    //! Returns the range of TSC values at which the uncore counters were read (over all aggregated units)
+    const ReadTSCRange & getUncoreReadTSC() const { return UncoreReadTSC; }
 };
 
 
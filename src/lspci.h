@@ -4,7 +4,15 @@
 #include <vector>
 #include <fstream>
 #include <memory>
+#include <string>
+#include <algorithm>
+#include <unordered_set>
+#include <map>
+#include <iterator>
 #include "cpucounters.h"
+#ifdef __linux__
+#include <dirent.h>
+#endif
 
 #if defined(_MSC_VER)
 #define PCI_IDS_PATH "pci.ids"
@@ -351,6 +359,59 @@ bool operator<(const bdf &l, const bdf &r) {
     return false; // bdf == bdf
 };
 
+/*! \brief PCI functions enumerated by the OS, read once from /sys/bus/pci/devices
+
+    Scans over all buses, devices and functions check the index first, so absent functions
+    cost no system calls. The index is not available on other OSes; there the devices are
+    probed with PciHandleType::exists, like with simulated hardware (PCM_SIMULATE).
+*/
+class PciDeviceIndex
+{
+    std::unordered_set<uint64_t> devices;
+    std::vector<std::string> names; // sorted sysfs names (dddd:bb:dd.f)
+    bool valid = false;
+
+    PciDeviceIndex()
+    {
+#ifdef __linux__
+        if (SimulatedHardware::get()) return; // the simulated devices are not in sysfs, probe them
+        DIR * dir = opendir("/sys/bus/pci/devices");
+        if (dir == nullptr) return;
+        struct dirent * entry = nullptr;
+        while ((entry = readdir(dir)) != nullptr)
+        {
+            uint32_t domain = 0, bus = 0, device = 0, function = 0;
+            if (sscanf(entry->d_name, "%x:%x:%x.%x", &domain, &bus, &device, &function) == 4)
+            {
+                devices.insert(key(domain, bus, device, function));
+                names.push_back(entry->d_name);
+            }
+        }
+        closedir(dir);
+        std::sort(names.begin(), names.end());
+        valid = !devices.empty();
+#endif
+    }
+    PciDeviceIndex(const PciDeviceIndex &) = delete;
+    PciDeviceIndex & operator = (const PciDeviceIndex &) = delete;
+    static uint64_t key(uint32_t domain, uint32_t bus, uint32_t device, uint32_t function)
+    {
+        return (uint64_t(domain) << 16) | ((bus & 0xff) << 8) | ((device & 0x1f) << 3) | (function & 0x7);
+    }
+public:
+    static const PciDeviceIndex & getInstance()
+    {
+        static PciDeviceIndex instance; // thread-safe initialization, probes may run in parallel
+        return instance;
+    }
+    bool isValid() const { return valid; }
+    bool contains(const struct bdf & address) const
+    {
+        return devices.count(key(address.domainno, address.busno, address.devno, address.funcno)) > 0;
+    }
+    const std::vector<std::string> & getNames() const { return names; }
+};
+
 void probe_capability_pci_express(struct pci *p, uint32_t cap_ptr)
 {
     struct cap {
@@ -385,6 +446,13 @@ bool probe_pci(struct pci *p)
     uint32 value;
     p->exist = false;
     struct bdf *bdf = &p->bdf;
+#if defined(__linux__) && !defined(PCM_USE_PCI_MM_LINUX)
+    // with MMCONFIG access devices hidden from the OS can be probed too, so the index is not used then
+    const auto & index = PciDeviceIndex::getInstance();
+    if (index.isValid() && !index.contains(*bdf)) {
+        return false;
+    }
+#endif
     if (PciHandleType::exists(bdf->domainno, bdf->busno, bdf->devno, bdf->funcno)) {
         PciHandleType h(bdf->domainno, bdf->busno, bdf->devno, bdf->funcno);
         // VID:DID
@@ -414,11 +482,105 @@ bool probe_pci(struct pci *p)
     return p->exist;
 }
 
-/*
-  first : [vendorID] -> vencor name
-  second : [vendorID][deviceID] -> device name
- */
-typedef std::pair< std::map<int, std::string> ,std::map< int, std::map<int, std::string> > > PCIDB;
+/*! \brief Vendor and device names from the pci.ids database
+
+    The file is read into one buffer, the vendor lines are indexed on the first lookup and
+    the devices of a vendor on the first lookup of that vendor, so only the looked up vendors
+    are parsed (a few dozen of the thousands in the file).
+*/
+class PCIDB
+{
+    std::string data; // contents of pci.ids
+    typedef std::vector<std::pair<int, size_t> > Index; // sorted (ID, offset of the line) pairs
+    mutable bool vendorsIndexed = false;
+    mutable Index vendors;
+    mutable std::map<int, Index> devices; // per vendor ID
+
+    static int parseID(const std::string & d, size_t pos)
+    {
+        // four hex digits followed by two spaces
+        if (pos + 6 > d.size() || d[pos + 4] != ' ' || d[pos + 5] != ' ') return -1;
+        int id = 0;
+        for (size_t i = pos; i < pos + 4; ++i)
+        {
+            const char c = d[i];
+            const int digit = (c >= '0' && c <= '9') ? (c - '0') : (c >= 'a' && c <= 'f') ? (c - 'a' + 10) : (c >= 'A' && c <= 'F') ? (c - 'A' + 10) : -1;
+            if (digit < 0) return -1;
+            id = id * 16 + digit;
+        }
+        return id;
+    }
+    size_t nextLine(size_t pos) const
+    {
+        pos = data.find('\n', pos);
+        return (pos == std::string::npos) ? data.size() : pos + 1;
+    }
+    std::string nameAt(size_t pos) const // the name after "xxxx  "
+    {
+        const size_t end = data.find('\n', pos);
+        std::string name = data.substr(pos + 6, (end == std::string::npos) ? std::string::npos : end - pos - 6);
+        if (!name.empty() && name.back() == '\r') name.pop_back();
+        return name;
+    }
+    static const std::pair<int, size_t> * find(const Index & index, int id)
+    {
+        auto it = std::lower_bound(index.begin(), index.end(), std::make_pair(id, size_t(0)));
+        return (it != index.end() && it->first == id) ? &(*it) : nullptr;
+    }
+    const Index & getVendors() const
+    {
+        if (!vendorsIndexed)
+        {
+            // vendor lines start with the ID, device lines with one tab, subsystem lines with two tabs
+            for (size_t pos = 0; pos < data.size(); pos = nextLine(pos))
+            {
+                const int id = parseID(data, pos);
+                if (id >= 0) vendors.push_back(std::make_pair(id, pos));
+            }
+            std::sort(vendors.begin(), vendors.end());
+            vendorsIndexed = true;
+        }
+        return vendors;
+    }
+    const Index & getDevices(int vendorID, size_t vendorPos) const
+    {
+        auto it = devices.find(vendorID);
+        if (it != devices.end()) return it->second;
+        Index & index = devices[vendorID];
+        for (size_t pos = nextLine(vendorPos); pos < data.size() && (data[pos] == '\t' || data[pos] == '#' || data[pos] == '\n'); pos = nextLine(pos))
+        {
+            if (data[pos] != '\t' || (pos + 1 < data.size() && data[pos + 1] == '\t')) continue;
+            const int id = parseID(data, pos + 1);
+            if (id >= 0) index.push_back(std::make_pair(id, pos + 1));
+        }
+        std::sort(index.begin(), index.end());
+        return index;
+    }
+
+public:
+    //! \brief Reads the database file, returns false if it can not be read
+    bool load(const char * path)
+    {
+        std::ifstream in(path, std::ios::in | std::ios::binary);
+        if (!in.is_open()) return false;
+        data.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+        vendorsIndexed = false;
+        vendors.clear();
+        devices.clear();
+        return true;
+    }
+    std::string getVendorName(int vendorID, const char * unknown = "unknown vendor") const
+    {
+        const auto vendor = find(getVendors(), vendorID);
+        return vendor ? nameAt(vendor->second) : std::string(unknown);
+    }
+    std::string getDeviceName(int vendorID, int deviceID, const char * unknown = "unknown device") const
+    {
+        const auto vendor = find(getVendors(), vendorID);
+        const auto device = vendor ? find(getDevices(vendorID, vendor->second), deviceID) : nullptr;
+        return device ? nameAt(device->second) : std::string(unknown);
+    }
+};
 
 void print_pci(struct pci p, const PCIDB & pciDB)
 {
@@ -426,62 +588,34 @@ void print_pci(struct pci p, const PCIDB & pciDB)
     printf("%x:%x.%d [%04x:%04x] %s %s %d P:%x S:%x S:%x ",
             p.bdf.busno, p.bdf.devno, p.bdf.funcno,
             p.vendor_id, p.device_id,
-            (pciDB.first.count(p.vendor_id) > 0)?pciDB.first.at(p.vendor_id).c_str():"unknown vendor",
-            (pciDB.second.count(p.vendor_id) > 0 && pciDB.second.at(p.vendor_id).count(p.device_id) > 0)?pciDB.second.at(p.vendor_id).at(p.device_id).c_str():"unknown device",
+            pciDB.getVendorName(p.vendor_id).c_str(),
+            pciDB.getDeviceName(p.vendor_id, p.device_id).c_str(),
             p.header_type,
             p.primary_bus_number, p.secondary_bus_number, p.subordinate_bus_number);
     printf("Device info:");
     printf("%x:%x.%d [%04x:%04x] %s %s %d Gen%d x%d\n",
             p.bdf.busno, p.bdf.devno, p.bdf.funcno,
             p.vendor_id, p.device_id,
-            (pciDB.first.count(p.vendor_id) > 0)?pciDB.first.at(p.vendor_id).c_str():"unknown vendor",
-            (pciDB.second.count(p.vendor_id) > 0 && pciDB.second.at(p.vendor_id).count(p.device_id) > 0)?pciDB.second.at(p.vendor_id).at(p.device_id).c_str():"unknown device",
+            pciDB.getVendorName(p.vendor_id).c_str(),
+            pciDB.getDeviceName(p.vendor_id, p.device_id).c_str(),
             p.header_type,
             p.link_speed, p.link_width);
 }
 
 void load_PCIDB(PCIDB & pciDB)
 {
-    std::ifstream in(PCI_IDS_PATH);
-    std::string line, item;
-
-    if (!in.is_open())
+    if (pciDB.load(PCI_IDS_PATH))
     {
-#ifndef _MSC_VER
-        // On Unix, try the current directory if the default path failed
-        in.open("pci.ids");
+        return;
     }
-
-    if (!in.is_open())
+#ifndef _MSC_VER
+    // On Unix, try the current directory if the default path failed
+    if (pciDB.load("pci.ids"))
     {
-#endif
-        std::cerr << PCI_IDS_NOT_FOUND << "\n";
         return;
     }
-
-    int vendorID = -1;
-
-    while (std::getline(in, line)) {
-        // Ignore any line starting with #
-        if (line.size() == 0 || line[0] == '#')
-            continue;
-
-        if (line[0] == '\t' && line[1] == '\t')
-        {
-            // subvendor subdevice  subsystem_name
-            continue;
-        }
-        if (line[0] == '\t')
-        {
-            int deviceID = stoi(line.substr(1,4),0,16);
-            //std::cout << vendorID << ";" << vendorName << ";" << deviceID << ";" << line.substr(7) << "\n";
-            pciDB.second[vendorID][deviceID] = line.substr(7);
-            continue;
-        }
-        // vendor
-        vendorID = stoi(line.substr(0,4),0,16);
-        pciDB.first[vendorID] = line.substr(6);
-    }
+#endif
+    std::cerr << PCI_IDS_NOT_FOUND << "\n";
 }
 
 } // namespace pcm
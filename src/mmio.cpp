@@ -195,6 +195,15 @@ uint64 MMIORange::read64(uint64 offset)
     return val;
 }
 
+void MMIORange::readBlock64(uint64 offset, uint64 * dest, size_t count)
+{
+    for (size_t i = 0; i < count; ++i)
+    {
+        dest[i] = 0;
+        PCIDriver_readMemory64((uint8_t *)mmapAddr + offset + i * sizeof(uint64), dest + i);
+    }
+}
+
 void MMIORange::write32(uint64 offset, uint32 val)
 {
     std::cerr << "PCM Error: the driver does not support writing to MMIORange\n";
@@ -260,6 +269,16 @@ uint64 MMIORange::read64(uint64 offset)
     return *((uint64 *)(mmapAddr + offset));
 }
 
+void MMIORange::readBlock64(uint64 offset, uint64 * dest, size_t count)
+{
+    // one register sized load per counter: device registers do not necessarily support wider (SIMD) loads
+    const volatile uint64 * src = (const volatile uint64 *)(mmapAddr + offset);
+    for (size_t i = 0; i < count; ++i)
+    {
+        dest[i] = src[i];
+    }
+}
+
 void MMIORange::write32(uint64 offset, uint32 val)
 {
     if (readonly)
@@ -35,6 +35,13 @@ public:
     virtual uint64 read64(uint64 offset) = 0;
     virtual void write32(uint64 offset, uint32 val) = 0;
     virtual void write64(uint64 offset, uint64 val) = 0;
+    virtual void readBlock64(uint64 offset, uint64 * dest, size_t count)
+    {
+        for (size_t i = 0; i < count; ++i)
+        {
+            dest[i] = read64(offset + i * sizeof(uint64));
+        }
+    }
     virtual ~MMIORangeInterface() {}
 };
 
@@ -84,6 +91,15 @@ public:
         readInternal(offset, result);
         return result;
     }
+    void readBlock64(uint64 offset, uint64 * dest, size_t count) override
+    {
+        mutex.lock();
+        for (size_t i = 0; i < count; ++i)
+        {
+            pmem->read(startAddr + offset + i * sizeof(uint64), dest[i]);
+        }
+        mutex.unlock();
+    }
     void write32(uint64 offset, uint32 val)
     {
         writeInternal(offset, val);
@@ -124,6 +140,10 @@ public:
     {
         return impl->read64(offset);
     }
+    void readBlock64(uint64 offset, uint64 * dest, size_t count)
+    {
+        impl->readBlock64(offset, dest, count);
+    }
     void write32(uint64 offset, uint32 val)
     {
         impl->write32(offset, val);
@@ -152,6 +172,8 @@ public:
     MMIORange(uint64 baseAddr_, uint64 size_, bool readonly_ = true, bool silent = false);
     uint32 read32(uint64 offset);
     uint64 read64(uint64 offset);
+    //! \brief Reads count consecutive 64-bit registers starting at offset into dest in one tight loop
+    void readBlock64(uint64 offset, uint64 * dest, size_t count);
     void write32(uint64 offset, uint32 val);
     void write64(uint64 offset, uint64 val);
     ~MMIORange();
@@ -14,6 +14,7 @@
 #include "types.h"
 #include "msr.h"
 #include "utils.h"
+#include "simulated_hw.h"
 #include <assert.h>
 
 #ifdef _MSC_VER
@@ -213,8 +214,17 @@ bool noMSRMode()
     return 1 == noMSR;
 }
 
-MsrHandle::MsrHandle(uint32 cpu) : fd(-1), cpu_id(cpu)
+MsrHandle::MsrHandle(uint32 cpu) : fd(-1), simulated(SimulatedHardware::get()), cpu_id(cpu)
 {
+    if (simulated)
+    {
+        if (cpu >= simulated->getNumCPUs())
+        {
+            std::cerr << "PCM Error: can't open MSR handle for core " << cpu << " (not simulated)\n";
+            throw std::exception();
+        }
+        return;
+    }
     if (noMSRMode()) return;
     constexpr auto allowWritesPath = "/sys/module/msr/parameters/allow_writes";
     static bool writesEnabled = false;
@@ -257,12 +267,14 @@ int32 MsrHandle::write(uint64 msr_number, uint64 value)
     std::lock_guard<std::mutex> g(m);
     std::cout << "DEBUG: writing MSR 0x" << std::hex << msr_number << " value 0x" << value << " on cpu " << std::dec << cpu_id << std::endl;
 #endif
+    if (simulated) return simulated->writeMSR(cpu_id, msr_number, value);
     if (fd < 0) return 0;
     return ::pwrite(fd, (const void *)&value, sizeof(uint64), msr_number);
 }
 
 int32 MsrHandle::read(uint64 msr_number, uint64 * value)
 {
+    if (simulated) return simulated->readMSR(cpu_id, msr_number, value);
     if (fd < 0) return 0;
     return ::pread(fd, (void *)value, sizeof(uint64), msr_number);
 }
@@ -21,12 +21,15 @@
 #endif
 
 #include "mutex.h"
+#include "overhead_stats.h"
 #include <memory>
 
 namespace pcm {
 
 bool noMSRMode();
 
+class SimulatedHardware;
+
 class MsrHandle
 {
 #ifdef _MSC_VER
@@ -36,6 +39,9 @@ class MsrHandle
     static int num_handles;
 #else
     int32 fd;
+#endif
+#ifdef __linux__
+    SimulatedHardware * simulated = nullptr;
 #endif
     uint32 cpu_id;
     MsrHandle();                                // forbidden
@@ -72,6 +78,7 @@ public:
 
     int32 read(uint64 msr_number, uint64 * value)
     {
+        OverheadScope overhead(OverheadStats::MSRAccess);
         if (pHandle)
             return pHandle->read(msr_number, value);
 
@@ -82,6 +89,7 @@ public:
 
     int32 write(uint64 msr_number, uint64 value)
     {
+        OverheadScope overhead(OverheadStats::MSRAccess);
         if (pHandle)
             return pHandle->write(msr_number, value);
 
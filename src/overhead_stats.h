@@ -0,0 +1,91 @@
+// SPDX-License-Identifier: BSD-3-Clause
+// Copyright (c) 2024, Intel Corporation
+
+#pragma once
+
+/*!     \file overhead_stats.h
+        \brief Optional accounting of the time PCM spends in register accesses and sampling phases
+*/
+
+#include "types.h"
+#include <atomic>
+#include <chrono>
+
+namespace pcm {
+
+/*! \brief Process-wide counters of calls and time per access kind and sampling phase
+
+    Disabled by default: then every instrumented call site costs one relaxed load of a flag.
+    Used by the self-overhead benchmark (tests/overhead_bench.cpp). Times are summed over all
+    threads, so for parallel phases they can exceed the wall time.
+*/
+class OverheadStats
+{
+public:
+    enum Kind
+    {
+        MSRAccess = 0,
+        PCICFGAccess,
+        MMIOAccess,
+        DispatchPhase,    // queuing the per-core read tasks
+        AggregationPhase, // summing per-core states into socket and system states
+        NumKinds
+    };
+    struct Counter
+    {
+        std::atomic<uint64> calls{0};
+        std::atomic<uint64> nanoseconds{0};
+    };
+    static bool enabled() { return enabledFlag().load(std::memory_order_relaxed); }
+    static void enable(const bool value) { enabledFlag().store(value); }
+    static void reset()
+    {
+        for (int k = 0; k < NumKinds; ++k)
+        {
+            counters()[k].calls.store(0);
+            counters()[k].nanoseconds.store(0);
+        }
+    }
+    static void add(const Kind kind, const uint64 ns)
+    {
+        counters()[kind].calls.fetch_add(1, std::memory_order_relaxed);
+        counters()[kind].nanoseconds.fetch_add(ns, std::memory_order_relaxed);
+    }
+    static uint64 getCalls(const Kind kind) { return counters()[kind].calls.load(); }
+    static uint64 getNanoseconds(const Kind kind) { return counters()[kind].nanoseconds.load(); }
+private:
+    static std::atomic<bool> & enabledFlag()
+    {
+        static std::atomic<bool> flag{false};
+        return flag;
+    }
+    static Counter * counters()
+    {
+        static Counter c[NumKinds];
+        return c;
+    }
+};
+
+//! \brief Adds the lifetime of the scope to an OverheadStats kind if the accounting is enabled
+class OverheadScope
+{
+    const OverheadStats::Kind kind;
+    const bool active;
+    std::chrono::steady_clock::time_point start;
+    OverheadScope(const OverheadScope &) = delete;
+    OverheadScope & operator = (const OverheadScope &) = delete;
+public:
+    explicit OverheadScope(const OverheadStats::Kind kind_) : kind(kind_), active(OverheadStats::enabled())
+    {
+        if (active) start = std::chrono::steady_clock::now();
+    }
+    ~OverheadScope()
+    {
+        if (active)
+        {
+            OverheadStats::add(kind, (uint64)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count());
+        }
+    }
+};
+
+} // namespace pcm
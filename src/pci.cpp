@@ -12,11 +12,19 @@
 #include <sys/stat.h>
 #include <fcntl.h>
 #include "pci.h"
+#ifdef __linux__
+#include "simulated_hw.h"
+#endif
 
 #ifndef _MSC_VER
 #include <sys/mman.h>
 #include <errno.h>
 #include <strings.h>
+#include <cstdlib>
+#include <string>
+#include <map>
+#include <set>
+#include <mutex>
 #endif
 
 #ifdef _MSC_VER
@@ -34,6 +42,21 @@
 
 namespace pcm {
 
+// reads a block of configuration space one dword at a time
+template <class Handle>
+static int32 readBlockByDwords(Handle & handle, const uint64 offset, void * buffer, const uint32 size)
+{
+    uint32 * dwords = (uint32 *)buffer;
+    for (uint32 i = 0; i < size / sizeof(uint32); ++i)
+    {
+        if (handle.read32(offset + i * sizeof(uint32), dwords + i) != (int32)sizeof(uint32))
+        {
+            return (int32)(i * sizeof(uint32));
+        }
+    }
+    return (int32)size;
+}
+
 #ifdef _MSC_VER
 
 extern HMODULE hOpenLibSys;
@@ -172,6 +195,11 @@ int32 PciHandle::read64(uint64 offset, uint64 * value)
     return 0;
 }
 
+int32 PciHandle::readBlock(uint64 offset, void * buffer, uint32 size)
+{
+    return readBlockByDwords(*this, offset, buffer, size);
+}
+
 PciHandle::~PciHandle()
 {
     if (hDriver != INVALID_HANDLE_VALUE) CloseHandle(hDriver);
@@ -224,6 +252,11 @@ int32 PciHandle::read64(uint64 offset, uint64 * value)
     return PCIDriver_read64(pci_address, value);
 }
 
+int32 PciHandle::readBlock(uint64 offset, void * buffer, uint32 size)
+{
+    return readBlockByDwords(*this, offset, buffer, size);
+}
+
 PciHandle::~PciHandle()
 { }
 
@@ -351,6 +384,11 @@ int32 PciHandle::read64(uint64 offset, uint64 * value)
     return sizeof(value);
 }
 
+int32 PciHandle::readBlock(uint64 offset, void * buffer, uint32 size)
+{
+    return readBlockByDwords(*this, offset, buffer, size);
+}
+
 PciHandle::~PciHandle()
 {
     if (fd >= 0) ::close(fd);
@@ -384,17 +422,54 @@ int openHandle(uint32 groupnr_, uint32 bus, uint32 device, uint32 function)
     return handle;
 }
 
+static bool usePciMM()
+{
+    static const bool result = []() {
+        const char * env = std::getenv("PCM_USE_PCI_MM");
+        return env != nullptr && std::string(env) == std::string("1");
+    }();
+    return result;
+}
+
 PciHandle::PciHandle(uint32 groupnr_, uint32 bus_, uint32 device_, uint32 function_) :
     fd(-1),
+    ecamAddr(nullptr),
+    simulated(SimulatedHardware::get()),
     bus(bus_),
     device(device_),
     function(function_)
 {
+    auto cantOpen = [&]()
+    {
+        return std::runtime_error(std::string("PCM error: can't open PciHandle ")
+            + std::to_string(groupnr_) + ":" + std::to_string(bus_) + ":" + std::to_string(device_) + ":" + std::to_string(function_));
+    };
+    if (simulated)
+    {
+        if (simulated->pciExists(groupnr_, bus_, device_, function_) == false)
+        {
+            throw cantOpen();
+        }
+        return;
+    }
+    if (usePciMM())
+    {
+        ecam = ECAMMapping::get(groupnr_, bus_);
+        if (ecam.get())
+        {
+            ecamAddr = ecam->getFunctionBase(bus_, device_, function_);
+            if (*((volatile uint32 *)ecamAddr) == 0xffffffff)
+            {
+                // like a missing /proc/bus/pci entry: no function at this address
+                throw cantOpen();
+            }
+            return;
+        }
+    }
     int handle = openHandle(groupnr_, bus_, device_, function_);
     if (handle < 0)
     {
-        throw std::runtime_error(std::string("PCM error: can't open PciHandle ")
-            + std::to_string(groupnr_) + ":" + std::to_string(bus_) + ":" + std::to_string(device_) + ":" + std::to_string(function_));
+        throw cantOpen();
     }
     fd = handle;
 
@@ -404,6 +479,10 @@ PciHandle::PciHandle(uint32 groupnr_, uint32 bus_, uint32 device_, uint32 functi
 
 bool PciHandle::exists(uint32 groupnr_, uint32 bus_, uint32 device_, uint32 function_)
 {
+    if (const auto simulated = SimulatedHardware::get())
+    {
+        return simulated->pciExists(groupnr_, bus_, device_, function_);
+    }
     int handle = openHandle(groupnr_, bus_, device_, function_);
 
     if (handle < 0) return false;
@@ -415,16 +494,45 @@ bool PciHandle::exists(uint32 groupnr_, uint32 bus_, uint32 device_, uint32 func
 
 int32 PciHandle::read32(uint64 offset, uint32 * value)
 {
+    if (simulated)
+    {
+        return simulated->readPCI(bus, device, function, offset, value, sizeof(uint32));
+    }
+    if (ecamAddr)
+    {
+        *value = *((volatile uint32 *)(ecamAddr + offset));
+        return sizeof(uint32);
+    }
     return ::pread(fd, (void *)value, sizeof(uint32), offset);
 }
 
 int32 PciHandle::write32(uint64 offset, uint32 value)
 {
+    if (simulated)
+    {
+        return simulated->writePCI(bus, device, function, offset, &value, sizeof(uint32));
+    }
+    if (ecamAddr)
+    {
+        *((volatile uint32 *)(ecamAddr + offset)) = value;
+        return sizeof(uint32);
+    }
     return ::pwrite(fd, (const void *)&value, sizeof(uint32), offset);
 }
 
 int32 PciHandle::read64(uint64 offset, uint64 * value)
 {
+    if (simulated)
+    {
+        return simulated->readPCI(bus, device, function, offset, value, sizeof(uint64));
+    }
+    if (ecamAddr)
+    {
+        // config space is accessed with dword granularity
+        read32(offset, (uint32 *)value);
+        read32(offset + sizeof(uint32), ((uint32 *)value) + 1);
+        return sizeof(uint64);
+    }
     size_t res = ::pread(fd, (void *)value, sizeof(uint64), offset);
     if(res != sizeof(uint64))
     {
@@ -433,6 +541,24 @@ int32 PciHandle::read64(uint64 offset, uint64 * value)
     return res;
 }
 
+int32 PciHandle::readBlock(uint64 offset, void * buffer, uint32 size)
+{
+    if (simulated)
+    {
+        return simulated->readPCI(bus, device, function, offset, buffer, size);
+    }
+    if (ecamAddr)
+    {
+        return readBlockByDwords(*this, offset, buffer, size);
+    }
+    const ssize_t res = ::pread(fd, buffer, size, offset);
+    if (res != (ssize_t)size)
+    {
+        std::cerr << " ERROR: pread from " << fd << " with offset 0x" << std::hex << offset << std::dec << " returned " << res << " bytes \n";
+    }
+    return (int32)res;
+}
+
 PciHandle::~PciHandle()
 {
     if (fd >= 0) ::close(fd);
@@ -545,6 +671,11 @@ int32 PciHandleM::read64(uint64 offset, uint64 * value)
     return ::pread(fd, (void *)value, sizeof(uint64), offset + base_addr);
 }
 
+int32 PciHandleM::readBlock(uint64 offset, void * buffer, uint32 size)
+{
+    return (int32)::pread(fd, buffer, size, offset + base_addr);
+}
+
 PciHandleM::~PciHandleM()
 {
     if (fd >= 0) ::close(fd);
@@ -568,6 +699,17 @@ void PciHandleMM::readMCFG()
     if (mcfgRecords.size() > 0)
         return; // already initialized
 
+    if (SimulatedHardware::get())
+    {
+        // all simulated devices are in segment 0
+        MCFGRecord segment;
+        segment.PCISegmentGroupNumber = 0;
+        segment.startBusNumber = 0;
+        segment.endBusNumber = 0xff;
+        mcfgRecords.push_back(segment);
+        return;
+    }
+
     int mcfg_handle = PciHandle::openMcfgTable();
     if (mcfg_handle < 0) throw std::runtime_error("cannot open any of /[pcm]/sys/firmware/acpi/tables/MCFG* files!");
 
@@ -610,51 +752,114 @@ void PciHandleMM::readMCFG()
     ::close(mcfg_handle);
 }
 
-PciHandleMM::PciHandleMM(uint32 groupnr_, uint32 bus_, uint32 device_, uint32 function_) :
-    fd(-1),
-    mmapAddr(NULL),
-    bus(bus_),
-    device(device_),
-    function(function_),
-    base_addr(0)
-{
-    int handle = ::open("/dev/mem", O_RDWR);
-    if (handle < 0) throw std::exception();
-    fd = handle;
+static std::mutex ecamMutex;
+static std::map<uint32, std::weak_ptr<ECAMMapping> > ecamSegmentMappings; // MCFG record index -> mapping
+static std::map<std::pair<uint32, uint32>, std::weak_ptr<ECAMMapping> > ecamBusMappings; // (group, bus) -> mapping
+static std::vector<bool> ecamSegmentMapFailed;
+static std::set<std::pair<uint32, uint32> > ecamBusMapFailed; // (group, bus) that can't be mapped
 
-    readMCFG();
+static char * mapECAM(const uint64 physicalAddress, const size_t size)
+{
+    const int handle = ::open("/dev/mem", O_RDWR);
+    if (handle < 0)
+    {
+        return nullptr;
+    }
+    void * addr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, handle, physicalAddress);
+    ::close(handle); // the mapping stays valid
+    return (addr == MAP_FAILED) ? nullptr : (char *)addr;
+}
 
-    unsigned segment = 0;
-    for ( ; segment < mcfgRecords.size(); ++segment)
+std::shared_ptr<ECAMMapping> ECAMMapping::get(uint32 groupnr_, uint32 bus_)
+{
+    const auto & records = PciHandleMM::getMCFGRecords();
+    uint32 segment = 0;
+    for ( ; segment < records.size(); ++segment)
     {
-        if (mcfgRecords[segment].PCISegmentGroupNumber == groupnr_
-            && mcfgRecords[segment].startBusNumber <= bus_
-            && bus <= mcfgRecords[segment].endBusNumber)
+        if (records[segment].PCISegmentGroupNumber == groupnr_
+            && records[segment].startBusNumber <= bus_
+            && bus_ <= records[segment].endBusNumber)
             break;
     }
-    if (segment == mcfgRecords.size())
+    if (segment == records.size())
     {
         std::cerr << "PCM Error: (group " << groupnr_ << ", bus " << bus_ << ") not found in the MCFG table.\n";
-        throw std::exception();
+        return std::shared_ptr<ECAMMapping>();
     }
-    else
+    const MCFGRecord & record = records[segment];
+    const uint64 busSize = 1024ULL * 1024ULL;
+
+    std::lock_guard<std::mutex> lock(ecamMutex);
+    ecamSegmentMapFailed.resize(records.size(), false);
+    std::shared_ptr<ECAMMapping> result = ecamSegmentMappings[segment].lock();
+    if (result.get())
     {
-#ifdef PCM_DEBUG
-        std::cout << "PCM Debug: (group " << groupnr_ << ", bus " << bus_ << ") found in the MCFG table in segment " << segment << "\n";
-#endif
+        return result;
     }
+    if (ecamSegmentMapFailed[segment] == false)
+    {
+        // the MCFG base address corresponds to bus 0 of the segment
+        const size_t size = (record.endBusNumber - record.startBusNumber + 1) * busSize;
+        char * addr = mapECAM(record.baseAddress + record.startBusNumber * busSize, size);
+        if (addr)
+        {
+            result = std::shared_ptr<ECAMMapping>(new ECAMMapping(addr, size, record.startBusNumber));
+            ecamSegmentMappings[segment] = result;
+            return result;
+        }
+        ecamSegmentMapFailed[segment] = true;
+    }
+    const auto key = std::make_pair(groupnr_, bus_);
+    if (ecamBusMapFailed.count(key))
+    {
+        return result;
+    }
+    result = ecamBusMappings[key].lock();
+    if (result.get() == nullptr)
+    {
+        char * addr = mapECAM(record.baseAddress + bus_ * busSize, busSize);
+        if (addr == nullptr)
+        {
+            if (ecamBusMapFailed.empty())
+            {
+                // e.g. /dev/mem is restricted without iomem=relaxed: warn once, not for every handle
+                std::cerr << "PCM Error: can't map PCI configuration space of (group " << groupnr_ << ", bus " << bus_ << ") from /dev/mem, errno is " << errno << "\n";
+            }
+            ecamBusMapFailed.insert(key);
+            return result;
+        }
+        result = std::shared_ptr<ECAMMapping>(new ECAMMapping(addr, busSize, bus_));
+        ecamBusMappings[key] = result;
+    }
+    return result;
+}
 
-    base_addr = mcfgRecords[segment].baseAddress;
-
-    base_addr += (bus * 1024ULL * 1024ULL + device * 32ULL * 1024ULL + function * 4ULL * 1024ULL);
+ECAMMapping::~ECAMMapping()
+{
+    munmap(base, size);
+}
 
-    mmapAddr = (char *)mmap(NULL, 4096, PROT_READ | PROT_WRITE, MAP_SHARED, fd, base_addr);
+size_t ECAMMapping::getNumMappings()
+{
+    std::lock_guard<std::mutex> lock(ecamMutex);
+    size_t result = 0;
+    for (const auto & m : ecamSegmentMappings) if (!m.second.expired()) ++result;
+    for (const auto & m : ecamBusMappings) if (!m.second.expired()) ++result;
+    return result;
+}
 
-    if (mmapAddr == MAP_FAILED)
+PciHandleMM::PciHandleMM(uint32 groupnr_, uint32 bus_, uint32 device_, uint32 function_) :
+    mmapAddr(NULL),
+    bus(bus_),
+    device(device_),
+    function(function_)
+{
+    ecam = ECAMMapping::get(groupnr_, bus_);
+    if (ecam.get() == nullptr)
     {
-        std::cout << "mmap failed: errno is " << errno << "\n";
         throw std::exception();
     }
+    mmapAddr = ecam->getFunctionBase(bus_, device_, function_);
 }
 
 bool PciHandleMM::exists(uint32 /*groupnr_*/, uint32 /*bus_*/, uint32 /*device_*/, uint32 /*function_*/)
@@ -702,10 +907,13 @@ int32 PciHandleMM::read64(uint64 offset, uint64 * value)
     return sizeof(uint64);
 }
 
+int32 PciHandleMM::readBlock(uint64 offset, void * buffer, uint32 size)
+{
+    return readBlockByDwords(*this, offset, buffer, size);
+}
+
 PciHandleMM::~PciHandleMM()
 {
-    if (mmapAddr) munmap(mmapAddr, 4096);
-    if (fd >= 0) ::close(fd);
 }
 
 #endif
@@ -26,9 +26,15 @@
 #endif
 
 #include <vector>
+#include <memory>
 
 namespace pcm {
 
+#ifdef __linux__
+class ECAMMapping;
+class SimulatedHardware;
+#endif
+
 class PciHandle
 {
 #ifdef _MSC_VER
@@ -36,6 +42,12 @@ class PciHandle
 #else
     int32 fd;
 #endif
+#ifdef __linux__
+    // view into a shared ECAM mapping (PCM_USE_PCI_MM=1), nullptr if /proc/bus/pci is used
+    std::shared_ptr<ECAMMapping> ecam;
+    char * ecamAddr;
+    SimulatedHardware * simulated; // PCM_SIMULATE, see simulated_hw.h
+#endif
 
     uint32 bus;
     uint32 device;
@@ -60,6 +72,9 @@ public:
     int32 write32(uint64 offset, uint32 value);
 
     int32 read64(uint64 offset, uint64 * value);
+    //! \brief Reads size bytes of contiguous configuration space starting at offset (both dword aligned)
+    //! \return number of bytes read
+    int32 readBlock(uint64 offset, void * buffer, uint32 size);
 
     virtual ~PciHandle();
 
@@ -103,22 +118,62 @@ public:
     int32 write32(uint64 offset, uint32 value);
 
     int32 read64(uint64 offset, uint64 * value);
+    //! \brief Reads size bytes of contiguous configuration space starting at offset (both dword aligned)
+    //! \return number of bytes read
+    int32 readBlock(uint64 offset, void * buffer, uint32 size);
 
     virtual ~PciHandleM();
 };
 
 #ifndef _MSC_VER
 
+#ifdef __linux__
+/*! \brief Memory mapping of the ECAM (enhanced configuration access mechanism) region of a PCI segment
+
+    The configuration space of a whole MCFG segment is mapped once from /dev/mem and shared by
+    all PCI handles of the segment, so that a handle is just a pointer into the mapping and a
+    register access is a plain load or store. If the kernel does not allow mapping the whole
+    segment, the configuration space of each bus is mapped separately.
+*/
+class ECAMMapping
+{
+    char * base;
+    size_t size;
+    uint32 startBus;
+
+    ECAMMapping(char * base_, const size_t size_, const uint32 startBus_) : base(base_), size(size_), startBus(startBus_) { }
+    ECAMMapping() = delete;
+    ECAMMapping(const ECAMMapping &) = delete;
+    ECAMMapping & operator = (const ECAMMapping &) = delete;
+
+public:
+    ~ECAMMapping();
+
+    //! \brief Returns the (shared) mapping containing the bus or nullptr if it can not be mapped
+    static std::shared_ptr<ECAMMapping> get(uint32 groupnr_, uint32 bus_);
+
+    //! \brief Returns the address of the 4 KB configuration space of the function
+    char * getFunctionBase(uint32 bus_, uint32 device_, uint32 function_) const
+    {
+        return base + (bus_ - startBus) * 1024ULL * 1024ULL + device_ * 32ULL * 1024ULL + function_ * 4ULL * 1024ULL;
+    }
+
+    //! \brief Returns the number of mappings currently in use
+    static size_t getNumMappings();
+};
+#endif
+
 // read/write PCI config space using physical memory using mmapped file I/O
 class PciHandleMM
 {
-    int32 fd;
+#ifdef __linux__
+    std::shared_ptr<ECAMMapping> ecam;
+#endif
     char * mmapAddr;
 
     uint32 bus;
     uint32 device;
     uint32 function;
-    uint64 base_addr;
 
 #ifdef __linux__
     static MCFGHeader mcfgHeader;
@@ -139,6 +194,9 @@ public:
     int32 write32(uint64 offset, uint32 value);
 
     int32 read64(uint64 offset, uint64 * value);
+    //! \brief Reads size bytes of contiguous configuration space starting at offset (both dword aligned)
+    //! \return number of bytes read
+    int32 readBlock(uint64 offset, void * buffer, uint32 size);
 
     virtual ~PciHandleMM();
 
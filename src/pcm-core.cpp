@@ -26,11 +26,21 @@
 #include <bitset>
 #include "cpucounters.h"
 #include "utils.h"
+#ifdef PCM_SHARED_LIBRARY
+#include "region_profiler.h"
+#endif
 #ifdef _MSC_VER
 #include "freegetopt/getopt.h"
 #endif
 
 #include <vector>
+#ifdef PCM_SHARED_LIBRARY
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#endif
 #define PCM_DELAY_DEFAULT 1.0 // in seconds
 #define PCM_DELAY_MIN 0.015 // 15 milliseconds is practical on most modern CPUs
 #define MAX_CORES 4096
@@ -50,10 +60,175 @@ struct CoreEvent
 
 #ifdef PCM_SHARED_LIBRARY
 
+/*
+	Snapshot layout used by the bulk C API (all values are uint64_t, counts are deltas over the snapshot interval):
+	  header:  PCM_C_SNAPSHOT_HEADER values: sequence number, elapsed invariant TSC ticks, TSC frequency (Hz),
+	           number of cores, number of sockets, values per core, values per socket, reserved
+	  cores:   number of cores x PCM_C_CORE_VALUES: cycles, instructions retired, custom core events 0..3
+	  sockets: number of sockets x PCM_C_SOCKET_VALUES: bytes read from and written to memory controllers,
+	           package and DRAM energy (in energy units, see PCM::getJoulesPerEnergyUnit())
+*/
+enum {
+	PCM_C_SNAPSHOT_HEADER = 8,
+	PCM_C_CORE_EVENTS = 4,
+	PCM_C_CORE_VALUES = 2 + PCM_C_CORE_EVENTS,
+	PCM_C_SOCKET_VALUES = 4
+};
+
+struct CCounterStates
+{
+	SystemCounterState system;
+	std::vector<SocketCounterState> sockets;
+	std::vector<CoreCounterState> cores;
+	// pcm_c_start/pcm_c_stop and the background sampler may read at the same time,
+	// but concurrent getAllCounterStates calls would interleave the uncore freeze/unfreeze
+	void read(PCM * m)
+	{
+		static std::mutex readMutex;
+		std::lock_guard<std::mutex> lock(readMutex);
+		m->getAllCounterStates(system, sockets, cores);
+	}
+};
+
+static uint32_t snapshotSize(PCM * m)
+{
+	return PCM_C_SNAPSHOT_HEADER + m->getNumCores() * PCM_C_CORE_VALUES + m->getNumSockets() * PCM_C_SOCKET_VALUES;
+}
+
+static void fillSnapshot(uint64_t * buffer, const uint64_t sequence, const CCounterStates & before, const CCounterStates & after)
+{
+	PCM * m = PCM::getInstance();
+	const uint32_t numCores = (uint32_t)after.cores.size();
+	const uint32_t numSockets = (uint32_t)after.sockets.size();
+	uint64_t * out = buffer;
+	*out++ = sequence;
+	*out++ = numCores ? getInvariantTSC(before.cores[0], after.cores[0]) : 0;
+	*out++ = m->getNominalFrequency();
+	*out++ = numCores;
+	*out++ = numSockets;
+	*out++ = PCM_C_CORE_VALUES;
+	*out++ = PCM_C_SOCKET_VALUES;
+	*out++ = 0;
+	for (uint32_t c = 0; c < numCores; ++c)
+	{
+		const CoreCounterState & b = before.cores[c];
+		const CoreCounterState & a = after.cores[c];
+		*out++ = getCycles(b, a);
+		*out++ = getInstructionsRetired(b, a);
+		for (uint32_t e = 0; e < PCM_C_CORE_EVENTS; ++e)
+		{
+			*out++ = getNumberOfCustomEvents(e, b, a);
+		}
+	}
+	for (uint32_t s = 0; s < numSockets; ++s)
+	{
+		const SocketCounterState & b = before.sockets[s];
+		const SocketCounterState & a = after.sockets[s];
+		*out++ = getBytesReadFromMC(b, a);
+		*out++ = getBytesWrittenToMC(b, a);
+		*out++ = getConsumedEnergy(b, a);
+		*out++ = getDRAMConsumedEnergy(b, a);
+	}
+}
+
+/*
+	Background sampler for the double-buffered mode: a thread reads all counters every interval and
+	writes the deltas into the buffer not being published, then flips the published index. Each buffer
+	is guarded by a seqlock (its version is odd while the sampler writes it), so readers copy without
+	waiting and retry only if the sampler started to overwrite the buffer during the copy.
+*/
+class CSnapshotSampler
+{
+	std::vector<uint64_t> buffers[2];
+	std::atomic<uint64_t> versions[2]; // seqlock of each buffer: odd while the sampler writes it
+	std::atomic<uint64_t> published{0}; // number of published snapshots, the latest is in buffers[published & 1]
+	std::thread sampler;
+	std::mutex stopMutex;
+	std::condition_variable stopCondition;
+	bool stopSampling = false;
+
+	void sample_loop(const std::chrono::milliseconds interval)
+	{
+		PCM * m = PCM::getInstance();
+		CCounterStates states[2];
+		states[0].read(m);
+		uint32_t current = 0;
+		auto next = std::chrono::steady_clock::now();
+		while (true)
+		{
+			next += interval;
+			{
+				std::unique_lock<std::mutex> lock(stopMutex);
+				if (stopCondition.wait_until(lock, next, [this]() { return stopSampling; }))
+				{
+					break;
+				}
+			}
+			states[current ^ 1].read(m);
+			const uint64_t sequence = published.load(std::memory_order_relaxed) + 1;
+			const uint32_t b = sequence & 1;
+			versions[b].fetch_add(1, std::memory_order_relaxed);
+			// orders the buffer writes after marking it as being written
+			std::atomic_thread_fence(std::memory_order_release);
+			fillSnapshot(buffers[b].data(), sequence, states[current], states[current ^ 1]);
+			versions[b].fetch_add(1, std::memory_order_release);
+			published.store(sequence, std::memory_order_release);
+			current ^= 1;
+		}
+	}
+public:
+	CSnapshotSampler(const uint32_t interval_ms)
+	{
+		const uint32_t size = snapshotSize(PCM::getInstance());
+		versions[0].store(0);
+		versions[1].store(0);
+		buffers[0].resize(size, 0);
+		buffers[1].resize(size, 0);
+		sampler = std::thread(&CSnapshotSampler::sample_loop, this, std::chrono::milliseconds(interval_ms));
+	}
+	~CSnapshotSampler()
+	{
+		{
+			std::lock_guard<std::mutex> lock(stopMutex);
+			stopSampling = true;
+		}
+		stopCondition.notify_all();
+		sampler.join();
+	}
+	int read(uint64_t * buffer, const uint32_t size)
+	{
+		const uint32_t needed = (uint32_t)buffers[0].size();
+		if (size < needed)
+		{
+			return -1;
+		}
+		while (true)
+		{
+			const uint64_t sequence = published.load(std::memory_order_acquire);
+			if (sequence == 0)
+			{
+				return 0; // no snapshot yet
+			}
+			const uint32_t b = sequence & 1;
+			const uint64_t version = versions[b].load(std::memory_order_acquire);
+			if (version & 1)
+			{
+				continue; // being overwritten: a newer snapshot is already published in the other buffer
+			}
+			memcpy(buffer, buffers[b].data(), needed * sizeof(uint64_t));
+			// orders the copy before the version re-check
+			std::atomic_thread_fence(std::memory_order_acquire);
+			if (versions[b].load(std::memory_order_relaxed) == version)
+			{
+				return (int)needed;
+			}
+		}
+	}
+};
+
 extern "C" {
-	static std::shared_ptr<SystemCounterState> globalSysBeforeState, globalSysAfterState;
-	static std::shared_ptr<std::vector<CoreCounterState> > globalBeforeState, globalAfterState;
-	static std::shared_ptr<std::vector<SocketCounterState> > globalDummySocketStates;
+	static std::shared_ptr<CCounterStates> globalBeforeState, globalAfterState;
+	static std::shared_ptr<CSnapshotSampler> globalSampler;
 	static EventSelectRegister globalRegs[PERF_MAX_COUNTERS];
 	static PCM::ExtendedCustomCoreEventDescription globalConf;
 
@@ -70,11 +245,8 @@ extern "C" {
 	int pcm_c_init()
 	{
 		PCM * m = PCM::getInstance();
-		globalSysBeforeState = std::make_shared<SystemCounterState>();
-		globalSysAfterState = std::make_shared<SystemCounterState>();
-		globalBeforeState = std::make_shared<std::vector<CoreCounterState> >();
-		globalAfterState = std::make_shared<std::vector<CoreCounterState> >();
-		globalDummySocketStates = std::make_shared<std::vector<SocketCounterState> >();
+		globalBeforeState = std::make_shared<CCounterStates>();
+		globalAfterState = std::make_shared<CCounterStates>();
 		globalConf.fixedCfg = NULL; // default
 		globalConf.nGPCounters = m->getMaxCustomCoreEvents();
 		globalConf.gpCounterCfg = globalRegs;
@@ -89,31 +261,123 @@ extern "C" {
 			return -1;
 	}
 
+	// pcm_c_start and pcm_c_stop can be used while the background sampler runs:
+	// the reads are serialized, so they may wait for an ongoing read of the sampler
 	void pcm_c_start()
 	{
 		PCM * m = PCM::getInstance();
-		m->getAllCounterStates(*globalSysBeforeState.get(), *globalDummySocketStates.get(), *globalBeforeState.get());
+		globalBeforeState->read(m);
 	}
 
 	void pcm_c_stop()
 	{
 		PCM * m = PCM::getInstance();
-		m->getAllCounterStates(*globalSysAfterState.get(), *globalDummySocketStates.get(), *globalAfterState.get());
+		globalAfterState->read(m);
 	}
 
 	uint64_t pcm_c_get_cycles(uint32_t core_id)
 	{
-		return getCycles((*globalBeforeState.get())[core_id], (*globalAfterState.get())[core_id]);
+		return getCycles(globalBeforeState->cores[core_id], globalAfterState->cores[core_id]);
 	}
 
 	uint64_t pcm_c_get_instr(uint32_t core_id)
 	{
-		return getInstructionsRetired((*globalBeforeState.get())[core_id], (*globalAfterState.get())[core_id]);
+		return getInstructionsRetired(globalBeforeState->cores[core_id], globalAfterState->cores[core_id]);
 	}
 
 	uint64_t pcm_c_get_core_event(uint32_t core_id, uint32_t event_id)
 	{
-		return getNumberOfCustomEvents(event_id, (*globalBeforeState.get())[core_id], (*globalAfterState.get())[core_id]);
+		return getNumberOfCustomEvents(event_id, globalBeforeState->cores[core_id], globalAfterState->cores[core_id]);
+	}
+
+	// number of uint64_t values in a snapshot buffer (valid after pcm_c_init)
+	uint32_t pcm_c_get_snapshot_size()
+	{
+		return snapshotSize(PCM::getInstance());
+	}
+
+	// fills buffer with all counters measured between pcm_c_start and pcm_c_stop in one call
+	// returns the number of values written or -1 if the buffer is too small
+	int pcm_c_get_snapshot(uint64_t * buffer, uint32_t size)
+	{
+		const uint32_t needed = pcm_c_get_snapshot_size();
+		if (buffer == NULL || size < needed || globalAfterState.get() == NULL || globalAfterState->cores.empty())
+			return -1;
+
+		fillSnapshot(buffer, 0, *globalBeforeState.get(), *globalAfterState.get());
+		return (int)needed;
+	}
+
+	// starts sampling all counters every interval_ms milliseconds in a background thread
+	// (its reads are serialized with pcm_c_start and pcm_c_stop)
+	int pcm_c_start_sampling(uint32_t interval_ms)
+	{
+		if (globalSampler.get() || interval_ms == 0)
+			return -1;
+
+		globalSampler = std::make_shared<CSnapshotSampler>(interval_ms);
+		return 0;
+	}
+
+	// copies the latest background snapshot into buffer without blocking the sampler
+	// returns the number of values written, 0 if no snapshot is available yet or -1 on error
+	int pcm_c_read_latest(uint64_t * buffer, uint32_t size)
+	{
+		if (buffer == NULL || globalSampler.get() == NULL)
+			return -1;
+
+		return globalSampler->read(buffer, size);
+	}
+
+	void pcm_c_stop_sampling()
+	{
+		globalSampler.reset();
+	}
+
+	// region profiling with rdpmc: call after pcm_c_init, returns 0 on success or -1 if not possible
+	int pcm_c_region_init()
+	{
+		return RegionProfiler::getInstance().init() ? 0 : -1;
+	}
+
+	// returns the id of the named region (registered on first use) or -1
+	int32_t pcm_c_region_id(const char * name)
+	{
+		if (name == NULL)
+			return -1;
+
+		return RegionProfiler::getInstance().getRegionId(name);
+	}
+
+	void pcm_c_region_begin(int32_t id)
+	{
+		RegionProfiler::getInstance().begin(id);
+	}
+
+	void pcm_c_region_end(int32_t id)
+	{
+		RegionProfiler::getInstance().end(id);
+	}
+
+	// prints the per-region statistics of all threads to stdout
+	void pcm_c_region_dump()
+	{
+		RegionProfiler::getInstance().dump(cout);
+	}
+
+	static void regionDumpAtExit()
+	{
+		pcm_c_region_dump();
+	}
+
+	void pcm_c_region_dump_at_exit()
+	{
+		static bool registered = false;
+		if (!registered)
+		{
+			registered = true;
+			atexit(regionDumpAtExit);
+		}
 	}
 }
 
@@ -11,6 +11,7 @@
     #include "windows/windriver.h"
 #else
     #include <unistd.h>
+    #include <sys/stat.h>
 #endif
 
 #include <memory>
@@ -22,6 +23,14 @@
 #include <numeric>
 #include <algorithm>
 #include <set>
+#include <array>
+#include <sstream>
+#include <iomanip>
+#include <functional>
+#include <future>
+#include <mutex>
+#include <cctype>
+#include <cstdio>
 
 #ifdef _MSC_VER
     #include "freegetopt/getopt.h"
@@ -29,6 +38,7 @@
 
 #include "lspci.h"
 #include "utils.h"
+#include "uncore_multiplexer.h"
 using namespace std;
 using namespace pcm;
 
@@ -496,8 +506,8 @@ string build_pci_header(const PCIDB & pciDB, uint32_t column_width, const struct
     snprintf(speed_buf, sizeof(speed_buf), "Gen%1d x%-2d", p.link_speed, p.link_width);
     snprintf(vid_did_buf, sizeof(vid_did_buf), "%04X:%04X", p.vendor_id, p.device_id);
     snprintf(device_name_buf, sizeof(device_name_buf), "%s %s",
-            (pciDB.first.count(p.vendor_id) > 0)?pciDB.first.at(p.vendor_id).c_str():"unknown vendor",
-            (pciDB.second.count(p.vendor_id) > 0 && pciDB.second.at(p.vendor_id).count(p.device_id) > 0)?pciDB.second.at(p.vendor_id).at(p.device_id).c_str():"unknown device"
+            pciDB.getVendorName(p.vendor_id).c_str(),
+            pciDB.getDeviceName(p.vendor_id, p.device_id).c_str()
         );
     s += bdf_buf;
     s += '|';
@@ -698,6 +708,10 @@ private:
     uint32_t m_model;
 protected:
     void probeDeviceRange(std::vector<struct pci> &child_pci_devs, int domain, int secondary, int subordinate);
+    // runs probeSocket for every socket on its own thread, appends the results to iios in the order of socket_ids
+    bool probeSocketsInParallel(const std::vector<uint32_t> &socket_ids, std::vector<struct iio_stacks_on_socket>& iios,
+                                const std::function<bool(struct iio_stacks_on_socket &)> &probeSocket);
+    static std::mutex outputMutex; // serializes the progress output of parallel probes
 public:
     IPlatformMapping(int cpu_model, uint32_t sockets_count) : m_sockets(sockets_count), m_model(cpu_model) {}
     virtual ~IPlatformMapping() {};
@@ -746,14 +760,15 @@ bool PurleyPlatformMapping::pciTreeDiscover(std::vector<struct iio_stacks_on_soc
         return false;
     }
 
-    for (uint32_t socket_id = 0; socket_id < socketsCount(); socket_id++) {
+    std::vector<uint32_t> socket_ids(socketsCount());
+    std::iota(socket_ids.begin(), socket_ids.end(), 0);
+    return probeSocketsInParallel(socket_ids, iios, [&ubox](struct iio_stacks_on_socket &iio_on_socket) {
+        const uint32_t socket_id = iio_on_socket.socket_id;
         if (!PciHandleType::exists(0, ubox[socket_id], SKX_UBOX_DEVICE_NUM, SKX_UBOX_FUNCTION_NUM)) {
             cerr << "No access to PCICFG\n" << endl;
             return false;
         }
         uint64 cpubusno = 0;
-        struct iio_stacks_on_socket iio_on_socket;
-        iio_on_socket.socket_id = socket_id;
         PciHandleType h(0, ubox[socket_id], SKX_UBOX_DEVICE_NUM, SKX_UBOX_FUNCTION_NUM);
         h.read64(ROOT_BUSES_OFFSET, &cpubusno);
 
@@ -796,10 +811,8 @@ bool PurleyPlatformMapping::pciTreeDiscover(std::vector<struct iio_stacks_on_soc
 
             iio_on_socket.stacks.push_back(stack);
         }
-        iios.push_back(iio_on_socket);
-    }
-
-    return true;
+        return true;
+    });
 }
 
 class IPlatformMapping10Nm: public IPlatformMapping {
@@ -866,9 +879,10 @@ public:
 
 bool WhitleyPlatformMapping::pciTreeDiscover(std::vector<struct iio_stacks_on_socket>& iios)
 {
-    for (uint32_t socket = 0; socket < socketsCount(); socket++) {
-        struct iio_stacks_on_socket iio_on_socket;
-        iio_on_socket.socket_id = socket;
+    std::vector<uint32_t> socket_ids(socketsCount());
+    std::iota(socket_ids.begin(), socket_ids.end(), 0);
+    return probeSocketsInParallel(socket_ids, iios, [this](struct iio_stacks_on_socket &iio_on_socket) {
+        const uint32_t socket = iio_on_socket.socket_id;
         std::map<uint8_t, uint8_t> sad_id_bus_map;
         if (!getSadIdRootBusMap(socket, sad_id_bus_map)) {
             return false;
@@ -974,10 +988,8 @@ bool WhitleyPlatformMapping::pciTreeDiscover(std::vector<struct iio_stacks_on_so
             }
             iio_on_socket.stacks.push_back(stack);
         }
-        std::sort(iio_on_socket.stacks.begin(), iio_on_socket.stacks.end());
-        iios.push_back(iio_on_socket);
-    }
-    return true;
+        return true;
+    });
 }
 
 // Mapping for Snowridge.
@@ -1269,6 +1281,7 @@ bool EagleStreamPlatformMapping::eagleStreamDmiStackProbe(int unit, const struct
     pch_part.part_id = dmi_part_id;
     pci->bdf = address;
     if (!probe_pci(pci)) {
+        std::lock_guard<std::mutex> lock(outputMutex);
         cerr << "Failed to probe DMI Stack: address: " << std::setw(4) << std::setfill('0') << std::hex << address.domainno <<
                                                           std::setw(2) << std::setfill('0') << ":" << address.busno << ":" << address.devno <<
                                                           "." << address.funcno << std::dec << endl;
@@ -1425,20 +1438,19 @@ bool EagleStreamPlatformMapping::pciTreeDiscover(std::vector<struct iio_stacks_o
         return false;
     }
 
+    std::vector<uint32_t> socket_ids;
     for (auto iter = root_buses.cbegin(); iter != root_buses.cend(); ++iter) {
-        auto rbs_on_socket = iter->second;
-        struct iio_stacks_on_socket iio_on_socket;
-        iio_on_socket.socket_id = iter->first;
+        socket_ids.push_back(iter->first);
+    }
+    return probeSocketsInParallel(socket_ids, iios, [this, &root_buses](struct iio_stacks_on_socket &iio_on_socket) {
+        const auto &rbs_on_socket = root_buses.at(iio_on_socket.socket_id);
         for (auto rb = rbs_on_socket.cbegin(); rb != rbs_on_socket.cend(); ++rb) {
             if (!stackProbe(rb->first, rb->second, iio_on_socket)) {
                 return false;
             }
         }
-        std::sort(iio_on_socket.stacks.begin(), iio_on_socket.stacks.end());
-        iios.push_back(iio_on_socket);
-    }
-
-    return true;
+        return true;
+    });
 }
 
 void IPlatformMapping::probeDeviceRange(std::vector<struct pci> &pci_devs, int domain, int secondary, int subordinate)
@@ -1462,6 +1474,32 @@ void IPlatformMapping::probeDeviceRange(std::vector<struct pci> &pci_devs, int d
     }
 }
 
+std::mutex IPlatformMapping::outputMutex;
+
+bool IPlatformMapping::probeSocketsInParallel(const std::vector<uint32_t> &socket_ids, std::vector<struct iio_stacks_on_socket>& iios,
+                                              const std::function<bool(struct iio_stacks_on_socket &)> &probeSocket)
+{
+    // the sockets have separate root buses, so their probes are independent
+    std::vector<struct iio_stacks_on_socket> results(socket_ids.size());
+    std::vector<std::future<bool>> probes;
+    for (size_t i = 0; i < socket_ids.size(); ++i) {
+        results[i].socket_id = socket_ids[i];
+        probes.push_back(std::async(std::launch::async, [&probeSocket, &results, i]() { return probeSocket(results[i]); }));
+    }
+    bool ok = true;
+    for (auto &probe : probes) {
+        ok = probe.get() && ok;
+    }
+    if (!ok) {
+        return false;
+    }
+    for (auto &result : results) {
+        std::sort(result.stacks.begin(), result.stacks.end());
+        iios.push_back(std::move(result));
+    }
+    return true;
+}
+
 class BirchStreamPlatform: public IPlatformMapping {
 private:
     bool isPcieStack(int unit);
@@ -1606,16 +1644,19 @@ bool BirchStreamPlatform::stackProbe(int unit, const struct bdf &address, struct
         return birchStreamAcceleratorStackProbe(unit, address, iio_on_socket);
     }
     else if (isPartHcStack(unit)) {
+        std::lock_guard<std::mutex> lock(outputMutex);
         cout << "Found a part of HC stack. Stack ID - " << unit << " domain " << address.domainno
              << " bus " << std::hex << std::setfill('0') << std::setw(2) << (int)address.busno << std::dec << ". Don't probe it again." << endl;
         return true;
     }
     else if (isUboxStack(unit)) {
+        std::lock_guard<std::mutex> lock(outputMutex);
         cout << "Found UBOX stack. Stack ID - " << unit << " domain " << address.domainno
              << " bus " << std::hex << std::setfill('0') << std::setw(2) << (int)address.busno << std::dec << endl;
         return true;
     }
 
+    std::lock_guard<std::mutex> lock(outputMutex);
     cout << "Unknown stack ID " << unit << " domain " << address.domainno << " bus " << std::hex << std::setfill('0') << std::setw(2) << (int)address.busno << std::dec << endl;
 
     return false;
@@ -1671,20 +1712,19 @@ bool BirchStreamPlatform::pciTreeDiscover(std::vector<struct iio_stacks_on_socke
         return false;
     }
 
+    std::vector<uint32_t> socket_ids;
     for (auto iter = root_buses.cbegin(); iter != root_buses.cend(); ++iter) {
-        auto rbs_on_socket = iter->second;
-        struct iio_stacks_on_socket iio_on_socket;
-        iio_on_socket.socket_id = iter->first;
+        socket_ids.push_back(iter->first);
+    }
+    return probeSocketsInParallel(socket_ids, iios, [this, &root_buses](struct iio_stacks_on_socket &iio_on_socket) {
+        const auto &rbs_on_socket = root_buses.at(iio_on_socket.socket_id);
         for (auto rb = rbs_on_socket.cbegin(); rb != rbs_on_socket.cend(); ++rb) {
             if (!stackProbe(rb->first, rb->second, iio_on_socket)) {
                 return false;
             }
         }
-        std::sort(iio_on_socket.stacks.begin(), iio_on_socket.stacks.end());
-        iios.push_back(iio_on_socket);
-    }
-
-    return true;
+        return true;
+    });
 }
 
 std::unique_ptr<IPlatformMapping> IPlatformMapping::getPlatformMapping(int cpu_model, uint32_t sockets_count)
@@ -1706,6 +1746,195 @@ std::unique_ptr<IPlatformMapping> IPlatformMapping::getPlatformMapping(int cpu_m
     }
 }
 
+/*
+ * Cache of the discovered IIO stacks (environment variable PCM_IIO_TOPOLOGY_CACHE=<file>).
+ * The cache stores only the topology: addresses of the root ports and the devices behind them and
+ * their part numbers. The config space values (bus ranges, link status) are probed again on load.
+ * It is valid for the same boot, CPU model, socket count and list of PCI devices enumerated by the OS.
+ */
+static const char * iioTopologyCacheMagic = "pcm-iio-topology-cache-v1";
+
+std::string getIioTopologyFingerprint(int cpu_model, uint32_t sockets_count)
+{
+#ifdef __linux__
+    const auto & index = PciDeviceIndex::getInstance();
+    std::string boot_id = readSysFS("/proc/sys/kernel/random/boot_id", true);
+    boot_id.erase(std::remove_if(boot_id.begin(), boot_id.end(), ::isspace), boot_id.end());
+    if (!index.isValid() || boot_id.empty()) {
+        return std::string();
+    }
+    // FNV-1a hash of the device list
+    uint64_t hash = 14695981039346656037ULL;
+    for (const auto & name : index.getNames()) {
+        for (const char c : name + ";") {
+            hash = (hash ^ (uint8_t)c) * 1099511628211ULL;
+        }
+    }
+    std::ostringstream fingerprint;
+    fingerprint << "model=" << cpu_model << " sockets=" << sockets_count << " boot=" << boot_id
+                << " devices=" << index.getNames().size() << ":" << std::hex << hash;
+    return fingerprint.str();
+#else
+    (void)cpu_model;
+    (void)sockets_count;
+    return std::string();
+#endif
+}
+
+void writeCachedPci(std::ostream & out, const struct pci & dev)
+{
+    out << "pci " << dev.bdf.domainno << " " << (int)dev.bdf.busno << " " << (int)dev.bdf.devno << " " << (int)dev.bdf.funcno
+        << " " << dev.exist << " " << dev.parts_no.size();
+    for (const auto part : dev.parts_no) {
+        out << " " << (int)part;
+    }
+    out << " " << dev.child_pci_devs.size() << "\n";
+    for (const auto & child : dev.child_pci_devs) {
+        writeCachedPci(out, child);
+    }
+}
+
+bool readCachedPci(std::istream & in, struct pci & dev)
+{
+    std::string tag;
+    uint32_t domain = 0, bus = 0, device = 0, function = 0;
+    bool exist = false;
+    size_t parts = 0, children = 0;
+    if (!(in >> tag >> domain >> bus >> device >> function >> exist >> parts) || tag != "pci" ||
+        bus > 0xff || device > 0x1f || function > 0x7) {
+        return false;
+    }
+    dev = pci(domain, (uint8_t)bus, (uint8_t)device, (uint8_t)function);
+    for (size_t i = 0; i < parts; ++i) {
+        int part = 0;
+        if (!(in >> part)) return false;
+        dev.parts_no.push_back((uint8_t)part);
+    }
+    if (!(in >> children)) return false;
+    // refresh the config space values, a device that disappeared invalidates the cache
+    if (exist && !probe_pci(&dev)) {
+        return false;
+    }
+    dev.child_pci_devs.resize(children);
+    for (auto & child : dev.child_pci_devs) {
+        if (!readCachedPci(in, child)) return false;
+    }
+    return true;
+}
+
+bool loadIioTopologyCache(const std::string & path, const std::string & fingerprint, std::vector<struct iio_stacks_on_socket>& iios)
+{
+    std::ifstream in(path);
+    std::string magic, cached_fingerprint;
+    if (!std::getline(in, magic) || magic != iioTopologyCacheMagic ||
+        !std::getline(in, cached_fingerprint) || cached_fingerprint != fingerprint) {
+        return false;
+    }
+    std::vector<struct iio_stacks_on_socket> result;
+    std::string tag;
+    size_t sockets = 0;
+    if (!(in >> tag >> sockets) || tag != "sockets") return false;
+    result.resize(sockets);
+    for (auto & socket : result) {
+        size_t stacks = 0;
+        if (!(in >> tag >> socket.socket_id >> stacks) || tag != "socket") return false;
+        socket.stacks.resize(stacks);
+        for (auto & stack : socket.stacks) {
+            uint32_t busno = 0;
+            size_t parts = 0;
+            if (!(in >> tag >> stack.iio_unit_id >> stack.domain >> busno >> parts) || tag != "stack") return false;
+            stack.busno = (uint8_t)busno;
+            in.ignore(1); // the name is the rest of the line
+            if (!std::getline(in, stack.stack_name)) return false;
+            stack.parts.resize(parts);
+            for (auto & part : stack.parts) {
+                size_t children = 0;
+                if (!(in >> tag >> part.part_id >> children) || tag != "part") return false;
+                if (!readCachedPci(in, part.root_pci_dev)) return false;
+                part.child_pci_devs.resize(children);
+                for (auto & child : part.child_pci_devs) {
+                    if (!readCachedPci(in, child)) return false;
+                }
+            }
+        }
+    }
+    iios = std::move(result);
+    return true;
+}
+
+void saveIioTopologyCache(const std::string & path, const std::string & fingerprint, const std::vector<struct iio_stacks_on_socket>& iios)
+{
+#ifdef __linux__
+    std::ostringstream out;
+    out << iioTopologyCacheMagic << "\n" << fingerprint << "\n" << "sockets " << iios.size() << "\n";
+    for (const auto & socket : iios) {
+        out << "socket " << socket.socket_id << " " << socket.stacks.size() << "\n";
+        for (const auto & stack : socket.stacks) {
+            out << "stack " << stack.iio_unit_id << " " << stack.domain << " " << (int)stack.busno << " "
+                << stack.parts.size() << " " << stack.stack_name << "\n";
+            for (const auto & part : stack.parts) {
+                out << "part " << part.part_id << " " << part.child_pci_devs.size() << "\n";
+                writeCachedPci(out, part.root_pci_dev);
+                for (const auto & child : part.child_pci_devs) {
+                    writeCachedPci(out, child);
+                }
+            }
+        }
+    }
+    const std::string content = out.str();
+    // write to a new temporary file and rename it, so concurrent runs never read a partial cache.
+    // mkstemp creates the file exclusively with a random name: it never follows a planted symlink
+    // (pcm-iio runs as root and the cache may be in a world-writable directory like /tmp)
+    std::vector<char> tmp_path(path.begin(), path.end());
+    const std::string suffix = ".XXXXXX";
+    tmp_path.insert(tmp_path.end(), suffix.begin(), suffix.end());
+    tmp_path.push_back('\0');
+    const int fd = ::mkstemp(tmp_path.data());
+    if (fd < 0) {
+        cerr << "Can not write the IIO topology cache " << path << ": " << strerror(errno) << endl;
+        return;
+    }
+    // mkstemp creates the file with mode 0600, the cache has no secrets
+    ::fchmod(fd, 0644);
+    size_t written = 0;
+    while (written < content.size()) {
+        const ssize_t result = ::write(fd, content.data() + written, content.size() - written);
+        if (result < 0 && errno == EINTR) {
+            continue;
+        }
+        if (result <= 0) {
+            break;
+        }
+        written += (size_t)result;
+    }
+    const bool closed = ::close(fd) == 0;
+    if (written != content.size() || !closed || std::rename(tmp_path.data(), path.c_str()) != 0) {
+        cerr << "Can not write the IIO topology cache " << path << endl;
+        ::unlink(tmp_path.data());
+    }
+#else
+    (void)path;
+    (void)fingerprint;
+    (void)iios;
+#endif
+}
+
+bool discoverIioTopology(IPlatformMapping & mapping, std::vector<struct iio_stacks_on_socket>& iios)
+{
+    const std::string cache_path = safe_getenv("PCM_IIO_TOPOLOGY_CACHE");
+    const std::string fingerprint = cache_path.empty() ? std::string() : getIioTopologyFingerprint(mapping.cpuId(), mapping.socketsCount());
+    if (!fingerprint.empty() && loadIioTopologyCache(cache_path, fingerprint, iios)) {
+        return true;
+    }
+    if (!mapping.pciTreeDiscover(iios)) {
+        return false;
+    }
+    if (!fingerprint.empty()) {
+        saveIioTopologyCache(cache_path, fingerprint, iios);
+    }
+    return true;
+}
+
 ccr* get_ccr(PCM* m, uint64_t& ccr)
 {
     switch (m->getCPUModel())
@@ -1796,50 +2025,120 @@ int iio_evt_parse_handler(evt_cb_type cb_type, void *cb_ctx, counter &base_ctr,
     return 0;
 }
 
-result_content get_IIO_Samples(PCM *m, const std::vector<struct iio_stacks_on_socket>& iios, const struct iio_counter & ctr, uint32_t delay_ms)
+constexpr int IIO_COUNTERS_PER_STACK = 4;
+// index into the counter list for each hardware counter of an IIO stack, -1 if the counter is unused
+typedef std::array<int, IIO_COUNTERS_PER_STACK> iio_event_group;
+
+// packs the events into groups that can be counted simultaneously (each event is pinned to its counter index)
+vector<iio_event_group> pack_IIO_counters(const vector<struct iio_counter>& ctrs)
 {
-    IIOCounterState *before, *after;
-    uint64 rawEvents[4] = {0};
-    auto ccrCopy = ctr.ccr;
-    std::unique_ptr<ccr> pccr(get_ccr(m, ccrCopy));
-    rawEvents[ctr.idx] = pccr->get_ccr_value();
-    const int stacks_count = (int)m->getMaxNumOfIIOStacks();
-    before = new IIOCounterState[iios.size() * stacks_count];
-    after = new IIOCounterState[iios.size() * stacks_count];
-
-    m->programIIOCounters(rawEvents);
-    for (auto socket = iios.cbegin(); socket != iios.cend(); ++socket) {
-        for (auto stack = socket->stacks.cbegin(); stack != socket->stacks.cend(); ++stack) {
-            auto iio_unit_id = stack->iio_unit_id;
-            uint32_t idx = (uint32_t)stacks_count * socket->socket_id + iio_unit_id;
-            before[idx] = m->getIIOCounterState(socket->socket_id, iio_unit_id, ctr.idx);
+    vector<iio_event_group> groups;
+    for (int i = 0; i < (int)ctrs.size(); ++i) {
+        const int idx = ctrs[i].idx;
+        if (idx < 0 || idx >= IIO_COUNTERS_PER_STACK) {
+            throw std::runtime_error("invalid IIO counter index " + std::to_string(idx) + " for " + ctrs[i].h_event_name + "/" + ctrs[i].v_event_name);
         }
-    }
-    MySleepMs(delay_ms);
-    for (auto socket = iios.cbegin(); socket != iios.cend(); ++socket) {
-        for (auto stack = socket->stacks.cbegin(); stack != socket->stacks.cend(); ++stack) {
-            auto iio_unit_id = stack->iio_unit_id;
-            uint32_t idx = (uint32_t)stacks_count * socket->socket_id + iio_unit_id;
-            after[idx] = m->getIIOCounterState(socket->socket_id, iio_unit_id, ctr.idx);
-            uint64_t raw_result = getNumberOfEvents(before[idx], after[idx]);
-            uint64_t trans_result = uint64_t (raw_result * ctr.multiplier / (double) ctr.divider * (1000 / (double) delay_ms));
-            results[socket->socket_id][iio_unit_id][std::pair<h_id,v_id>(ctr.h_id,ctr.v_id)] = trans_result;
+        auto group = std::find_if(groups.begin(), groups.end(), [idx](const iio_event_group& g) { return g[idx] < 0; });
+        if (group == groups.end()) {
+            iio_event_group g;
+            g.fill(-1);
+            groups.push_back(g);
+            group = groups.end() - 1;
         }
+        (*group)[idx] = i;
     }
-    deleteAndNullifyArray(before);
-    deleteAndNullifyArray(after);
-    return results;
+    return groups;
 }
 
-void collect_data(PCM *m, const double delay, vector<struct iio_stacks_on_socket>& iios, vector<struct iio_counter>& ctrs)
+// per socket/stack counter values of the programmed group
+typedef std::vector<std::array<IIOCounterState, IIO_COUNTERS_PER_STACK> > iio_counter_states;
+
+class IIOEventCollector
 {
-    const uint32_t delay_ms = uint32_t(delay * 1000 / ctrs.size());
-    for (auto counter = ctrs.begin(); counter != ctrs.end(); ++counter) {
-        counter->data.clear();
-        result_content sample = get_IIO_Samples(m, iios, *counter, delay_ms);
-        counter->data.push_back(sample);
+    PCM *m;
+    const std::vector<struct iio_stacks_on_socket>& iios;
+    vector<struct iio_counter>& ctrs;
+    vector<iio_event_group> groups;
+    const int stacks_count;
+    std::shared_ptr<UncoreEventMultiplexer<iio_counter_states> > multiplexer;
+
+    void program(const size_t g)
+    {
+        uint64 rawEvents[IIO_COUNTERS_PER_STACK] = {0};
+        for (int c = 0; c < IIO_COUNTERS_PER_STACK; ++c) {
+            if (groups[g][c] < 0) continue;
+            auto ccrCopy = ctrs[groups[g][c]].ccr;
+            std::unique_ptr<ccr> pccr(get_ccr(m, ccrCopy));
+            rawEvents[c] = pccr->get_ccr_value();
+        }
+        m->programIIOCounters(rawEvents);
     }
-}
+    void read(iio_counter_states & states)
+    {
+        for (auto socket = iios.cbegin(); socket != iios.cend(); ++socket) {
+            for (auto stack = socket->stacks.cbegin(); stack != socket->stacks.cend(); ++stack) {
+                auto iio_unit_id = stack->iio_unit_id;
+                uint32_t idx = (uint32_t)stacks_count * socket->socket_id + iio_unit_id;
+                m->getIIOCounterStates(socket->socket_id, iio_unit_id, states[idx].data());
+            }
+        }
+    }
+public:
+    IIOEventCollector(PCM *m_, const std::vector<struct iio_stacks_on_socket>& iios_, vector<struct iio_counter>& ctrs_) :
+        m(m_),
+        iios(iios_),
+        ctrs(ctrs_),
+        groups(pack_IIO_counters(ctrs_)),
+        stacks_count((int)m_->getMaxNumOfIIOStacks())
+    {
+        if (groups.empty()) {
+            throw std::runtime_error("no IIO events to collect");
+        }
+        const size_t numStates = (size_t)m->getNumSockets() * stacks_count;
+        multiplexer = std::make_shared<UncoreEventMultiplexer<iio_counter_states> >(
+            std::vector<size_t>(groups.size(), numStates * IIO_COUNTERS_PER_STACK),
+            [this](const size_t g) { program(g); },
+            [this](const size_t, iio_counter_states & states) { read(states); },
+            [](const size_t, const iio_counter_states & before, const iio_counter_states & after, std::vector<uint64> & counts) {
+                for (size_t idx = 0; idx < before.size(); ++idx) {
+                    for (int c = 0; c < IIO_COUNTERS_PER_STACK; ++c) {
+                        counts[idx * IIO_COUNTERS_PER_STACK + c] += getNumberOfEvents(before[idx][c], after[idx][c]);
+                    }
+                }
+            },
+            iio_counter_states(numStates));
+    }
+    size_t getNumGroups() const { return groups.size(); }
+
+    void collect(const double delay)
+    {
+        const auto & result = multiplexer->collect(delay);
+        const double interval = result.getIntervalTime();
+        for (auto socket = iios.cbegin(); socket != iios.cend(); ++socket) {
+            for (auto stack = socket->stacks.cbegin(); stack != socket->stacks.cend(); ++stack) {
+                auto iio_unit_id = stack->iio_unit_id;
+                uint32_t idx = (uint32_t)stacks_count * socket->socket_id + iio_unit_id;
+                for (size_t g = 0; g < groups.size(); ++g) {
+                    for (int c = 0; c < IIO_COUNTERS_PER_STACK; ++c) {
+                        if (groups[g][c] < 0) continue;
+                        const auto & ctr = ctrs[groups[g][c]];
+                        const uint64_t raw_result = result.getScaledCount(g, idx * IIO_COUNTERS_PER_STACK + c);
+                        const uint64_t trans_result = (interval > 0.) ? uint64_t(raw_result * ctr.multiplier / (double) ctr.divider / interval) : 0;
+                        results[socket->socket_id][iio_unit_id][std::pair<h_id,v_id>(ctr.h_id,ctr.v_id)] = trans_result;
+                    }
+                }
+            }
+        }
+        for (auto counter = ctrs.begin(); counter != ctrs.end(); ++counter) {
+            counter->data.clear();
+            counter->data.push_back(results);
+        }
+    }
+    double getCoverage() const
+    {
+        return multiplexer->getResult().getAverageCoverage();
+    }
+};
 
 void print_PCIeMapping(const std::vector<struct iio_stacks_on_socket>& iios, const PCIDB & pciDB, std::ostream& stream)
 {
@@ -1981,7 +2280,7 @@ int mainThrows(int argc, char * argv[])
     }
 
     std::vector<struct iio_stacks_on_socket> iios;
-    if (!mapping->pciTreeDiscover(iios)) {
+    if (!discoverIioTopology(*mapping, iios)) {
         exit(EXIT_FAILURE);
     }
 
@@ -2047,12 +2346,31 @@ int mainThrows(int argc, char * argv[])
 
     results.resize(m->getNumSockets(), stack_content(m->getMaxNumOfIIOStacks(), ctr_data()));
 
+    std::shared_ptr<IIOEventCollector> collector;
+    try
+    {
+        collector = std::make_shared<IIOEventCollector>(m, iios, evt_ctx.ctrs);
+    }
+    catch (std::exception & e)
+    {
+        std::cerr << "Error info:" << e.what() << "\n";
+        exit(EXIT_FAILURE);
+    }
+    std::cerr << "Counting " << evt_ctx.ctrs.size() << " events in " << collector->getNumGroups()
+              << " counter groups rotated every " << UncoreEventMultiplexer<iio_counter_states>::defaultSliceMs << " ms\n";
+
     mainLoop([&]()
     {
-        collect_data(m, delay, iios, evt_ctx.ctrs);
+        collector->collect(delay);
         vector<string> display_buffer = csv ?
             build_csv(iios, evt_ctx.ctrs, human_readable, show_root_port, csv_delimiter, nameMap) :
             build_display(iios, evt_ctx.ctrs, pciDB, nameMap);
+        if (!csv) {
+            std::stringstream coverageInfo;
+            coverageInfo << "Each event was counted " << std::fixed << std::setprecision(1)
+                         << 100.0 * collector->getCoverage() << "% of the interval, values are scaled to the full interval";
+            display_buffer.push_back(coverageInfo.str());
+        }
         display(display_buffer, *output);
         return true;
     });
@@ -16,6 +16,8 @@
 #include <bitset>
 #include <algorithm>
 #include <string.h>
+#include <chrono>
+#include <thread>
 #ifdef _MSC_VER
 #include "freegetopt/getopt.h"
 #endif
@@ -40,6 +42,7 @@ using namespace pcm;
 #define FB_INS_RD 1
 
 #define PCM_DELAY_DEFAULT 3.0 // in seconds
+#define PCM_DIST_SAMPLE_MS_DEFAULT 10
 #define MAX_CORES 4096
 
 EventSelectRegister regs[2];
@@ -447,6 +450,156 @@ void collect_data(PCM *m, bool enable_pmm, bool enable_verbose, int delay_ms, Ma
     deleteAndNullifyArray(AfterState);
 }
 
+/*
+    Latency distribution mode: samples the RPQ/WPQ occupancy and insert counters of every memory
+    channel each samplePeriod. Occupancy / inserts of one sample window is the average read latency
+    of the requests in that window (Little's law). The per-window estimates are tracked in
+    histograms so tail latency (p99) is visible and not averaged away over the whole interval.
+*/
+class LatencyDistributionCollector
+{
+    PCM * pcm;
+    std::chrono::milliseconds samplePeriod;
+    std::vector<ServerUncoreCounterState> prevState, curState;
+    std::chrono::steady_clock::time_point prevTime;
+    // socket x channel
+    std::vector<std::vector<LogHistogram> > readLatency;
+    std::vector<std::vector<double> > readBytes, writeBytes;
+    double intervalSeconds = 0.;
+    uint64 numSamples = 0;
+
+    LatencyDistributionCollector() = delete;
+    LatencyDistributionCollector(const LatencyDistributionCollector &) = delete;
+    LatencyDistributionCollector & operator = (const LatencyDistributionCollector &) = delete;
+
+    void readStates(std::vector<ServerUncoreCounterState> & states)
+    {
+        for (uint32 skt = 0; skt < pcm->getNumSockets(); ++skt)
+        {
+            pcm->readServerUncoreCounterState(skt, states[skt], PCM::MC_UNITS);
+        }
+    }
+
+    void sample()
+    {
+        readStates(curState);
+        const auto now = std::chrono::steady_clock::now();
+        const double seconds = std::chrono::duration<double>(now - prevTime).count();
+        if (seconds > 0.)
+        {
+            for (uint32 skt = 0; skt < pcm->getNumSockets(); ++skt)
+            {
+                for (uint32 channel = 0; channel < (uint32)pcm->getMCChannelsPerSocket(); ++channel)
+                {
+                    const double rinsert = (double)getMCCounter(channel, RPQ_INS, prevState[skt], curState[skt]);
+                    const double roccupancy = (double)getMCCounter(channel, RPQ_OCC, prevState[skt], curState[skt]);
+                    const double winsert = (double)getMCCounter(channel, WPQ_INS, prevState[skt], curState[skt]);
+                    const double clocks = (double)getDRAMClocks(channel, prevState[skt], curState[skt]);
+                    readBytes[skt][channel] += rinsert * 64.;
+                    writeBytes[skt][channel] += winsert * 64.;
+                    if (rinsert > 0. && clocks > 0.)
+                    {
+                        // occupancy per insert is in DRAM clocks
+                        const double clocksPerNs = clocks / (seconds * 1e9);
+                        readLatency[skt][channel].add(roccupancy / rinsert / clocksPerNs);
+                    }
+                }
+            }
+            intervalSeconds += seconds;
+            ++numSamples;
+        }
+        std::swap(prevState, curState);
+        prevTime = now;
+    }
+
+public:
+    LatencyDistributionCollector(PCM * m, const uint32 samplePeriodMs) :
+        pcm(m),
+        samplePeriod(samplePeriodMs),
+        prevState(m->getNumSockets()),
+        curState(m->getNumSockets()),
+        readLatency(m->getNumSockets(), std::vector<LogHistogram>(m->getMCChannelsPerSocket())),
+        readBytes(m->getNumSockets(), std::vector<double>(m->getMCChannelsPerSocket(), 0.)),
+        writeBytes(m->getNumSockets(), std::vector<double>(m->getMCChannelsPerSocket(), 0.))
+    {
+        readStates(prevState);
+        prevTime = std::chrono::steady_clock::now();
+    }
+
+    //! samples the memory controller counters every samplePeriod until delay_ms milliseconds have passed
+    void collect(const int delay_ms)
+    {
+        const auto start = std::chrono::steady_clock::now();
+        const auto end = start + std::chrono::milliseconds(delay_ms);
+        auto deadline = start;
+        do
+        {
+            deadline += samplePeriod;
+            std::this_thread::sleep_until((std::min)(deadline, end));
+            sample();
+        } while (std::chrono::steady_clock::now() < end);
+    }
+
+    void print(const bool enable_pmm)
+    {
+        for (uint32 skt = 0; skt < pcm->getNumSockets(); ++skt)
+        {
+            cout << "Socket" << skt << " " << (enable_pmm ? "PMM" : "DDR") << " read latency (ns) over "
+                 << numSamples << " samples of " << samplePeriod.count() << " ms\n";
+            cout << "           p50       p99       max   Samples   Rd MB/s   Wr MB/s\n";
+            for (uint32 channel = 0; channel < (uint32)pcm->getMCChannelsPerSocket(); ++channel)
+            {
+                const auto & h = readLatency[skt][channel];
+                if (h.count() == 0 && readBytes[skt][channel] == 0. && writeBytes[skt][channel] == 0.)
+                {
+                    // inactive channel
+                    continue;
+                }
+                const double seconds = (intervalSeconds > 0.) ? intervalSeconds : 1.;
+                cout << "Ch" << left << setw(3) << channel << right << fixed << setprecision(1)
+                     << setw(10) << h.percentile(50.)
+                     << setw(10) << h.percentile(99.)
+                     << setw(10) << h.max()
+                     << setw(10) << h.count()
+                     << setw(10) << readBytes[skt][channel] / seconds / 1e6
+                     << setw(10) << writeBytes[skt][channel] / seconds / 1e6 << "\n";
+            }
+            cout << "\n";
+        }
+        for (auto & s : readLatency)
+            for (auto & h : s)
+                h.reset();
+        for (auto & s : readBytes)
+            std::fill(s.begin(), s.end(), 0.);
+        for (auto & s : writeBytes)
+            std::fill(s.begin(), s.end(), 0.);
+        intervalSeconds = 0.;
+        numSamples = 0;
+    }
+};
+
+void collect_distribution(PCM *m, bool enable_pmm, int delay_ms, uint32 sample_ms, MainLoop & mainLoop)
+{
+    if (m->DDRLatencyMetricsAvailable() == false)
+    {
+        cerr << "DDR/PMM latency metrics are not supported on your processor\n";
+        exit(EXIT_FAILURE);
+    }
+    if (enable_pmm && m->PMMTrafficMetricsAvailable() == false)
+    {
+        cerr << "PMM metrics are not supported on your processor\n";
+        exit(EXIT_FAILURE);
+    }
+    LatencyDistributionCollector collector(m, sample_ms);
+    mainLoop([&]()
+    {
+        collector.collect(delay_ms);
+        collector.print(enable_pmm);
+        std::cout << std::flush;
+        return true;
+    });
+}
+
 void print_usage()
 {
     cout << "\nUsage: \n";
@@ -456,6 +609,9 @@ void print_usage()
     cout << " -silent                   => silence information output and print only measurements\n";
     cout << " --version                 => print application version\n";
     cout << " -v | --verbose            => verbose Output\n";
+    cout << " -dist[=ms]                => latency distribution mode: sample the memory controller queues every\n";
+    cout << "                              ms milliseconds (default " << PCM_DIST_SAMPLE_MS_DEFAULT << ") and print per-channel p50/p99\n";
+    cout << "                              read latency and bandwidth every second\n";
     cout << "\n";
 }
 
@@ -477,11 +633,14 @@ int mainThrows(int argc, char * argv[])
     bool enable_pmm = false;
     bool enable_verbose = false;
     int delay_ms = 1000;
+    bool enable_dist = false;
+    uint32 dist_sample_ms = PCM_DIST_SAMPLE_MS_DEFAULT;
     MainLoop mainLoop;
     if(argc > 1) do
     {
         argv++;
         argc--;
+        string arg_value;
 
         if (check_argument_equals(*argv, {"--help", "-h", "/h"}))
         {
@@ -507,6 +666,26 @@ int mainThrows(int argc, char * argv[])
             enable_verbose = true;
             continue;
         }
+        else if (check_argument_equals(*argv, {"-dist", "/dist"}))
+        {
+            enable_dist = true;
+            continue;
+        }
+        else if (extract_argument_value(*argv, {"-dist", "/dist"}, arg_value))
+        {
+            enable_dist = true;
+            if (!arg_value.empty())
+            {
+                const int ms = atoi(arg_value.c_str());
+                if (ms <= 0 || ms > delay_ms)
+                {
+                    cerr << "Error: invalid sample period " << arg_value << " ms (must be between 1 and " << delay_ms << ")\n";
+                    exit(EXIT_FAILURE);
+                }
+                dist_sample_ms = (uint32)ms;
+            }
+            continue;
+        }
     } while(argc > 1);
 
     PCM::ExtendedCustomCoreEventDescription conf;
@@ -519,7 +698,14 @@ int mainThrows(int argc, char * argv[])
     DummySocketStates = std::make_shared<std::vector<SocketCounterState> >();
 
     build_registers(m, conf, enable_pmm, enable_verbose);
-    collect_data(m, enable_pmm, enable_verbose, delay_ms, mainLoop);
+    if (enable_dist)
+    {
+        collect_distribution(m, enable_pmm, delay_ms, dist_sample_ms, mainLoop);
+    }
+    else
+    {
+        collect_data(m, enable_pmm, enable_verbose, delay_ms, mainLoop);
+    }
 
     exit(EXIT_SUCCESS);
 }
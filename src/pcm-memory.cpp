@@ -23,11 +23,14 @@
 #include <string.h>
 #include <string>
 #include <assert.h>
+#include <thread>
 #include "cpucounters.h"
 #include "utils.h"
+#include "uncore_multiplexer.h"
 
 #define PCM_DELAY_DEFAULT 1.0 // in seconds
 #define PCM_DELAY_MIN 0.015 // 15 milliseconds is practical on most modern CPUs
+#define PCM_HISTOGRAM_SAMPLE_MS_DEFAULT 5
 
 #define DEFAULT_DISPLAY_COLUMNS 2
 
@@ -101,6 +104,8 @@ void print_help(const string & prog_name)
     cout << "  -silent                            => silence information output and print only measurements\n";
     cout << "  --version                          => print application version\n";
     cout << "  -u                                 => update measurements instead of printing new ones\n";
+    cout << "  -histogram[=ms] | /histogram[=ms]  => sample memory channel bandwidth every ms milliseconds (default " << PCM_HISTOGRAM_SAMPLE_MS_DEFAULT << ")\n"
+         << "                                        and print p50/p90/p99/max bandwidth per socket and channel for each interval\n";
     print_enforce_flush_option_help();
 #ifdef _MSC_VER
     cout << "  --uninstallDriver | --installDriver=> (un)install driver\n";
@@ -109,6 +114,7 @@ void print_help(const string & prog_name)
     cout << "  " << prog_name << " 1                  => print counters every second without core and socket output\n";
     cout << "  " << prog_name << " 0.5 -csv=test.log  => twice a second save counter values to test.log in CSV format\n";
     cout << "  " << prog_name << " /csv 5 2>/dev/null => one sample every 5 seconds, and discard all diagnostic output\n";
+    cout << "  " << prog_name << " 1 -histogram=2     => bandwidth percentiles of 2 ms samples printed every second\n";
     cout << "\n";
 }
 
@@ -1189,43 +1195,27 @@ void calculate_bandwidth_rank(PCM *m, const std::vector<ServerUncoreCounterState
     }
 }
 
-void readState(std::vector<ServerUncoreCounterState>& state)
+void readState(std::vector<ServerUncoreCounterState>& state, const uint64 unitMask = PCM::ALL_SERVER_UNCORE_UNITS)
 {
     auto* pcm = PCM::getInstance();
     assert(pcm);
     for (uint32 i = 0; i < pcm->getNumSockets(); ++i)
-        state[i] = pcm->getServerUncoreCounterState(i);
+        pcm->readServerUncoreCounterState(i, state[i], unitMask);
 };
 
 class CHAEventCollector
 {
+    typedef std::vector<ServerUncoreCounterState> StateType;
     std::vector<eventGroup_t> eventGroups;
-    double delay;
     const char* sysCmd;
     const MainLoop& mainLoop;
     PCM* pcm;
-    std::vector<std::vector<ServerUncoreCounterState> > MidStates;
-    size_t curGroup = 0ULL;
+    std::shared_ptr<UncoreEventMultiplexer<StateType> > multiplexer;
     uint64 totalCount = 0ULL;
     CHAEventCollector() = delete;
     CHAEventCollector(const CHAEventCollector&) = delete;
     CHAEventCollector & operator = (const CHAEventCollector &) = delete;
 
-    uint64 extractCHATotalCount(const std::vector<ServerUncoreCounterState>& before, const std::vector<ServerUncoreCounterState>& after)
-    {
-        uint64 result = 0;
-        for (uint32 i = 0; i < pcm->getNumSockets(); ++i)
-        {
-            for (uint32 cbo = 0; cbo < pcm->getMaxNumOfUncorePMUs(PCM::CBO_PMU_ID); ++cbo)
-            {
-                for (uint32 ctr = 0; ctr < 4 && ctr < eventGroups[curGroup].size(); ++ctr)
-                {
-                    result += getUncoreCounter(PCM::CBO_PMU_ID, cbo, ctr, before[i], after[i]);
-                }
-            }
-        }
-        return result;
-    }
     void programGroup(const size_t group)
     {
         uint64 events[4] = { 0, 0, 0, 0 };
@@ -1238,7 +1228,7 @@ class CHAEventCollector
     }
 
 public:
-    CHAEventCollector(const double delay_, const char* sysCmd_, const MainLoop& mainLoop_, PCM* m) :
+    CHAEventCollector(const char* sysCmd_, const MainLoop& mainLoop_, PCM* m) :
         sysCmd(sysCmd_),
         mainLoop(mainLoop_),
         pcm(m)
@@ -1287,42 +1277,239 @@ public:
 
         assert(eventGroups.size() > 1);
 
-        delay = delay_ / double(eventGroups.size());
-        MidStates.resize(eventGroups.size() - 1);
-        for (auto& e : MidStates)
+        multiplexer = std::make_shared<UncoreEventMultiplexer<StateType> >(
+            std::vector<size_t>(eventGroups.size(), 1),
+            [this](const size_t group) { programGroup(group); },
+            [](const size_t, StateType & state) { readState(state, PCM::CHA_UNITS); },
+            [this](const size_t group, const StateType & before, const StateType & after, std::vector<uint64> & counts)
+            {
+                for (uint32 i = 0; i < pcm->getNumSockets(); ++i)
+                {
+                    for (uint32 cbo = 0; cbo < pcm->getMaxNumOfUncorePMUs(PCM::CBO_PMU_ID); ++cbo)
+                    {
+                        for (uint32 ctr = 0; ctr < 4 && ctr < eventGroups[group].size(); ++ctr)
+                        {
+                            counts[0] += getUncoreCounter(PCM::CBO_PMU_ID, cbo, ctr, before[i], after[i]);
+                        }
+                    }
+                }
+            },
+            StateType(pcm->getNumSockets()));
+    }
+
+    void start()
+    {
+        multiplexer->start();
+    }
+
+    //! multiplexes the CHA event groups for delay seconds
+    void multiplexEvents(const double delay)
+    {
+        const bool blocked = sysCmd != NULL && mainLoop.getNumberOfIterations() == 0 && pcm->isBlocked();
+        const auto & result = multiplexer->collect(blocked ? 0. : delay);
+        totalCount = 0;
+        for (size_t group = 0; group < eventGroups.size(); ++group)
         {
-            e.resize(pcm->getNumSockets());
+            totalCount += result.getScaledCount(group, 0);
         }
     }
 
-    void programFirstGroup()
+    uint64 getTotalCount() const
     {
-        programGroup(0);
+        return totalCount;
     }
+};
 
-    void multiplexEvents(const std::vector<ServerUncoreCounterState>& BeforeState)
+class BandwidthHistogramCollector
+{
+    PCM* pcm;
+    std::chrono::milliseconds samplePeriod;
+    std::vector<ServerUncoreCounterState> prevState, curState;
+    std::chrono::steady_clock::time_point prevTime;
+    // socket x (channels + socket total)
+    std::vector<std::vector<LogHistogram> > readHist, writeHist;
+    std::vector<std::vector<bool> > activeChannel;
+    uint64 numSamples = 0;
+    BandwidthHistogramCollector() = delete;
+    BandwidthHistogramCollector(const BandwidthHistogramCollector&) = delete;
+    BandwidthHistogramCollector & operator = (const BandwidthHistogramCollector &) = delete;
+
+    static const std::vector<double> & percentiles()
+    {
+        static const std::vector<double> p{ 50., 90., 99. };
+        return p;
+    }
+    void sample()
     {
-        for (curGroup = 0; curGroup < eventGroups.size() - 1; ++curGroup)
+        readState(curState, PCM::MC_UNITS);
+        const auto now = std::chrono::steady_clock::now();
+        const double seconds = std::chrono::duration<double>(now - prevTime).count();
+        if (seconds > 0.)
         {
-            assert(curGroup < MidStates.size());
-            calibratedSleep(delay, sysCmd, mainLoop, pcm);
-            readState(MidStates[curGroup]);  // TODO: read only CHA counters (performance optmization)
-            totalCount += extractCHATotalCount((curGroup > 0) ? MidStates[curGroup - 1] : BeforeState, MidStates[curGroup]);
-            programGroup(curGroup + 1);
-            readState(MidStates[curGroup]);  // TODO: read only CHA counters (performance optmization)
+            const auto cpu_model = pcm->getCPUModel();
+            auto toBW = [&seconds](const uint64 nEvents) { return double(nEvents) * 64. / 1000000. / seconds; };
+            for (uint32 skt = 0; skt < pcm->getNumSockets(); ++skt)
+            {
+                double socketReads = 0., socketWrites = 0.;
+                for (uint32 channel = 0; channel < max_imc_channels; ++channel)
+                {
+                    uint64 reads = getMCCounter(channel, ServerUncorePMUs::EventPosition::READ, prevState[skt], curState[skt]);
+                    uint64 writes = getMCCounter(channel, ServerUncorePMUs::EventPosition::WRITE, prevState[skt], curState[skt]);
+                    switch (cpu_model)
+                    {
+                    case PCM::SRF:
+                        reads += getMCCounter(channel, ServerUncorePMUs::EventPosition::READ2, prevState[skt], curState[skt]);
+                        writes += getMCCounter(channel, ServerUncorePMUs::EventPosition::WRITE2, prevState[skt], curState[skt]);
+                        break;
+                    }
+                    if (reads + writes != 0)
+                    {
+                        activeChannel[skt][channel] = true;
+                    }
+                    readHist[skt][channel].add(toBW(reads));
+                    writeHist[skt][channel].add(toBW(writes));
+                    socketReads += toBW(reads);
+                    socketWrites += toBW(writes);
+                }
+                readHist[skt][max_imc_channels].add(socketReads);
+                writeHist[skt][max_imc_channels].add(socketWrites);
+            }
+            ++numSamples;
         }
+        std::swap(prevState, curState);
+        prevTime = now;
+    }
+    bool showChannel(const uint32 skt, const uint32 channel) const
+    {
+        return activeChannel[skt][channel] || skipInactiveChannels == false;
+    }
+    void printTable(const bool show_channel_output) const
+    {
+        auto printRow = [](const std::string & label, const LogHistogram & h)
+        {
+            cout << "|-- " << left << setw(16) << label << right;
+            for (const auto p : percentiles())
+            {
+                cout << setw(10) << h.percentile(p);
+            }
+            cout << setw(10) << h.max() << " --|\n";
+        };
+        for (uint32 skt = 0; skt < pcm->getNumSockets(); ++skt)
+        {
+            cout << "|-- Socket " << setw(2) << skt << " bandwidth (MB/s) over " << numSamples << " samples of "
+                 << samplePeriod.count() << " ms --|\n";
+            cout << "|-- " << setw(16) << " ";
+            for (const auto p : percentiles())
+            {
+                cout << setw(10) << ("p" + std::to_string(int(p)));
+            }
+            cout << setw(10) << "max" << " --|\n";
+            for (uint32 channel = 0; show_channel_output && channel < max_imc_channels; ++channel)
+            {
+                if (showChannel(skt, channel) == false)
+                {
+                    continue;
+                }
+                printRow("Ch " + std::to_string(channel) + " Reads", readHist[skt][channel]);
+                printRow("Ch " + std::to_string(channel) + " Writes", writeHist[skt][channel]);
+            }
+            printRow("Mem Read", readHist[skt][max_imc_channels]);
+            printRow("Mem Write", writeHist[skt][max_imc_channels]);
+        }
+        cout << "\n";
+    }
+    void printCSV(const CsvOutputType outputType, const bool show_channel_output) const
+    {
+        printDateForCSV(outputType);
+        for (uint32 skt = 0; skt < pcm->getNumSockets(); ++skt)
+        {
+            auto printColumns = [&](const std::string & prefix, const LogHistogram & h, const bool valid)
+            {
+                choose(outputType,
+                    [&]() {
+                        for (size_t i = 0; i <= percentiles().size(); ++i)
+                            cout << "SKT" << skt << ',';
+                    },
+                    [&]() {
+                        for (const auto p : percentiles())
+                            cout << prefix << "_p" << int(p) << ',';
+                        cout << prefix << "_max,";
+                    },
+                    [&]() {
+                        if (valid == false)
+                        {
+                            cout << std::string(percentiles().size() + 1, ',');
+                            return;
+                        }
+                        for (const auto p : percentiles())
+                            cout << setw(8) << h.percentile(p) << ',';
+                        cout << setw(8) << h.max() << ',';
+                    });
+            };
+            for (uint32 channel = 0; show_channel_output && channel < max_imc_channels; ++channel)
+            {
+                const bool valid = showChannel(skt, channel);
+                printColumns("Ch" + std::to_string(channel) + "Read", readHist[skt][channel], valid);
+                printColumns("Ch" + std::to_string(channel) + "Write", writeHist[skt][channel], valid);
+            }
+            printColumns("Mem Read (MB/s)", readHist[skt][max_imc_channels], true);
+            printColumns("Mem Write (MB/s)", writeHist[skt][max_imc_channels], true);
+        }
+        cout << "\n";
+    }
 
-        calibratedSleep(delay, sysCmd, mainLoop, pcm);
+public:
+    BandwidthHistogramCollector(PCM* m, const uint32 samplePeriodMs) :
+        pcm(m),
+        samplePeriod(samplePeriodMs),
+        prevState(m->getNumSockets()),
+        curState(m->getNumSockets()),
+        readHist(m->getNumSockets(), std::vector<LogHistogram>(max_imc_channels + 1)),
+        writeHist(m->getNumSockets(), std::vector<LogHistogram>(max_imc_channels + 1)),
+        activeChannel(m->getNumSockets(), std::vector<bool>(max_imc_channels, false))
+    {
+        assert(pcm);
+        readState(prevState, PCM::MC_UNITS);
+        prevTime = std::chrono::steady_clock::now();
     }
 
-    uint64 getTotalCount(const std::vector<ServerUncoreCounterState>& AfterState)
+    //! samples the memory controller counters every samplePeriod until delay seconds have passed
+    void collect(const double delay)
     {
-        return eventGroups.size() * (totalCount + extractCHATotalCount(MidStates.back(), AfterState));
+        const auto start = std::chrono::steady_clock::now();
+        const auto end = start + std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(delay));
+        auto deadline = start;
+        do
+        {
+            deadline += samplePeriod;
+            sleepUntil((std::min)(deadline, end), getSleepSpin());
+            sample();
+        } while (std::chrono::steady_clock::now() < end);
     }
 
-    void reset()
+    void print(const bool csv, bool & csvheader, const bool show_channel_output)
     {
-        totalCount = 0;
+        if (csv)
+        {
+            if (csvheader)
+            {
+                printCSV(Header1, show_channel_output);
+                printCSV(Header2, show_channel_output);
+                csvheader = false;
+            }
+            printCSV(Data, show_channel_output);
+        }
+        else
+        {
+            printTable(show_channel_output);
+        }
+        for (auto & s : readHist)
+            for (auto & h : s)
+                h.reset();
+        for (auto & s : writeHist)
+            for (auto & h : s)
+                h.reset();
+        numSamples = 0;
     }
 };
 
@@ -1359,6 +1546,7 @@ int mainThrows(int argc, char * argv[])
     char * sysCmd = NULL;
     char ** sysArgv = NULL;
     int rankA = -1, rankB = -1;
+    uint32 histogramSampleMs = 0; // 0: histogram mode is disabled
     MainLoop mainLoop;
 
     string program = string(argv[0]);
@@ -1475,6 +1663,21 @@ int mainThrows(int argc, char * argv[])
             print_update = true;
             continue;
         }
+        else if (check_argument_equals(*argv, {"-histogram", "/histogram"}))
+        {
+            histogramSampleMs = PCM_HISTOGRAM_SAMPLE_MS_DEFAULT;
+            continue;
+        }
+        else if (extract_argument_value(*argv, {"-histogram", "/histogram"}, arg_value))
+        {
+            histogramSampleMs = arg_value.empty() ? PCM_HISTOGRAM_SAMPLE_MS_DEFAULT : (uint32)stoi(arg_value);
+            if (histogramSampleMs == 0)
+            {
+                cerr << "Histogram sampling period must be at least 1 ms\n";
+                exit(EXIT_FAILURE);
+            }
+            continue;
+        }
         PCM_ENFORCE_FLUSH_OPTION
 #ifdef _MSC_VER
         else if (check_argument_equals(*argv, {"--uninstallDriver"}))
@@ -1545,6 +1748,16 @@ int mainThrows(int argc, char * argv[])
         cerr << "Rank level output requires channel output\n";
         exit(EXIT_FAILURE);
     }
+    if (histogramSampleMs && (rankA >= 0 || rankB >= 0 || metrics == PmemMemoryMode))
+    {
+        cerr << "Histogram mode supports only DRAM channel bandwidth (no -rank or -mm)\n";
+        exit(EXIT_FAILURE);
+    }
+    if (histogramSampleMs && (sysCmd != NULL) && (delay <= 0.0))
+    {
+        cerr << "Histogram mode requires a delay\n";
+        exit(EXIT_FAILURE);
+    }
     PCM::ErrorCode status = m->programServerUncoreMemoryMetrics(metrics, rankA, rankB);
     m->checkError(status);
 
@@ -1576,9 +1789,9 @@ int mainThrows(int argc, char * argv[])
     SPR_CXL = (PCM::SPR == cpu_model || PCM::EMR == cpu_model) && (getNumCXLPorts(m) > 0);
     if (SPR_CXL)
     {
-         chaEventCollector = std::make_shared<CHAEventCollector>(delay, sysCmd, mainLoop, m);
+         chaEventCollector = std::make_shared<CHAEventCollector>(sysCmd, mainLoop, m);
          assert(chaEventCollector.get());
-         chaEventCollector->programFirstGroup();
+         chaEventCollector->start();
     }
 
     cerr << "Update every " << delay << " seconds\n";
@@ -1592,6 +1805,25 @@ int mainThrows(int argc, char * argv[])
 
     BeforeTime = m->getTickCount();
 
+    if (histogramSampleMs)
+    {
+        cerr << "Sampling memory channel bandwidth every " << histogramSampleMs << " ms\n";
+        BandwidthHistogramCollector histogramCollector(m, histogramSampleMs);
+        if (sysCmd != NULL) {
+            MySystem(sysCmd, sysArgv);
+        }
+        mainLoop([&]()
+        {
+            if (enforceFlush || !csv) cout << flush;
+
+            histogramCollector.collect(delay);
+            histogramCollector.print(csv, csvheader, show_channel_output);
+
+            return m->isBlocked() == false;
+        });
+        exit(EXIT_SUCCESS);
+    }
+
     if( sysCmd != NULL ) {
         MySystem(sysCmd, sysArgv);
     }
@@ -1602,7 +1834,8 @@ int mainThrows(int argc, char * argv[])
 
         if (chaEventCollector.get())
         {
-            chaEventCollector->multiplexEvents(BeforeState);
+            chaEventCollector->multiplexEvents(delay);
+            SPR_CHA_CXL_Event_Count = chaEventCollector->getTotalCount();
         }
         else
         {
@@ -1611,13 +1844,6 @@ int mainThrows(int argc, char * argv[])
 
         AfterTime = m->getTickCount();
         readState(AfterState);
-        if (chaEventCollector.get())
-        {
-            SPR_CHA_CXL_Event_Count = chaEventCollector->getTotalCount(AfterState);
-            chaEventCollector->reset();
-            chaEventCollector->programFirstGroup();
-            readState(AfterState); // TODO: re-read only CHA counters (performance optmization)
-        }
 
         if (!csv) {
           //cout << "Time elapsed: " << dec << fixed << AfterTime-BeforeTime << " ms\n";
@@ -1640,6 +1866,7 @@ int mainThrows(int argc, char * argv[])
         return true;
     });
 
+    getSamplingScheduler().printStatistics(cerr);
     exit(EXIT_SUCCESS);
 }
 
@@ -21,10 +21,16 @@
 #include <string.h>
 #include <string>
 #include <assert.h>
+#include <thread>
+#include <atomic>
+#include <chrono>
 #include "pcm-pcie.h"
+#include "spsc_queue.h"
 
 #define PCM_DELAY_DEFAULT 1.0 // in seconds
 #define PCM_DELAY_MIN 0.015 // 15 milliseconds is practical on most modern CPUs
+#define PCM_STREAM_SAMPLE_MS_DEFAULT 10
+#define PCM_STREAM_QUEUE_SIZE 1024
 
 using namespace std;
 
@@ -82,6 +88,11 @@ void print_usage(const string & progname)
     cout << "                                        the number of transfers by the cache line size (=64 bytes).\n";
     cout << "  -e                                 => print additional PCIe LLC miss/hit statistics.\n";
     cout << "  -i[=number] | /i[=number]          => allow to determine number of iterations\n";
+    cout << "  -stream[=ms]                       => streaming mode: keep the PCIe events programmed, sample them every ms\n";
+    cout << "                                        milliseconds (default " << PCM_STREAM_SAMPLE_MS_DEFAULT << ") and print the per-socket read/write\n";
+    cout << "                                        bandwidth (Bytes/sec) of each interval as one CSV line per socket\n";
+    cout << "                                        (Icelake server and later)\n";
+    cout << "  -json[=file.json] | /json[=file.json] => in streaming mode print JSON lines instead of CSV\n";
     cout << " It overestimates the bandwidth under traffic with many partial cache line transfers.\n";
     cout << "\n";
     print_events();
@@ -90,6 +101,7 @@ void print_usage(const string & progname)
     cout << "  " << progname << " 1                  => print counters every second without core and socket output\n";
     cout << "  " << progname << " 0.5 -csv=test.log  => twice a second save counter values to test.log in CSV format\n";
     cout << "  " << progname << " /csv 5 2>/dev/null => one sample every 5 seconds, and discard all diagnostic output\n";
+    cout << "  " << progname << " 0.1 -stream=5      => sample every 5 ms and print the bandwidth every 100 ms\n";
     cout << "\n";
 }
 
@@ -119,6 +131,193 @@ IPlatform *IPlatform::getPlatform(PCM *m, bool csv, bool print_bandwidth, bool p
     }
 }
 
+//! one sample of the streaming mode, produced by the sampling thread
+struct PCIeStreamSample
+{
+    double end = 0.;      // seconds since the start of the stream
+    double duration = 0.; // seconds
+    vector<uint64> readBytes, writeBytes; // per socket
+};
+
+/*! \brief Streaming mode of pcm-pcie
+
+    The PCIe bandwidth events are programmed once. The sampling thread reads their deltas on
+    absolute deadlines (SamplingScheduler) into a lock-free ring. The output thread (the caller of printInterval) drains the ring, aggregates the
+    samples of one interval and prints them, so slow output does not disturb the sampling cadence.
+    If the output thread falls behind and the ring fills up, samples are dropped and reported.
+*/
+class PCIeStreamer
+{
+    IPlatform * platform;
+    const double sampleTime;
+    const double interval;
+    const bool json;
+    const uint sockets;
+    SPSCQueue<PCIeStreamSample> queue;
+    std::atomic<bool> stopSampling{false};
+    std::atomic<uint64> dropped{0};
+    std::thread sampler;
+    SamplingScheduler scheduler; // of the sampling thread
+    PCIeStreamSample sample;
+    // aggregate of the current output interval
+    vector<uint64> readBytes, writeBytes;
+    double duration = 0.;
+    uint64 samples = 0, droppedReported = 0;
+    uint64 currentInterval = 0;
+    bool headerPrinted = false;
+    bool pendingSample = false;
+
+    PCIeStreamSample makePrototype() const
+    {
+        PCIeStreamSample s;
+        s.readBytes.resize(sockets, 0);
+        s.writeBytes.resize(sockets, 0);
+        return s;
+    }
+
+    void sample_loop()
+    {
+        PCIeStreamSample s = makePrototype();
+        // cumulative byte counts of the previous and the current read
+        vector<uint64> lastRead(sockets, 0), lastWrite(sockets, 0), read(sockets, 0), write(sockets, 0);
+        platform->readStream(lastRead, lastWrite);
+        const auto start = std::chrono::steady_clock::now();
+        auto last = start;
+        while (stopSampling.load() == false)
+        {
+            scheduler.sleepUntilNext(sampleTime);
+            platform->readStream(read, write);
+            const auto now = std::chrono::steady_clock::now();
+            for (uint skt = 0; skt < sockets; ++skt)
+            {
+                s.readBytes[skt] = read[skt] - lastRead[skt];
+                s.writeBytes[skt] = write[skt] - lastWrite[skt];
+            }
+            lastRead.swap(read);
+            lastWrite.swap(write);
+            s.end = std::chrono::duration<double>(now - start).count();
+            s.duration = std::chrono::duration<double>(now - last).count();
+            last = now;
+            if (queue.tryPush(s) == false)
+            {
+                ++dropped;
+            }
+        }
+    }
+
+    void print()
+    {
+        const std::string separator = json ? ",\"" : ",";
+        const std::string jsonSeparator = "\":";
+        const uint64 droppedNow = dropped.load();
+        if (!json && !headerPrinted)
+        {
+            printDateForCSV(Header2);
+            cout << "Skt,Interval (s),Samples,Dropped,PCIe Rd (B/s),PCIe Wr (B/s)\n";
+            headerPrinted = true;
+        }
+        for (uint skt = 0; skt < sockets; ++skt)
+        {
+            const double rd = (duration > 0.) ? double(readBytes[skt]) / duration : 0.;
+            const double wr = (duration > 0.) ? double(writeBytes[skt]) / duration : 0.;
+            if (json)
+            {
+                cout << "{\"";
+                printDateForJson(separator, jsonSeparator);
+                cout << "Skt" << jsonSeparator << skt << separator
+                     << "Interval (s)" << jsonSeparator << duration << separator
+                     << "Samples" << jsonSeparator << samples << separator
+                     << "Dropped" << jsonSeparator << (droppedNow - droppedReported) << separator
+                     << "PCIe Rd (B/s)" << jsonSeparator << uint64(rd) << separator
+                     << "PCIe Wr (B/s)" << jsonSeparator << uint64(wr) << "}\n";
+            }
+            else
+            {
+                printDateForCSV(Data);
+                cout << skt << ',' << duration << ',' << samples << ',' << (droppedNow - droppedReported)
+                     << ',' << uint64(rd) << ',' << uint64(wr) << "\n";
+            }
+        }
+        cout << flush;
+        droppedReported = droppedNow;
+        fill(readBytes.begin(), readBytes.end(), 0);
+        fill(writeBytes.begin(), writeBytes.end(), 0);
+        duration = 0.;
+        samples = 0;
+    }
+
+    void add(const PCIeStreamSample & s)
+    {
+        for (uint skt = 0; skt < sockets; ++skt)
+        {
+            readBytes[skt] += s.readBytes[skt];
+            writeBytes[skt] += s.writeBytes[skt];
+        }
+        duration += s.duration;
+        ++samples;
+    }
+
+    PCIeStreamer() = delete;
+    PCIeStreamer(const PCIeStreamer &) = delete;
+    PCIeStreamer & operator = (const PCIeStreamer &) = delete;
+public:
+    PCIeStreamer(IPlatform * platform_, const double sampleTime_, const double interval_, const bool json_) :
+        platform(platform_),
+        sampleTime(sampleTime_),
+        interval(interval_),
+        json(json_),
+        sockets(platform_->getSocketCount()),
+        queue(PCM_STREAM_QUEUE_SIZE, makePrototype()),
+        sample(makePrototype()),
+        readBytes(sockets, 0),
+        writeBytes(sockets, 0)
+    {
+        sampler = std::thread(&PCIeStreamer::sample_loop, this);
+    }
+
+    //! waits until all samples of the next interval have arrived and prints them
+    void printInterval()
+    {
+        ++currentInterval;
+        const double intervalEnd = double(currentInterval) * interval;
+        for (;;)
+        {
+            if (pendingSample == false)
+            {
+                if (queue.tryPop(sample) == false)
+                {
+                    MySleepMs(1);
+                    continue;
+                }
+                pendingSample = true;
+            }
+            // a sample belongs to the interval its end falls into
+            if (sample.end > intervalEnd)
+            {
+                break;
+            }
+            add(sample);
+            pendingSample = false;
+        }
+        print();
+    }
+
+    void stop()
+    {
+        stopSampling.store(true);
+        if (sampler.joinable())
+        {
+            sampler.join();
+            scheduler.printStatistics(cerr);
+        }
+    }
+
+    ~PCIeStreamer()
+    {
+        stop();
+    }
+};
+
 PCM_MAIN_NOTHROW;
 
 int mainThrows(int argc, char * argv[])
@@ -147,6 +346,9 @@ int mainThrows(int argc, char * argv[])
     bool csv = false;
     bool print_bandwidth = false;
 	bool print_additional_info = false;
+    bool stream = false;
+    bool json = false;
+    double stream_sample_ms = PCM_STREAM_SAMPLE_MS_DEFAULT;
     char * sysCmd = NULL;
     char ** sysArgv = NULL;
     MainLoop mainLoop;
@@ -197,6 +399,39 @@ int mainThrows(int argc, char * argv[])
             print_additional_info = true;
             continue;
         }
+        else if (check_argument_equals(*argv, {"-stream", "/stream"}))
+        {
+            stream = true;
+            continue;
+        }
+        else if (extract_argument_value(*argv, {"-stream", "/stream"}, arg_value))
+        {
+            stream = true;
+            if (!arg_value.empty())
+            {
+                stream_sample_ms = atof(arg_value.c_str());
+                if (stream_sample_ms <= 0.)
+                {
+                    cerr << "Error: invalid stream sample time " << arg_value << "\n";
+                    print_usage(program);
+                    exit(EXIT_FAILURE);
+                }
+            }
+            continue;
+        }
+        else if (check_argument_equals(*argv, {"-json", "/json"}))
+        {
+            json = true;
+            continue;
+        }
+        else if (extract_argument_value(*argv, {"-json", "/json"}, arg_value))
+        {
+            json = true;
+            if (!arg_value.empty()) {
+                m->setOutput(arg_value);
+            }
+            continue;
+        }
         else if (check_argument_equals(*argv, {"--"}))
         {
             argv++;
@@ -211,6 +446,24 @@ int mainThrows(int argc, char * argv[])
         }
     } while(argc > 1); // end of command line partsing loop
 
+    if (json && !stream)
+    {
+        cerr << "Error: -json is only supported in the streaming mode (-stream)\n";
+        exit(EXIT_FAILURE);
+    }
+
+    if (stream)
+    {
+        // the streaming mode prints compact lines, any interval is fine
+        csv = true;
+        if (delay <= 0.0) delay = PCM_DELAY_DEFAULT;
+        if (stream_sample_ms > delay * 1000.)
+        {
+            cerr << "Stream sample time " << stream_sample_ms << " ms is longer than the interval. Using " << delay * 1000. << " ms\n";
+            stream_sample_ms = delay * 1000.;
+        }
+    }
+
     if ( (sysCmd != NULL) && (delay<=0.0) ) {
         // in case external command is provided in command line, and
         // delay either not provided (-1) or is zero
@@ -248,6 +501,24 @@ int mainThrows(int argc, char * argv[])
         MySystem(sysCmd, sysArgv);
     }
 
+    if (stream)
+    {
+        if (platform->startStream() == false)
+        {
+            cerr << "Error: the streaming mode needs a processor that counts all PCIe bandwidth events at once (Icelake server or later)\n";
+            exit(EXIT_FAILURE);
+        }
+        cerr << "Streaming: sampling every " << stream_sample_ms << " ms\n";
+        PCIeStreamer streamer(platform.get(), stream_sample_ms / 1000., delay, json);
+        mainLoop([&]()
+        {
+            streamer.printInterval();
+            return true;
+        });
+        streamer.stop();
+        exit(EXIT_SUCCESS);
+    }
+
     // ================================== Begin Printing Output ==================================
     mainLoop([&]()
     {
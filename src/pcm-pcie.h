@@ -6,6 +6,7 @@
 #include <iostream>
 #include "cpucounters.h"
 #include "utils.h"
+#include "uncore_multiplexer.h"
 #include <vector>
 #include <array>
 #include <string>
@@ -50,6 +51,16 @@ public:
     virtual void printEvents() = 0;
     virtual void printAggregatedEvents() = 0;
     virtual void cleanup() = 0;
+    /*! \brief Programs the PCIe read and write bandwidth events once for the streaming mode
+        \return false if the platform can not count all of them at the same time
+    */
+    virtual bool startStream() = 0;
+    /*! \brief Reads the counters programmed by startStream (no reprogramming)
+        \param readBytes bytes read by PCIe devices from memory since startStream, one entry per socket
+        \param writeBytes bytes written by PCIe devices to memory since startStream, one entry per socket
+    */
+    virtual void readStream(vector<uint64> &readBytes, vector<uint64> &writeBytes) = 0;
+    uint getSocketCount() const { return m_socketCount; }
     static IPlatform *getPlatform(PCM* m, bool csv, bool bandwidth,
                                         bool verbose, uint32 delay);
     virtual ~IPlatform() { }
@@ -104,22 +115,25 @@ class LegacyPlatform: public IPlatform
     vector<string> eventNames;
     vector<eventGroup_t> eventGroups;
     uint32 m_delay;
+    // socket x counter values of the programmed group
     typedef vector <vector <uint64>> eventCount_t;
-    array<eventCount_t, total> eventCount;
+    shared_ptr<UncoreEventMultiplexer<eventCount_t> > multiplexer;
 
     virtual void getEvents() final;
     virtual void printHeader() final;
     virtual void printEvents() final;
     virtual void printAggregatedEvents() final;
     virtual void cleanup() final;
+    virtual bool startStream() final;
+    virtual void readStream(vector<uint64> &readBytes, vector<uint64> &writeBytes) final;
 
+    void collectEvents(const double seconds);
     void printBandwidth(uint socket, eventFilter filter);
     void printBandwidth();
     void printSocketScopeEvent(uint socket, eventFilter filter, uint idx);
     void printSocketScopeEvents(uint socket, eventFilter filter);
-    uint64 getEventCount (uint socket, uint idx);
     uint eventGroupOffset(eventGroup_t &eventGroup);
-    void getEventGroup(eventGroup_t &eventGroup);
+    void readEventGroup(const size_t group, eventCount_t &counts);
     void printAggregatedEvent(uint idx);
 
 public:
@@ -129,24 +143,40 @@ public:
             eventNames(events), eventGroups(eventCodes)
     {
         int eventsCount = 0;
-        for (auto &group : eventGroups) eventsCount += (int)group.size();
+        size_t maxGroupSize = 0;
+        for (auto &group : eventGroups) {
+            eventsCount += (int)group.size();
+            maxGroupSize = (std::max)(maxGroupSize, group.size());
+        }
 
-        // Delay for each multiplexing group. Counters will be scaled.
-        m_delay = uint32(delay / eventGroups.size() / NUM_SAMPLES);
+        // Delay for each sample. Event groups are multiplexed within the sample and counters are scaled.
+        m_delay = uint32(delay / NUM_SAMPLES);
 
         eventSample.resize(m_socketCount);
         for (auto &e: eventSample)
             e.resize(eventsCount);
 
-        for (auto &run : eventCount) {
-            run.resize(m_socketCount);
-            for (auto &events_ : run)
-                events_.resize(eventsCount);
-        }
+        vector<size_t> eventsPerGroup;
+        for (auto &group : eventGroups) eventsPerGroup.push_back(m_socketCount * group.size());
+
+        multiplexer = make_shared<UncoreEventMultiplexer<eventCount_t> >(eventsPerGroup,
+            [this](const size_t group) { m_pcm->programPCIeEventGroup(eventGroups[group]); },
+            [this](const size_t group, eventCount_t &counts) { readEventGroup(group, counts); },
+            [this](const size_t group, const eventCount_t &before, const eventCount_t &after, vector<uint64> &counts) {
+                const size_t groupSize = eventGroups[group].size();
+                for (uint skt = 0; skt < m_socketCount; ++skt)
+                    for (size_t ctr = 0; ctr < groupSize; ++ctr)
+                        counts[skt * groupSize + ctr] += after[skt][ctr] - before[skt][ctr];
+            },
+            eventCount_t(m_socketCount, vector<uint64>(maxGroupSize, 0)));
     };
 
 protected:
     vector<vector<uint64>> eventSample;
+    // events of the streaming mode that count all PCIe reads (the first streamReadEvents) and
+    // writes in one group; empty if the platform needs the opcode filter for them
+    eventGroup_t streamEvents;
+    size_t streamReadEvents = 0;
     virtual uint64 getReadBw(uint socket, eventFilter filter) = 0;
     virtual uint64 getWriteBw(uint socket, eventFilter filter) = 0;
     virtual uint64 getReadBw() = 0;
@@ -160,12 +190,6 @@ void LegacyPlatform::cleanup()
         fill(socket.begin(), socket.end(), 0);
 }
 
-inline uint64 LegacyPlatform::getEventCount (uint skt, uint idx)
-{
-    return eventGroups.size() * (eventCount[after][skt][idx] -
-                                        eventCount[before][skt][idx]);
-}
-
 uint LegacyPlatform::eventGroupOffset(eventGroup_t &eventGroup)
 {
     uint offset = 0;
@@ -177,28 +201,48 @@ uint LegacyPlatform::eventGroupOffset(eventGroup_t &eventGroup)
     return offset;
 }
 
-void LegacyPlatform::getEventGroup(eventGroup_t &eventGroup)
+void LegacyPlatform::readEventGroup(const size_t group, eventCount_t &counts)
 {
-    m_pcm->programPCIeEventGroup(eventGroup);
-    uint offset = eventGroupOffset(eventGroup);
+    for (uint skt = 0; skt < m_socketCount; ++skt)
+        for (uint ctr = 0; ctr < eventGroups[group].size(); ++ctr)
+            counts[skt][ctr] = m_pcm->getPCIeCounterData(skt, ctr);
+}
 
-    for (int run = before; run < total; run++) {
-        for (uint skt = 0; skt < m_socketCount; ++skt)
-            for (uint ctr = 0; ctr < eventGroup.size(); ++ctr)
-                eventCount[run][skt][ctr + offset] = m_pcm->getPCIeCounterData(skt, ctr);
-        if (run == before)
-            MySleepMs(m_delay);
-    }
+void LegacyPlatform::getEvents()
+{
+    collectEvents(m_delay / 1000.);
+}
 
-    for(uint skt = 0; skt < m_socketCount; ++skt)
-        for (uint idx = offset; idx < offset + eventGroup.size(); ++idx)
-            eventSample[skt][idx] += getEventCount(skt, idx);
+bool LegacyPlatform::startStream()
+{
+    if (streamEvents.empty())
+        return false;
+    m_pcm->programPCIeEventGroup(streamEvents);
+    return true;
 }
 
-void LegacyPlatform::getEvents()
+void LegacyPlatform::readStream(vector<uint64> &readBytes, vector<uint64> &writeBytes)
 {
+    for (uint skt = 0; skt < m_socketCount; ++skt)
+    {
+        readBytes[skt] = writeBytes[skt] = 0;
+        for (uint ctr = 0; ctr < streamEvents.size(); ++ctr)
+            (ctr < streamReadEvents ? readBytes[skt] : writeBytes[skt]) += m_pcm->getPCIeCounterData(skt, ctr) * 64ULL;
+    }
+}
+
+void LegacyPlatform::collectEvents(const double seconds)
+{
+    const auto & result = multiplexer->collect(seconds);
+
     for (auto& evGroup : eventGroups)
-        getEventGroup(evGroup);
+    {
+        const size_t group = &evGroup - eventGroups.data();
+        const uint offset = eventGroupOffset(evGroup);
+        for (uint skt = 0; skt < m_socketCount; ++skt)
+            for (uint ctr = 0; ctr < evGroup.size(); ++ctr)
+                eventSample[skt][offset + ctr] += result.getScaledCount(group, skt * evGroup.size() + ctr);
+    }
 }
 
 void LegacyPlatform::printHeader()
@@ -357,6 +401,9 @@ public:
                         },
                         m, csv, bandwidth, verbose, delay)
     {
+        // PCIRdCur, ItoM and ItoMCacheNear, hits and misses
+        streamEvents = {0xC8F3FF00000435, 0xCC43FF00000435, 0xCD43FF00000435};
+        streamReadEvents = 1;
     };
 
 private:
@@ -488,6 +535,9 @@ public:
                         },
                         m, csv, bandwidth, verbose, delay)
     {
+        // PCIRdCur, ItoM and ItoMCacheNear, hits and misses
+        streamEvents = {0xC8F3FF00000435, 0xCC43FF00000435, 0xCD43FF00000435};
+        streamReadEvents = 1;
     };
 
 private:
@@ -617,6 +667,9 @@ public:
                         },
                         m, csv, bandwidth, verbose, delay)
     {
+        // PCIRdCur, ItoM and ItoMCacheNear, hits and misses
+        streamEvents = {0xC8F3FF00000435, 0xCC43FF00000435, 0xCD43FF00000435};
+        streamReadEvents = 1;
     };
 
 private:
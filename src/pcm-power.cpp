@@ -20,6 +20,13 @@
 #include "freegetopt/getopt.h"
 #endif
 #include "utils.h"
+#include "spsc_queue.h"
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <algorithm>
+#include <memory>
 
 #define PCM_DELAY_DEFAULT 1.0       // in seconds
 #define PCM_DELAY_MIN 0.015         // 15 milliseconds is practical on most modern CPUs
@@ -91,6 +98,205 @@ double getNormalizedPCUCounter(uint32 unit, uint32 counter, const ServerUncoreCo
     return double(getUncoreCounter(PCM::PCU_PMU_ID, unit, counter, before, after)) / double(PCUClocks);
 }
 
+// one sample of the RAPL energy counters of a socket
+struct RAPLSample
+{
+    uint64 tsc = 0;
+    uint64 packageEnergy = 0;
+    uint64 dramEnergy = 0;
+};
+
+/*
+    Samples the package and DRAM energy counters of every socket at a high rate (down to 1 ms).
+    There is one sampler thread per socket pinned to the reference core of the socket, so that
+    the MSR reads are local and no other core is disturbed. Each sample is timestamped with the
+    invariant TSC and passed to the main thread through a lock-free queue. The main thread
+    drains the queues once per output interval, writes the optional timeline and prints the
+    distribution of the power over the interval.
+*/
+class RAPLTimeline
+{
+    PCM * m;
+    const uint32 numSockets;
+    const std::chrono::microseconds period;
+    std::vector<std::shared_ptr<SPSCQueue<RAPLSample> > > queues;
+    std::vector<std::shared_ptr<std::atomic<uint64> > > dropped;
+    std::vector<uint64> droppedReported;
+    std::vector<RAPLSample> lastSample;
+    std::vector<bool> hasLastSample;
+    std::vector<std::thread> samplers;
+    std::atomic<bool> stopSampling{false};
+    std::ofstream timeline;
+    bool binaryTimeline = false;
+    uint64 firstTSC = 0;
+    std::vector<double> packageWatts, dramWatts;
+
+    void sample_loop(const uint32 socket)
+    {
+        const int32 refCore = m->getSocketRefCore(socket);
+        std::unique_ptr<TemporalThreadAffinity> affinity;
+        try
+        {
+            affinity.reset(new TemporalThreadAffinity(refCore, true, false));
+        }
+        catch (...)
+        {
+            cerr << "WARNING: can not pin RAPL sampler thread to core " << refCore << "\n";
+        }
+        const bool useRDTSCP = affinity.get() && m->supportsRDTSCP();
+        RAPLSample sample;
+        auto next = std::chrono::steady_clock::now();
+        while (stopSampling.load() == false)
+        {
+            sample.tsc = useRDTSCP ? RDTSCP() : m->getInvariantTSC_Fast(refCore);
+            m->getEnergyStatus(socket, sample.packageEnergy, sample.dramEnergy);
+            if (queues[socket]->tryPush(sample) == false)
+            {
+                ++(*dropped[socket]);
+            }
+            next += period;
+            const auto now = std::chrono::steady_clock::now();
+            if (next + period < now)
+            {
+                next = now; // do not try to catch up after a long preemption
+            }
+            sleepUntil(next, getSleepSpin());
+        }
+    }
+
+    static double percentile(std::vector<double> & values, const double p)
+    {
+        if (values.empty())
+        {
+            return -1.;
+        }
+        const size_t index = (std::min)(size_t(p * double(values.size() - 1) + 0.5), values.size() - 1);
+        std::nth_element(values.begin(), values.begin() + index, values.end());
+        return values[index];
+    }
+
+    static void printDistribution(const char * name, std::vector<double> & values)
+    {
+        cout << "; " << name << " Watts min/p50/p95/p99/max: "
+             << percentile(values, 0.) << "/" << percentile(values, 0.5) << "/" << percentile(values, 0.95) << "/"
+             << percentile(values, 0.99) << "/" << percentile(values, 1.);
+    }
+
+    void writeTimeline(const uint32 socket, const RAPLSample & sample, const double packageW, const double dramW)
+    {
+        if (!timeline.is_open())
+        {
+            return;
+        }
+        if (binaryTimeline)
+        {
+            const uint64 record[4] = { uint64(socket), sample.tsc, sample.packageEnergy, sample.dramEnergy };
+            timeline.write((const char *)record, sizeof(record));
+        }
+        else
+        {
+            timeline << socket << ',' << sample.tsc << ',' << double(sample.tsc - firstTSC) / double(m->getNominalFrequency()) << ','
+                     << sample.packageEnergy << ',' << sample.dramEnergy << ',' << packageW << ',' << dramW << '\n';
+        }
+    }
+
+public:
+    RAPLTimeline(PCM * m_, const uint32 period_ms, const double delay, const std::string & timelineFile) :
+        m(m_),
+        numSockets(m_->getNumSockets()),
+        period(std::chrono::milliseconds(period_ms)),
+        droppedReported(numSockets, 0),
+        lastSample(numSockets),
+        hasLastSample(numSockets, false)
+    {
+        // enough room for several output intervals in case the main thread is delayed
+        const size_t capacity = (std::max)(size_t(1024), size_t(4. * delay * 1000. / double(period_ms)));
+        for (uint32 s = 0; s < numSockets; ++s)
+        {
+            queues.push_back(std::make_shared<SPSCQueue<RAPLSample> >(capacity));
+            dropped.push_back(std::make_shared<std::atomic<uint64> >(0));
+        }
+        if (!timelineFile.empty())
+        {
+            binaryTimeline = timelineFile.size() > 4 && timelineFile.substr(timelineFile.size() - 4) == ".bin";
+            timeline.open(timelineFile, binaryTimeline ? (std::ios::out | std::ios::binary) : std::ios::out);
+            if (!timeline.is_open())
+            {
+                cerr << "ERROR: can not open " << timelineFile << " for writing\n";
+                exit(EXIT_FAILURE);
+            }
+            if (binaryTimeline)
+            {
+                // header: magic, TSC frequency (Hz), joules per package and DRAM energy unit
+                const char magic[8] = { 'P', 'C', 'M', 'R', 'A', 'P', 'L', '1' };
+                const uint64 tscFrequency = m->getNominalFrequency();
+                const double units[2] = { m->getJoulesPerEnergyUnit(), m->getDRAMJoulesPerEnergyUnit() };
+                timeline.write(magic, sizeof(magic));
+                timeline.write((const char *)&tscFrequency, sizeof(tscFrequency));
+                timeline.write((const char *)units, sizeof(units));
+            }
+            else
+            {
+                timeline << "Socket,TSC,Time (s),Package Energy Units,DRAM Energy Units,Package Watts,DRAM Watts\n";
+            }
+        }
+        firstTSC = m->getInvariantTSC_Fast();
+        for (uint32 s = 0; s < numSockets; ++s)
+        {
+            samplers.emplace_back(&RAPLTimeline::sample_loop, this, s);
+        }
+    }
+
+    ~RAPLTimeline()
+    {
+        stopSampling = true;
+        for (auto & t : samplers)
+        {
+            t.join();
+        }
+    }
+
+    //! drains the samples taken since the previous call, writes the timeline and prints the per-socket power distribution
+    void print()
+    {
+        const double tscFrequency = double(m->getNominalFrequency());
+        const double packageJoulesPerUnit = m->getJoulesPerEnergyUnit();
+        const double dramJoulesPerUnit = m->getDRAMJoulesPerEnergyUnit();
+        RAPLSample sample;
+        for (uint32 socket = 0; socket < numSockets; ++socket)
+        {
+            packageWatts.clear();
+            dramWatts.clear();
+            while (queues[socket]->tryPop(sample))
+            {
+                double packageW = 0., dramW = 0.;
+                if (hasLastSample[socket] && sample.tsc > lastSample[socket].tsc)
+                {
+                    const double seconds = double(sample.tsc - lastSample[socket].tsc) / tscFrequency;
+                    packageW = double(sample.packageEnergy - lastSample[socket].packageEnergy) * packageJoulesPerUnit / seconds;
+                    dramW = double(sample.dramEnergy - lastSample[socket].dramEnergy) * dramJoulesPerUnit / seconds;
+                    packageWatts.push_back(packageW);
+                    dramWatts.push_back(dramW);
+                }
+                writeTimeline(socket, sample, packageW, dramW);
+                lastSample[socket] = sample;
+                hasLastSample[socket] = true;
+            }
+            const uint64 droppedNow = dropped[socket]->load();
+            cout << "S" << socket << "; RAPL samples: " << packageWatts.size()
+                 << "; Dropped: " << (droppedNow - droppedReported[socket]);
+            droppedReported[socket] = droppedNow;
+            printDistribution("Package", packageWatts);
+            if (m->dramEnergyMetricsAvailable())
+            {
+                printDistribution("DRAM", dramWatts);
+            }
+            cout << "\n";
+        }
+        timeline.flush();
+    }
+};
+
 int default_freq_band[3] = { 12, 20, 40 };
 int freq_band[3];
 
@@ -108,6 +314,14 @@ void print_usage(const string & progname)
     cout << "  -i[=number] | /i[=number]          => allow to determine number of iterations\n";
 //    cout << "  -csv[=file.csv] | /csv[=file.csv]  => output compact CSV format to screen or\n"
 //         << "                                        to a file, in case filename is provided\n";
+    cout << "  -rapl[=ms]                         => additionally sample the package and DRAM energy counters every ms milliseconds\n"
+         << "                                        (default and minimum: 1) on the reference core of each socket and print\n"
+         << "                                        min/p50/p95/p99/max power per interval. Note that the energy counters\n"
+         << "                                        are updated about every millisecond by the hardware\n";
+    cout << "  -timeline=file                     => with -rapl: write the timeline of all RAPL samples to file as CSV\n"
+         << "                                        or, if the file name ends with .bin, as binary: a 32-byte header\n"
+         << "                                        (\"PCMRAPL1\", uint64 TSC Hz, double package and DRAM joules per unit)\n"
+         << "                                        followed by uint64 {socket, TSC, package energy, DRAM energy} records\n";
     cout << "  [-m imc_profile] [-p pcu_profile] [-a freq_band0] [-b freq_band1] [-c freq_band2]\n\n";
     cout << " Where: imc_profile, pcu_profile, freq_band0, freq_band1 and freq_band2 are the following:\n";
     cout << "  <imc_profile>      - profile (counter group) for IMC PMU. Possible values are: 0,1,2,3,4,-1 \n";
@@ -163,6 +377,8 @@ int mainThrows(int argc, char * argv[])
     freq_band[2] = default_freq_band[2];
 
     bool csv = false;
+    uint32 rapl_period_ms = 0;
+    std::string timeline_file;
     MainLoop mainLoop;
     string program = string(argv[0]);
 
@@ -196,6 +412,21 @@ int mainThrows(int argc, char * argv[])
                 }
                 continue;
             }
+            else if (check_argument_equals(*argv, {"-rapl", "/rapl"}))
+            {
+                rapl_period_ms = 1;
+                continue;
+            }
+            else if (extract_argument_value(*argv, {"-rapl", "/rapl"}, arg_value))
+            {
+                rapl_period_ms = (std::max)(1, atoi(arg_value.c_str()));
+                continue;
+            }
+            else if (extract_argument_value(*argv, {"-timeline", "/timeline"}, arg_value))
+            {
+                timeline_file = arg_value;
+                continue;
+            }
             else if (mainLoop.parseArg(*argv))
             {
                 continue;
@@ -331,6 +562,22 @@ int mainThrows(int argc, char * argv[])
 
     if (delay <= 0.0) delay = PCM_DELAY_DEFAULT;
 
+    std::unique_ptr<RAPLTimeline> raplTimeline;
+    if (rapl_period_ms)
+    {
+        if (!m->packageEnergyMetricsAvailable())
+        {
+            cerr << "Package energy metrics are not available on your processor\n";
+            exit(EXIT_FAILURE);
+        }
+        cerr << "Sampling RAPL energy counters every " << rapl_period_ms << " ms\n";
+        raplTimeline.reset(new RAPLTimeline(m, rapl_period_ms, delay, timeline_file));
+    }
+    else if (!timeline_file.empty())
+    {
+        cerr << "WARNING: -timeline requires -rapl, ignoring it\n";
+    }
+
     uint32 i = 0;
 
     for (i = 0; i < numSockets; ++i)
@@ -559,6 +806,10 @@ int mainThrows(int argc, char * argv[])
                       << "; DRAM Watts: " << 1000. * getDRAMConsumedJoules(BeforeState[socket], AfterState[socket]) / double(AfterTime - BeforeTime)
                       << "\n";
         }
+        if (raplTimeline.get())
+        {
+            raplTimeline->print();
+        }
         swap(BeforeState, AfterState);
         swap(BeforeTime, AfterTime);
         swap(beforeSocketState, afterSocketState);
@@ -571,5 +822,6 @@ int mainThrows(int argc, char * argv[])
         return true;
     });
 
+    raplTimeline.reset();
     exit(EXIT_SUCCESS);
 }
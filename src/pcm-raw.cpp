@@ -2690,5 +2690,6 @@ int mainThrows(int argc, char * argv[])
          }
          return true;
     });
+    getSamplingScheduler().printStatistics(cerr);
     exit(EXIT_SUCCESS);
 }
@@ -21,7 +21,7 @@ using namespace pcm;
 
 void print_usage(const char * progname)
 {
-    std::cout << "Usage " << progname << " [-w value] [-d] [-b low:high] [-e entries] ID offset\n\n";
+    std::cout << "Usage " << progname << " [-w value] [-d] [-b low:high] [-e entries] [-l ms] ID offset\n\n";
     std::cout << "  Reads/writes TPMI (Topology Aware Register and PM Capsule Interface) register \n";
     std::cout << "   ID          : TPMI ID\n";
     std::cout << "   offset      : register offset\n";
@@ -30,6 +30,7 @@ void print_usage(const char * progname)
     std::cout << "   -e entries  : perform read/write on specified entries (default is all entries)\n";
     std::cout << "                 (examples: -e 10 -e 10-11 -e 4,6,12-20,6)\n";
     std::cout << "   -d          : output all numbers in dec (default is hex)\n";
+    std::cout << "   -l ms       : read the register(s) every ms milliseconds until interrupted\n";
     std::cout << "   -v          : verbose ouput\n";
     std::cout << "   --version   : print application version\n";
     std::cout << "\n";
@@ -52,9 +53,10 @@ int mainThrows(int argc, char * argv[])
     bool dec = false;
     std::pair<int64,int64> bits{-1, -1};
     std::list<int> entries;
+    int loop_ms = 0;
 
     int my_opt = -1;
-    while ((my_opt = getopt(argc, argv, "w:dvb:e:")) != -1)
+    while ((my_opt = getopt(argc, argv, "w:dvb:e:l:")) != -1)
     {
         switch (my_opt)
         {
@@ -74,6 +76,9 @@ int mainThrows(int argc, char * argv[])
         case 'e':
             entries = extract_integer_list(optarg);
             break;
+        case 'l':
+            loop_ms = atoi(optarg);
+            break;
         default:
             print_usage(argv[0]);
             return -1;
@@ -106,39 +111,56 @@ int mainThrows(int argc, char * argv[])
 
     try
     {
+        // the handles are created once, so repeated reads in the loop mode are cheap
+        std::vector<std::shared_ptr<TPMIHandle> > handles;
         for (size_t i = 0; i < TPMIHandle::getNumInstances(); ++i)
         {
-            TPMIHandle h(i, requestedID, requestedRelativeOffset, !write);
-            auto one = [&](const size_t p)
+            handles.push_back(std::make_shared<TPMIHandle>(i, requestedID, requestedRelativeOffset, !write));
+        }
+        do
+        {
+            for (size_t i = 0; i < handles.size(); ++i)
             {
-                if (!dec)
-                    std::cout << std::hex << std::showbase;
-                readOldValueHelper(bits, value, write, [&h, &p](uint64& old_value)
-                { old_value = h.read64(p); return true; });
-                if (write)
+                TPMIHandle & h = *handles[i];
+                std::list<int> instanceEntries = entries;
+                auto one = [&](const size_t p)
+                {
+                    if (!dec)
+                        std::cout << std::hex << std::showbase;
+                    readOldValueHelper(bits, value, write, [&h, &p](uint64& old_value)
+                    { old_value = h.read64(p); return true; });
+                    if (write)
+                    {
+                        std::cout << " Writing " << value << " to TPMI ID " << requestedID << "@" << requestedRelativeOffset << " for entry " << p << " in instance " << i << "\n";
+                        h.write64(p, value);
+                    }
+                    value = h.read64(p);
+                    extractBitsPrintHelper(bits, value, dec);
+                    std::cout << " from TPMI ID " << requestedID << "@" << requestedRelativeOffset << " for entry " << p << " in instance " << i << "\n\n";
+                };
+                if (instanceEntries.empty())
                 {
-                    std::cout << " Writing " << value << " to TPMI ID " << requestedID << "@" << requestedRelativeOffset << " for entry " << p << " in instance " << i << "\n";
-                    h.write64(p, value);
+                    for (size_t p = 0; p < h.getNumEntries(); ++p)
+                    {
+                        instanceEntries.push_back(p);
+                    }
                 }
-                value = h.read64(p);
-                extractBitsPrintHelper(bits, value, dec);
-                std::cout << " from TPMI ID " << requestedID << "@" << requestedRelativeOffset << " for entry " << p << " in instance " << i << "\n\n";
-            };
-            if (entries.empty())
-            {
-                for (size_t p = 0; p < h.getNumEntries(); ++p)
+                for (const size_t p : instanceEntries)
                 {
-                    entries.push_back(p);
+                    if (p < h.getNumEntries())
+                    {
+                        one(p);
+                    }
                 }
             }
-            for (const size_t p : entries)
+            // write only once
+            write = false;
+            std::cout << std::flush;
+            if (loop_ms > 0)
             {
-                if (p < h.getNumEntries())
-                {
-                    one(p);
-                }
+                MySleepMs(loop_ms);
             }
-        }
+        } while (loop_ms > 0);
     }
     catch (std::exception &e)
     {
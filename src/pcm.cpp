@@ -26,8 +26,13 @@
 #include <sstream>
 #include <assert.h>
 #include <bitset>
+#include <chrono>
+#include <thread>
+#include <atomic>
+#include <functional>
 #include "cpucounters.h"
 #include "utils.h"
+#include "spsc_queue.h"
 
 #define SIZE (10000000)
 #define PCM_DELAY_DEFAULT 1.0 // in seconds
@@ -90,6 +95,7 @@ void print_help(const string & prog_name)
     cout << "  -ns   | --nosockets | /ns          => hide socket related output\n";
     cout << "  -nsys | --nosystem  | /nsys        => hide system related output\n";
     cout << "  --color                            => use ASCII colors\n";
+    cout << "  -rb   | --read-barrier             => read the counters of all cores at a common TSC deadline to reduce the read skew\n";
     cout << "  -csv[=file.csv] | /csv[=file.csv]  => output compact CSV format to screen or\n"
         << "                                        to a file, in case filename is provided\n"
         << "                                        the format used is documented here: https://www.intel.com/content/www/us/en/developer/articles/technical/intel-pcm-column-names-decoder-ring.html\n";
@@ -1141,11 +1147,12 @@ void print_csv(PCM * m,
     const bool show_core_output,
     const bool show_partial_core_output,
     const bool show_socket_output,
-    const bool show_system_output
+    const bool show_system_output,
+    const std::chrono::system_clock::time_point & timestamp = std::chrono::system_clock::now()
     )
 {
     cout << "\n";
-    printDateForCSV(CsvOutputType::Data);
+    printDateForCSV(CsvOutputType::Data, ",", timestamp);
 
     if (show_system_output)
     {
@@ -1340,6 +1347,113 @@ void print_csv(PCM * m,
     }
 }
 
+//! Counter states of one sample
+struct Sample
+{
+    SystemCounterState sstate;
+    std::vector<SocketCounterState> sktstates;
+    std::vector<CoreCounterState> cstates;
+    std::chrono::system_clock::time_point timestamp; // when the counters were read
+};
+
+/*! \brief Formats and writes the output on a separate thread
+
+    The sampling thread pushes the samples into a bounded lock-free queue with preallocated
+    slots and the output thread prints the metrics of each pair of consecutive samples, so
+    formatting large (per-core) outputs does not delay the next counter read. If the output
+    falls behind by more than the queue capacity, the sampling thread waits for a free slot.
+*/
+class OutputPipeline
+{
+public:
+    typedef std::function<void(const Sample &, const Sample &)> PrintFunc;
+private:
+    SPSCQueue<Sample> queue;
+    const PrintFunc print;
+    const std::chrono::milliseconds pollPeriod;
+    Sample before, after;
+    uint64 stalls = 0;
+    std::atomic<bool> stopped{false};
+    std::thread worker; // the last member: starts after the others are initialized
+
+    OutputPipeline() = delete;
+    OutputPipeline(const OutputPipeline &) = delete;
+    OutputPipeline & operator = (const OutputPipeline &) = delete;
+
+    void run()
+    {
+#ifndef _MSC_VER
+        // SIGINT/SIGTERM are handled by the sampling thread, the output thread is stopped by finish()
+        sigset_t mask;
+        sigemptyset(&mask);
+        sigaddset(&mask, SIGINT);
+        sigaddset(&mask, SIGTERM);
+        pthread_sigmask(SIG_BLOCK, &mask, nullptr);
+#endif
+        bool first = true;
+        for (;;)
+        {
+            if (queue.tryPop(after))
+            {
+                if (!first)
+                {
+                    print(before, after);
+                }
+                first = false;
+                std::swap(before, after);
+            }
+            else if (stopped.load())
+            {
+                break; // stopped and drained
+            }
+            else
+            {
+                std::this_thread::sleep_for(pollPeriod);
+            }
+        }
+    }
+public:
+    //! \param prototype a sample used to preallocate the queue slots
+    //! \param delay sampling period in seconds
+    OutputPipeline(const size_t capacity, const Sample & prototype, const PrintFunc & print_, const double delay) :
+        queue(capacity, prototype),
+        print(print_),
+        pollPeriod((std::max)(1, (std::min)(50, int(delay * 1000. / 20.)))),
+        before(prototype),
+        after(prototype),
+        worker(&OutputPipeline::run, this)
+    {
+    }
+    ~OutputPipeline()
+    {
+        finish();
+    }
+    //! \brief Queues a sample (sampling thread), sample receives the buffers of an already printed sample
+    void push(Sample & sample)
+    {
+        if (queue.tryPushSwap(sample))
+        {
+            return;
+        }
+        ++stalls;
+        do
+        {
+            std::this_thread::sleep_for(pollPeriod);
+        } while (queue.tryPushSwap(sample) == false);
+    }
+    //! \brief Prints the queued samples and stops the output thread
+    void finish()
+    {
+        stopped.store(true);
+        if (worker.joinable())
+        {
+            worker.join();
+        }
+    }
+    //! \brief Returns how many push() calls had to wait for the output
+    uint64 getStalls() const { return stalls; }
+};
+
 #ifndef UNIT_TEST
 
 PCM_MAIN_NOTHROW;
@@ -1465,6 +1579,11 @@ int mainThrows(int argc, char * argv[])
             setColorEnabled();
             continue;
         }
+        else if (check_argument_equals(*argv, {"--read-barrier", "-rb"}))
+        {
+            m->setReadBarrier(true);
+            continue;
+        }
         else if (check_argument_equals(*argv, {"-csv", "/csv"}))
         {
             csv_output = true;
@@ -1576,9 +1695,7 @@ int mainThrows(int argc, char * argv[])
 
     print_cpu_details();
 
-    std::vector<CoreCounterState> cstates1, cstates2;
-    std::vector<SocketCounterState> sktstate1, sktstate2;
-    SystemCounterState sstate1, sstate2;
+    Sample sample;
     const auto cpu_model = m->getCPUModel();
 
     print_pid_collection_message(pid);
@@ -1599,31 +1716,40 @@ int mainThrows(int argc, char * argv[])
         print_csv_header(m, ycores, cpu_model, show_core_output, show_partial_core_output, show_socket_output, show_system_output);
     }
 
-    m->getAllCounterStates(sstate1, sktstate1, cstates1);
+    m->getAllCounterStates(sample.sstate, sample.sktstates, sample.cstates);
+    sample.timestamp = std::chrono::system_clock::now();
+
+    OutputPipeline output(16, sample, [&](const Sample & before, const Sample & after)
+    {
+        if (csv_output)
+            print_csv(m, before.cstates, after.cstates, before.sktstates, after.sktstates, ycores, before.sstate, after.sstate,
+            cpu_model, show_core_output, show_partial_core_output, show_socket_output, show_system_output, after.timestamp);
+        else
+            print_output(m, before.cstates, after.cstates, before.sktstates, after.sktstates, ycores, before.sstate, after.sstate,
+                cpu_model, show_core_output, show_partial_core_output, show_socket_output, show_system_output,
+                metricVersion);
+
+        if (enforceFlush || !csv_output) cout << std::flush;
+    }, delay);
+    output.push(sample);
 
     if (sysCmd != NULL) {
         MySystem(sysCmd, sysArgv);
     }
 
+    LogHistogram readSkewUs; // time between the first and the last counter read of a sample
     mainLoop([&]()
     {
-        if (enforceFlush || !csv_output) cout << std::flush;
-
         calibratedSleep(delay, sysCmd, mainLoop, m);
 
-        m->getAllCounterStates(sstate2, sktstate2, cstates2);
-
-        if (csv_output)
-            print_csv(m, cstates1, cstates2, sktstate1, sktstate2, ycores, sstate1, sstate2,
-            cpu_model, show_core_output, show_partial_core_output, show_socket_output, show_system_output);
-        else
-            print_output(m, cstates1, cstates2, sktstate1, sktstate2, ycores, sstate1, sstate2,
-                cpu_model, show_core_output, show_partial_core_output, show_socket_output, show_system_output,
-                metricVersion);
+        m->getAllCounterStates(sample.sstate, sample.sktstates, sample.cstates);
+        sample.timestamp = std::chrono::system_clock::now();
+        if (!m->isBlocked())
+        {
+            readSkewUs.add(getReadSkewUs(sample.sstate));
+        }
 
-        std::swap(sstate1, sstate2);
-        std::swap(sktstate1, sktstate2);
-        std::swap(cstates1, cstates2);
+        output.push(sample);
 
         if (m->isBlocked()) {
             // in case PCM was blocked after spawning child application: break monitoring loop here
@@ -1632,6 +1758,23 @@ int mainThrows(int argc, char * argv[])
         return true;
     });
 
+    output.finish();
+    // timing summary: wake up lateness of the sampling loop, read skew and waits for the output
+    cerr << "\n";
+    getSamplingScheduler().printStatistics(cerr);
+    if (readSkewUs.count())
+    {
+        cerr << "Read skew across cores and uncore units over " << readSkewUs.count() << " samples:"
+             << " p50 " << readSkewUs.percentile(50) << " us,"
+             << " p99 " << readSkewUs.percentile(99) << " us,"
+             << " max " << readSkewUs.max() << " us.";
+        if (m->getReadBarrier())
+        {
+            cerr << " Read barrier deadline missed " << m->getReadBarrierMisses() << " times.";
+        }
+        cerr << " Sampling waited for the output " << output.getStalls() << " times.\n";
+    }
+
     exit(EXIT_SUCCESS);
 }
 
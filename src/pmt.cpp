@@ -8,8 +8,13 @@
 #include <unordered_map>
 #include <iostream>
 
+#include <algorithm>
+
 #ifdef __linux__
 #include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
 #endif
 
 namespace pcm {
@@ -18,7 +23,14 @@ namespace pcm {
 class TelemetryArrayLinux : public TelemetryArrayInterface
 {
     TelemetryArrayLinux() = delete;
-    typedef std::vector<std::FILE *> FileVector;
+    struct TelemetryFile
+    {
+        int fd;
+        size_t size;
+        // position of the telemetry region within its first page, mmap starts at that page
+        size_t offset;
+    };
+    typedef std::vector<TelemetryFile> FileVector;
     typedef std::unordered_map<uint64, FileVector> FileMap;
     static std::shared_ptr<FileMap> TelemetryFiles;
     static FileMap & getTelemetryFiles()
@@ -34,28 +46,21 @@ class TelemetryArrayLinux : public TelemetryArrayInterface
                 auto size = read_number(readSysFS((path + "/size").c_str()).c_str());
                 std::cout << "path: " << path << " guid: 0x" << std::hex << guid << " size: "<< std::dec << size <<  std::endl;
                 #endif
-                auto file = std::fopen((path + "/telem").c_str(), "rb");
-                if (!file)
+                const int fd = ::open((path + "/telem").c_str(), O_RDONLY);
+                if (fd < 0)
                 {
                     std::cerr << "Error: failed to open " << path << "/telem" << std::endl;
                     continue;
                 }
-                TelemetryFilesTemp->operator[](guid).push_back(file);
-            }
-            
-            // print the telemetry files
-            for (auto & guid : *TelemetryFilesTemp)
-            {
-                auto & files = guid.second;
-                for (auto & file : files)
+                // the size of the binary sysfs attribute is also reported in st_size
+                size_t size = (size_t)read_number(readSysFS((path + "/size").c_str(), true).c_str());
+                struct stat st;
+                if (size == 0 && fstat(fd, &st) == 0)
                 {
-                    if (!file)
-                    {
-                        std::cerr << "Error: file is null" << std::endl;
-                        continue;
-                    }
-                    // std::cout << "guid: 0x" << std::hex << guid.first << " file: " << file << std::endl;
+                    size = (size_t)st.st_size;
                 }
+                const size_t offset = (size_t)read_number(readSysFS((path + "/offset").c_str(), true).c_str());
+                TelemetryFilesTemp->operator[](guid).push_back(TelemetryFile{fd, size, offset});
             }
 
             TelemetryFiles = TelemetryFilesTemp;
@@ -64,15 +69,83 @@ class TelemetryArrayLinux : public TelemetryArrayInterface
     }
     std::vector<unsigned char> data;
     size_t uid, instance;
+    int fd;
+    // mapping of the telemetry region if the driver supports mmap
+    void * mappingBase = nullptr;
+    size_t mappingSize = 0;
+    volatile uint64 * mapping = nullptr; // mappingBase + offset of the region
+    // declared qwords and the merged qword ranges [first, last) that load() reads
+    std::vector<size_t> required;
+    std::vector<std::pair<size_t, size_t> > ranges;
+    size_t rangeBytes = 0;
+    enum {
+        // reading a gap of up to this many qwords is cheaper than another read call
+        maxGapQWords = 8
+    };
+
+    void updateRanges()
+    {
+        std::sort(required.begin(), required.end());
+        required.erase(std::unique(required.begin(), required.end()), required.end());
+        ranges.clear();
+        rangeBytes = 0;
+        for (const auto q : required)
+        {
+            if (ranges.empty() == false && q <= ranges.back().second + maxGapQWords)
+            {
+                ranges.back().second = q + 1;
+            }
+            else
+            {
+                ranges.push_back(std::make_pair(q, q + 1));
+            }
+        }
+        for (const auto & r : ranges)
+        {
+            rangeBytes += (r.second - r.first) * sizeof(uint64);
+        }
+    }
+    void readRange(const size_t offset, const size_t bytes)
+    {
+        if (mapping)
+        {
+            for (size_t q = offset / sizeof(uint64); q < (offset + bytes) / sizeof(uint64); ++q)
+            {
+                *reinterpret_cast<uint64 *>(&data[q * sizeof(uint64)]) = mapping[q];
+            }
+            return;
+        }
+        const ssize_t bytesRead = ::pread(fd, data.data() + offset, bytes, (off_t)offset);
+        if (bytesRead != (ssize_t)bytes)
+        {
+            std::cerr << "Error: failed to read " << bytes << " bytes at offset " << offset << " from telemetry file" << std::endl;
+        }
+    }
 public:
     TelemetryArrayLinux(const size_t uid_, const size_t instance_): uid(uid_), instance(instance_)
     {
         assert(instance < numInstances(uid));
+        const auto & file = getTelemetryFiles().at(uid).at(instance);
+        fd = file.fd;
+        data.resize(file.size, 0);
+        if (file.size >= sizeof(uint64))
+        {
+            const size_t pageSize = (size_t)sysconf(_SC_PAGESIZE);
+            // pread applies the offset itself, mmap maps the whole page the region starts in
+            const size_t len = ((file.offset + file.size + pageSize - 1) / pageSize) * pageSize;
+            void * addr = (file.offset % sizeof(uint64) == 0) ? mmap(nullptr, len, PROT_READ, MAP_SHARED, fd, 0) : MAP_FAILED;
+            if (addr != MAP_FAILED)
+            {
+                mappingBase = addr;
+                mappingSize = len;
+                mapping = reinterpret_cast<volatile uint64 *>(static_cast<char *>(addr) + file.offset);
+            }
+        }
         TelemetryArrayLinux::load();
     }
     static size_t numInstances(const size_t uid)
     {
-        auto t = getTelemetryFiles();
+        auto & t = getTelemetryFiles();
         if (t.find(uid) == t.end())
         {
             return 0;
@@ -81,30 +154,39 @@ public:
     }
     virtual ~TelemetryArrayLinux() override
     {
+        if (mappingBase)
+        {
+            munmap(mappingBase, mappingSize);
+        }
     }
     size_t size() override
     {
         return data.size();
     }
+    void require(size_t qWordOffset) override
+    {
+        if ((qWordOffset + 1) * sizeof(uint64) > data.size())
+        {
+            std::cerr << "Error: qword offset " << qWordOffset << " is out of the telemetry region of " << data.size() << " bytes" << std::endl;
+            return;
+        }
+        required.push_back(qWordOffset);
+        updateRanges();
+    }
+    size_t loadSize() override
+    {
+        return ranges.empty() ? data.size() : rangeBytes;
+    }
     void load() override
     {
-        FILE * file = getTelemetryFiles().at(uid).at(instance);
-        assert(file);
-        // get the file size
-        fseek(file, 0, SEEK_END);
-        const auto pos = ftell(file);
-        if (pos < 0)
+        if (ranges.empty())
         {
-            std::cerr << "Error: failed to get file size" << std::endl;
+            readRange(0, data.size() - data.size() % sizeof(uint64));
             return;
         }
-        const size_t fileSize = pos;
-        fseek(file, 0, SEEK_SET);
-        data.resize(fileSize);
-        const size_t bytesRead = fread(data.data(), 1, fileSize, file);
-        if (bytesRead != fileSize)
+        for (const auto & r : ranges)
         {
-            std::cerr << "Error: failed to read " << fileSize << " bytes from telemetry file" << std::endl;
+            readRange(r.first * sizeof(uint64), (r.second - r.first) * sizeof(uint64));
         }
     }
     uint64 get(size_t qWordOffset, size_t lsb, size_t msb) override
@@ -158,6 +240,18 @@ size_t TelemetryArray::size()
     return impl->size();
 }
 
+void TelemetryArray::require(size_t qWordOffset)
+{
+    assert(impl.get());
+    impl->require(qWordOffset);
+}
+
+size_t TelemetryArray::loadSize()
+{
+    assert(impl.get());
+    return impl->loadSize();
+}
+
 void TelemetryArray::load()
 {
     assert(impl.get());
@@ -16,6 +16,13 @@ public:
     {
         return size() / sizeof(uint64);
     }
+    //! declares that get() will be called for the qword; once any qword is declared load() reads only the declared ones
+    virtual void require(size_t /* qWordOffset */) {}
+    //! number of bytes one load() reads
+    virtual size_t loadSize()
+    {
+        return size();
+    }
     virtual void load() = 0;
     virtual uint64 get(size_t qWordOffset, size_t lsb, size_t msb) = 0;
     virtual ~TelemetryArrayInterface() {};
@@ -30,6 +37,8 @@ public:
     static size_t numInstances(const size_t /* uid */);
     virtual ~TelemetryArray() override;
     size_t size() override; // in bytes
+    void require(size_t qWordOffset) override;
+    size_t loadSize() override;
     void load() override;
     uint64 get(size_t qWordOffset, size_t lsb, size_t msb) override;
 };
@@ -0,0 +1,136 @@
+// SPDX-License-Identifier: BSD-3-Clause
+// Copyright (c) 2024, Intel Corporation
+
+#include "region_profiler.h"
+#include "cpucounters.h"
+#include "utils.h"
+#include <iostream>
+
+namespace pcm
+{
+
+RegionProfiler & RegionProfiler::getInstance()
+{
+    // never destroyed so that regions can still be ended and dumped from atexit handlers
+    static RegionProfiler * instance = new RegionProfiler();
+    return *instance;
+}
+
+// user space rdpmc is allowed for all tasks only if the "rdpmc" attribute of the core PMU is 2
+static bool userRdpmcEnabled()
+{
+#ifdef __linux__
+    for (const auto path : { "/sys/bus/event_source/devices/cpu/rdpmc", "/sys/bus/event_source/devices/cpu_core/rdpmc" })
+    {
+        const auto value = readSysFS(path, true);
+        if (!value.empty())
+        {
+            if (atoi(value.c_str()) == 2)
+            {
+                return true;
+            }
+            std::cerr << "ERROR: user space rdpmc is restricted, enable it with: echo 2 > " << path << "\n";
+            return false;
+        }
+    }
+    std::cerr << "ERROR: can not determine whether user space rdpmc is enabled\n";
+    return false;
+#else
+    std::cerr << "ERROR: region profiling is supported only on Linux\n";
+    return false;
+#endif
+}
+
+bool RegionProfiler::init()
+{
+    PCM * m = PCM::getInstance();
+    if (m->usesPerfForCoreCounters())
+    {
+        std::cerr << "ERROR: region profiling needs direct core counter programming (set PCM_NO_PERF=1)\n";
+        return false;
+    }
+    if (userRdpmcEnabled() == false)
+    {
+        return false;
+    }
+    numGenCounters = (std::min)(m->getNumUsedCoreGenCounters(), uint32(MaxGenCounters));
+    fixedMask = (m->getCoreFixedCounterWidth() >= 64) ? ~0ULL : ((1ULL << m->getCoreFixedCounterWidth()) - 1ULL);
+    genMask = (m->getCoreGenCounterWidth() >= 64) ? ~0ULL : ((1ULL << m->getCoreGenCounterWidth()) - 1ULL);
+    enabled = true;
+    return true;
+}
+
+int32 RegionProfiler::getRegionId(const std::string & name)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    const auto it = regionIds.find(name);
+    if (it != regionIds.end())
+    {
+        return it->second;
+    }
+    if (regionNames.size() >= MaxRegions)
+    {
+        std::cerr << "ERROR: too many profiling regions, ignoring region " << name << "\n";
+        return -1;
+    }
+    const int32 id = (int32)regionNames.size();
+    regionNames.push_back(name);
+    regionIds[name] = id;
+    return id;
+}
+
+RegionProfiler::ThreadTable * RegionProfiler::registerThread()
+{
+    // the table outlives the thread so that its regions are included in later dumps
+    auto table = std::make_shared<ThreadTable>();
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        threadTables.push_back(table);
+    }
+    currentThreadTable() = table.get();
+    return table.get();
+}
+
+void RegionProfiler::dump(std::ostream & out)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    out << "Region,Threads,Calls,Migrated,Cycles/call,Instructions/call,IPC,Ref cycles/call";
+    for (uint32 i = 0; i < numGenCounters; ++i)
+    {
+        out << ",Event" << i << "/call";
+    }
+    out << "\n";
+    for (size_t id = 0; id < regionNames.size(); ++id)
+    {
+        uint64 threads = 0, calls = 0, migrated = 0;
+        uint64 values[MaxCounters] = { 0 };
+        for (const auto & table : threadTables)
+        {
+            const Region & r = table->regions[id];
+            const uint64 c = r.calls.load(std::memory_order_relaxed);
+            const uint64 mig = r.migrated.load(std::memory_order_relaxed);
+            if (c == 0 && mig == 0) continue;
+            ++threads;
+            calls += c;
+            migrated += mig;
+            for (uint32 i = 0; i < MaxCounters; ++i)
+            {
+                values[i] += r.values[i].load(std::memory_order_relaxed);
+            }
+        }
+        auto perCall = [calls](const uint64 v) { return calls ? double(v) / double(calls) : 0.; };
+        // fixed counters: 0 - instructions retired, 1 - core cycles, 2 - reference cycles
+        out << regionNames[id] << "," << threads << "," << calls << "," << migrated
+            << "," << perCall(values[1]) << "," << perCall(values[0])
+            << "," << (values[1] ? double(values[0]) / double(values[1]) : 0.)
+            << "," << perCall(values[2]);
+        for (uint32 i = 0; i < numGenCounters; ++i)
+        {
+            out << "," << perCall(values[NumFixedCounters + i]);
+        }
+        out << "\n";
+    }
+    out.flush();
+}
+
+} // namespace pcm
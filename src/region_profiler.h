@@ -0,0 +1,164 @@
+// SPDX-License-Identifier: BSD-3-Clause
+// Copyright (c) 2024, Intel Corporation
+
+#pragma once
+
+/*!     \file region_profiler.h
+        \brief In-process profiling of code regions with user space rdpmc reads of the core counters
+*/
+
+#include "types.h"
+#include <atomic>
+#include <mutex>
+#include <memory>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <ostream>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+namespace pcm
+{
+
+/*! \brief Accumulates core counter deltas of named code regions per thread
+
+    The core events have to be programmed with PCM::program() (without Linux perf) before init().
+    begin() and end() read the fixed counters (instructions, cycles, reference cycles) and the
+    programmed general-purpose counters with rdpmc and add the deltas to a table owned by the
+    calling thread, so the fast path takes no locks and does no system calls. Regions where the
+    thread migrated to another core between begin() and end() are only counted as migrated.
+    A region must not be nested within itself on the same thread.
+*/
+class RegionProfiler
+{
+public:
+    enum {
+        MaxRegions = 256,
+        NumFixedCounters = 3,
+        MaxGenCounters = 8,
+        MaxCounters = NumFixedCounters + MaxGenCounters
+    };
+
+private:
+    struct Region
+    {
+        // written only by the owning thread, read by dump()
+        std::atomic<uint64> calls{0};
+        std::atomic<uint64> migrated{0};
+        std::atomic<uint64> values[MaxCounters];
+        // private to the owning thread
+        uint64 start[MaxCounters];
+        uint32 startCore = 0;
+        Region()
+        {
+            for (auto & v : values) v.store(0, std::memory_order_relaxed);
+        }
+    };
+    struct ThreadTable
+    {
+        Region regions[MaxRegions];
+    };
+
+    bool enabled = false;
+    uint32 numGenCounters = 0;
+    uint64 fixedMask = 0, genMask = 0;
+    std::mutex mutex; // protects the registries below, never taken on the fast path
+    std::vector<std::string> regionNames;
+    std::unordered_map<std::string, int32> regionIds;
+    std::vector<std::shared_ptr<ThreadTable> > threadTables;
+
+    RegionProfiler() = default;
+    RegionProfiler(const RegionProfiler &) = delete;
+    RegionProfiler & operator = (const RegionProfiler &) = delete;
+
+    static ThreadTable * & currentThreadTable()
+    {
+        static thread_local ThreadTable * table = nullptr;
+        return table;
+    }
+    ThreadTable * registerThread();
+
+    static uint64 readPMC(const uint32 index)
+    {
+#ifdef _MSC_VER
+        return __readpmc(index);
+#else
+        uint32 high = 0, low = 0;
+        asm volatile("rdpmc" : "=a" (low), "=d" (high) : "c" (index));
+        return low + (uint64(high) << 32ULL);
+#endif
+    }
+    static uint32 readCore()
+    {
+        uint32 aux = 0;
+#ifdef _MSC_VER
+        __rdtscp(&aux);
+#else
+        uint32 high = 0, low = 0;
+        asm volatile("rdtscp" : "=a" (low), "=d" (high), "=c" (aux));
+#endif
+        return aux; // OS specific encoding of the core (and node) id
+    }
+    void readCounters(uint64 * values) const
+    {
+        for (uint32 i = 0; i < NumFixedCounters; ++i)
+        {
+            values[i] = readPMC((1U << 30U) + i);
+        }
+        for (uint32 i = 0; i < numGenCounters; ++i)
+        {
+            values[NumFixedCounters + i] = readPMC(i);
+        }
+    }
+
+public:
+    static RegionProfiler & getInstance();
+
+    //! \brief Checks that the core counters can be read from user space and records the programmed counters
+    //! \return false (and prints the reason) if region profiling is not possible, begin()/end() are no-ops then
+    bool init();
+    bool isEnabled() const { return enabled; }
+    uint32 getNumGenCounters() const { return numGenCounters; }
+
+    //! \brief Returns the id of the named region, registering it on first use, or -1 if there are too many regions
+    int32 getRegionId(const std::string & name);
+
+    void begin(const int32 id)
+    {
+        if (!enabled || id < 0 || id >= MaxRegions) return;
+        ThreadTable * table = currentThreadTable();
+        if (table == nullptr) table = registerThread();
+        Region & r = table->regions[id];
+        r.startCore = readCore();
+        readCounters(r.start);
+    }
+
+    void end(const int32 id)
+    {
+        if (!enabled || id < 0 || id >= MaxRegions) return;
+        uint64 now[MaxCounters];
+        readCounters(now);
+        const uint32 core = readCore();
+        ThreadTable * table = currentThreadTable();
+        if (table == nullptr) return; // begin() was not called on this thread
+        Region & r = table->regions[id];
+        if (core != r.startCore)
+        {
+            r.migrated.store(r.migrated.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+            return;
+        }
+        for (uint32 i = 0; i < NumFixedCounters + numGenCounters; ++i)
+        {
+            const uint64 delta = (now[i] - r.start[i]) & (i < NumFixedCounters ? fixedMask : genMask);
+            r.values[i].store(r.values[i].load(std::memory_order_relaxed) + delta, std::memory_order_relaxed);
+        }
+        r.calls.store(r.calls.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    }
+
+    //! \brief Prints per-region statistics aggregated over all threads (CSV)
+    void dump(std::ostream & out);
+};
+
+} // namespace pcm
@@ -8,8 +8,12 @@
 #include "cpucounters.h"
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
 #include <string>
 #include <iostream>
+#include <algorithm>
 #include <cstdlib>
 
 namespace pcm
@@ -23,6 +27,80 @@ namespace pcm
         }
         return true;
     }
+    std::vector<int> Resctrl::getAllDomains()
+    {
+        std::vector<int> domains;
+        DIR * dir = opendir("/sys/fs/resctrl/mon_data");
+        if (dir)
+        {
+            struct dirent * entry = nullptr;
+            while ((entry = readdir(dir)) != nullptr)
+            {
+                int domain = -1;
+                if (sscanf(entry->d_name, "mon_L3_%d", &domain) == 1 && domain >= 0)
+                {
+                    domains.push_back(domain);
+                }
+            }
+            closedir(dir);
+        }
+        if (domains.empty())
+        {
+            for (int s = 0; s < (int)pcm.getNumSockets(); ++s)
+            {
+                domains.push_back(s);
+            }
+        }
+        std::sort(domains.begin(), domains.end());
+        return domains;
+    }
+    void Resctrl::openMetricFiles(const std::string & dir, const std::vector<int> & domains, int key,
+        FileMapType & l3occ, FileMapType & mbl, FileMapType & mbt)
+    {
+        auto generateMetricFiles = [&dir, &domains, key] (const std::string & metric, FileMapType & fileMap)
+        {
+            for (const auto d : domains)
+            {
+                std::ostringstream ostr;
+                ostr << dir << "/mon_data/mon_L3_" << std::setfill('0') << std::setw(2) << d << "/" << metric;
+                const auto path = ostr.str();
+                const int fd = ::open(path.c_str(), O_RDONLY);
+                if (fd < 0)
+                {
+                    std::cerr << "Error opening " << path << ". Error: " << strerror(errno) << "\n";
+                    if (errno == EMFILE)
+                    {
+                        std::cerr << PCM_ULIMIT_RECOMMENDATION;
+                    }
+                    continue;
+                }
+                fileMap[key].push_back(MetricFile{path, fd});
+            }
+        };
+        if (pcm.L3CacheOccupancyMetricAvailable())
+        {
+            generateMetricFiles("llc_occupancy", l3occ);
+        }
+        if (pcm.CoreLocalMemoryBWMetricAvailable())
+        {
+            generateMetricFiles("mbm_local_bytes", mbl);
+        }
+        if (pcm.CoreRemoteMemoryBWMetricAvailable())
+        {
+            generateMetricFiles("mbm_total_bytes", mbt);
+        }
+    }
+    void Resctrl::closeMetricFiles(FileMapType & fileMap)
+    {
+        for (auto & files : fileMap)
+        {
+            for (auto & f : files.second)
+            {
+                ::close(f.fd);
+            }
+        }
+        fileMap.clear();
+    }
     void Resctrl::init()
     {
         if (isMounted() == false)
@@ -32,6 +110,7 @@ namespace pcm
             std::cerr << "Mount it to make it work: mount -t resctrl resctrl /sys/fs/resctrl\n";
             return;
         }
+        const auto allDomains = getAllDomains();
         const auto numCores = pcm.getNumCores();
         for (unsigned int c = 0; c < numCores; ++c)
         {
@@ -53,36 +132,24 @@ namespace pcm
                 }
                 const auto cpus_listFilename = dir + "/cpus_list";
                 writeSysFS(cpus_listFilename.c_str(), C, false);
-                auto generateMetricFiles = [&dir, c] (PCM & pcm, const std::string & metric, FileMapType & fileMap)
-                {
-                    auto getMetricFilename = [] (const std::string & dir, const uint64 s, const std::string & metric)
-                    {
-                        std::ostringstream ostr;
-                        ostr << dir << "/mon_data/mon_L3_" << std::setfill('0') << std::setw(2) << s << "/" << metric;
-                        return ostr.str();
-                    };
-                    for (uint64 s = 0; s < pcm.getNumSockets(); ++s)
-                    {
-                        fileMap[c].push_back(getMetricFilename(dir, s, metric));
-                    }
-                };
-                if (pcm.L3CacheOccupancyMetricAvailable())
-                {
-                    generateMetricFiles(pcm, "llc_occupancy", L3OCC);
-                }
-                if (pcm.CoreLocalMemoryBWMetricAvailable())
+                // the group contains only core c, so only the L3 domain of core c counts anything
+                const auto domainId = readSysFS((std::string("/sys/devices/system/cpu/cpu") + C + "/cache/index3/id").c_str(), true);
+                if (domainId.empty() == false)
                 {
-                    generateMetricFiles(pcm, "mbm_local_bytes", MBL);
+                    openMetricFiles(dir, std::vector<int>{atoi(domainId.c_str())}, c, L3OCC, MBL, MBT);
                 }
-                if (pcm.CoreRemoteMemoryBWMetricAvailable())
+                else
                 {
-                    generateMetricFiles(pcm, "mbm_total_bytes", MBT);
+                    openMetricFiles(dir, allDomains, c, L3OCC, MBL, MBT);
                 }
             }
         }
     }
     void Resctrl::cleanup()
     {
+        closeMetricFiles(L3OCC);
+        closeMetricFiles(MBL);
+        closeMetricFiles(MBT);
         const auto numCores = pcm.getNumCores();
         for (unsigned int c = 0; c < numCores; ++c)
         {
@@ -95,9 +162,9 @@ namespace pcm
             }
         }
     }
-    size_t Resctrl::getMetric(const Resctrl::FileMapType & fileMap, int core)
+    size_t Resctrl::getMetric(const Resctrl::FileMapType & fileMap, int key)
     {
-        auto files = fileMap.find(core);
+        auto files = fileMap.find(key);
         if (files == fileMap.end())
         {
             return 0ULL;
@@ -105,20 +172,19 @@ namespace pcm
         size_t result = 0;
         for (auto& f : files->second)
         {
-            const auto data = readSysFS(f.c_str(), false);
-            if (data.empty() == false)
+            // re-reading from offset 0 makes the kernel generate fresh content
+            char buffer[64];
+            const ssize_t len = ::pread(f.fd, buffer, sizeof(buffer) - 1, 0);
+            if (len > 0)
             {
-                result += atoll(data.c_str());
+                buffer[len] = 0;
+                result += atoll(buffer);
             }
             else
             {
                 static std::mutex lock;
                 std::lock_guard<std::mutex> _(lock);
-                std::cerr << "Error reading " << f << ". Error: " << strerror(errno) << "\n";
-                if (errno == 24)
-                {
-                    std::cerr << PCM_ULIMIT_RECOMMENDATION;
-                }
+                std::cerr << "Error reading " << f.path << ". Error: " << strerror(errno) << "\n";
             }
         }
         return result;
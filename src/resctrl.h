@@ -16,6 +16,7 @@
 #include <vector>
 #include <mutex>
 #include <memory>
+#include <string>
 
 namespace pcm
 {
@@ -24,10 +25,20 @@ namespace pcm
     class Resctrl
     {
         PCM & pcm;
-        typedef std::unordered_map<int, std::vector<std::string> > FileMapType;
+        // mon_data files are kept open and re-read with pread
+        struct MetricFile
+        {
+            std::string path;
+            int fd;
+        };
+        typedef std::unordered_map<int, std::vector<MetricFile> > FileMapType;
         FileMapType L3OCC, MBL, MBT;
         Resctrl() = delete;
-        size_t getMetric(const FileMapType & fileMap, int core);
+        size_t getMetric(const FileMapType & fileMap, int key);
+        void openMetricFiles(const std::string & dir, const std::vector<int> & domains, int key,
+            FileMapType & l3occ, FileMapType & mbl, FileMapType & mbt);
+        static void closeMetricFiles(FileMapType & fileMap);
+        std::vector<int> getAllDomains();
         static constexpr auto PCMPath = "/sys/fs/resctrl/mon_groups/pcm";
     public:
         Resctrl(PCM & m) : pcm(m) {}
@@ -0,0 +1,696 @@
+// SPDX-License-Identifier: BSD-3-Clause
+// Copyright (c) 2024, Intel Corporation
+
+#include "simulated_hw.h"
+#include "cpucounters.h"
+#include "utils.h"
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+
+namespace pcm
+{
+
+// simulated activity: the cores are busy 80% of the time (the rest in C6) with 1.2 instructions per cycle,
+// every memory channel reads ~1.9 GB/s and writes ~1 GB/s, DDR4-2666 and 10.4 GT/s UPI links
+static constexpr double busyFraction = 0.8;
+static constexpr double instructionsPerCycle = 1.2;
+static constexpr double readCASPerSecond = 30e6;
+static constexpr double writeCASPerSecond = 15e6;
+static constexpr double dramClockHz = 1333e6;
+static constexpr double upiClockHz = 1300e6;
+static constexpr double energyUnitsPerJoule = 16384.;   // 2^-14 J, see MSR_RAPL_POWER_UNIT below
+static constexpr double dramEnergyUnitsPerJoule = 1. / 15.3e-6;
+static constexpr auto NCUPMONConfig = 0x702;            // number of CHAs on Skylake-SP
+
+SimulatedHardware * SimulatedHardware::get()
+{
+#ifdef __linux__
+    // never destroyed: MSR and PCI handles may still be used from atexit handlers
+    static SimulatedHardware * instance = []() -> SimulatedHardware *
+    {
+        const auto config = safe_getenv("PCM_SIMULATE");
+        if (config.empty())
+        {
+            return nullptr;
+        }
+        return new SimulatedHardware(config, safe_getenv("PCM_SIMULATE_TRACE"));
+    }();
+    return instance;
+#else
+    return nullptr;
+#endif
+}
+
+SimulatedHardware::SimulatedHardware(const std::string & config, const std::string & traceFile) :
+    start(std::chrono::steady_clock::now())
+{
+    auto invalid = [&config]()
+    {
+        return std::runtime_error("PCM error: invalid PCM_SIMULATE value \"" + config +
+            "\", expected <sockets>x<cores per socket>x<threads per core>[,imc=<channels>][,upi=<links>][,iio=<stacks>]");
+    };
+    auto parse = [&invalid](const std::string & str, const uint32 minValue, const uint32 maxValue)
+    {
+        char * end = nullptr;
+        const unsigned long value = std::strtoul(str.c_str(), &end, 10);
+        if (str.empty() || *end != 0 || value < minValue || value > maxValue)
+        {
+            throw invalid();
+        }
+        return (uint32)value;
+    };
+    const auto options = split(config, ',');
+    const auto dims = options.empty() ? std::vector<std::string>() : split(options[0], 'x');
+    if (dims.size() != 3)
+    {
+        throw invalid();
+    }
+    numSockets = parse(dims[0], 1, 8);
+    coresPerSocket = parse(dims[1], 1, 63); // the CHA count register has 6 bits
+    threadsPerCore = parse(dims[2], 1, 2);
+    for (size_t i = 1; i < options.size(); ++i)
+    {
+        const auto keyValue = split(options[i], '=');
+        if (keyValue.size() != 2) throw invalid();
+        if (keyValue[0] == "imc") imcChannels = parse(keyValue[1], 1, 6);
+        else if (keyValue[0] == "upi") upiLinks = parse(keyValue[1], 0, 3);
+        else if (keyValue[0] == "iio") iioStacks = parse(keyValue[1], 0, PCM::SKX_IIO_STACK_COUNT);
+        else throw invalid();
+    }
+
+    buildCPULayout();
+    buildPCILayouts();
+
+    cpus.resize(getNumCPUs());
+    for (uint32 cpu = 0; cpu < getNumCPUs(); ++cpu)
+    {
+        cpus[cpu].reset(new RegisterFile());
+        cpus[cpu]->layout = &cpuLayout;
+        cpus[cpu]->traceScope = (int32)cpu;
+        for (const auto & box : cpuLayout.boxes)
+        {
+            if (box.ctl) cpus[cpu]->values[box.ctl] = box.initial;
+        }
+    }
+
+    for (uint32 s = 0; s < numSockets; ++s)
+    {
+        // memory controller channels and M2M blocks on one bus, UPI and M3UPI links on the next one
+        const uint32 imcBus = 0x10 + 0x20 * s, upiBus = imcBus + 1;
+        static const struct { uint32 device, function, deviceId; } channels[] = {
+            { SKX_MC0_CH0_REGISTER_DEV_ADDR, SKX_MC0_CH0_REGISTER_FUNC_ADDR, 0x2042 },
+            { SKX_MC0_CH1_REGISTER_DEV_ADDR, SKX_MC0_CH1_REGISTER_FUNC_ADDR, 0x2046 },
+            { SKX_MC0_CH2_REGISTER_DEV_ADDR, SKX_MC0_CH2_REGISTER_FUNC_ADDR, 0x204a },
+            { SKX_MC1_CH0_REGISTER_DEV_ADDR, SKX_MC1_CH0_REGISTER_FUNC_ADDR, 0x2042 },
+            { SKX_MC1_CH1_REGISTER_DEV_ADDR, SKX_MC1_CH1_REGISTER_FUNC_ADDR, 0x2046 },
+            { SKX_MC1_CH2_REGISTER_DEV_ADDR, SKX_MC1_CH2_REGISTER_FUNC_ADDR, 0x204a }
+        };
+        for (uint32 c = 0; c < imcChannels; ++c)
+        {
+            addPCIFunction(s, imcBus, channels[c].device, channels[c].function, channels[c].deviceId, imcLayout);
+        }
+        addPCIFunction(s, imcBus, SKX_M2M_0_REGISTER_DEV_ADDR, SKX_M2M_0_REGISTER_FUNC_ADDR, 0x2066, m2mLayout);
+        if (imcChannels > 3)
+        {
+            addPCIFunction(s, imcBus, SKX_M2M_1_REGISTER_DEV_ADDR, SKX_M2M_1_REGISTER_FUNC_ADDR, 0x2066, m2mLayout);
+        }
+        static const struct { uint32 device, function, m3upiDevice, m3upiFunction; } links[] = {
+            { SKX_QPI_PORT0_REGISTER_DEV_ADDR, SKX_QPI_PORT0_REGISTER_FUNC_ADDR, SKX_M3UPI_PORT0_REGISTER_DEV_ADDR, SKX_M3UPI_PORT0_REGISTER_FUNC_ADDR },
+            { SKX_QPI_PORT1_REGISTER_DEV_ADDR, SKX_QPI_PORT1_REGISTER_FUNC_ADDR, SKX_M3UPI_PORT1_REGISTER_DEV_ADDR, SKX_M3UPI_PORT1_REGISTER_FUNC_ADDR },
+            { SKX_QPI_PORT2_REGISTER_DEV_ADDR, SKX_QPI_PORT2_REGISTER_FUNC_ADDR, SKX_M3UPI_PORT2_REGISTER_DEV_ADDR, SKX_M3UPI_PORT2_REGISTER_FUNC_ADDR }
+        };
+        for (uint32 l = 0; l < upiLinks; ++l)
+        {
+            addPCIFunction(s, upiBus, links[l].device, links[l].function, 0x2058, upiLayout);
+            addPCIFunction(s, upiBus, links[l].m3upiDevice, links[l].m3upiFunction, 0x204c, m3upiLayout);
+        }
+    }
+
+    if (traceFile.empty() == false)
+    {
+        loadTrace(traceFile);
+    }
+    std::cerr << "INFO: simulating " << numSockets << " socket(s) x " << coresPerSocket << " core(s) x " << threadsPerCore << " thread(s), "
+              << imcChannels << " memory channel(s), " << upiLinks << " UPI link(s) and " << iioStacks << " IIO stack(s) per socket"
+              << (traces.empty() ? "" : ", replaying " + traceFile) << "\n";
+}
+
+uint32 SimulatedHardware::Layout::addBox(const uint64 boxCtl, const uint64 initial, const uint64 freeze, const uint64 resetCounters, const uint64 resetControls)
+{
+    BoxDef box;
+    box.ctl = boxCtl;
+    box.initial = initial;
+    box.freeze = freeze;
+    box.resetCounters = resetCounters;
+    box.resetControls = resetControls;
+    boxes.push_back(box);
+    const uint32 index = (uint32)boxes.size() - 1;
+    if (boxCtl) controls[boxCtl] = index;
+    return index;
+}
+
+void SimulatedHardware::Layout::addCounter(const uint32 box, const BoxKind kind, const uint64 ctr, const uint64 ctl, const uint64 ctlEnable,
+    const uint64 boxEnable, const uint32 width, const double fixedRate)
+{
+    CounterDef d;
+    d.kind = kind;
+    d.box = box;
+    d.ctl = ctl;
+    d.ctlEnable = ctlEnable;
+    d.boxEnable = boxEnable;
+    d.mask = (width >= 64) ? ~0ULL : ((1ULL << width) - 1ULL);
+    d.fixedRate = fixedRate;
+    counters[ctr] = d;
+    boxes[box].counters.push_back(ctr);
+    if (ctl) controls[ctl] = box;
+}
+
+void SimulatedHardware::buildCPULayout()
+{
+    auto & l = cpuLayout;
+    const double tscHz = nominalHz();
+
+    const uint32 freeRunning = l.addBox(0, 0, 0, 0, 0);
+    l.addCounter(freeRunning, FreeRunning, IA32_TIME_STAMP_COUNTER, 0, 0, 0, 64, tscHz);
+    l.addCounter(freeRunning, FreeRunning, MSR_CORE_C6_RESIDENCY, 0, 0, 0, 64, (1. - busyFraction) * tscHz);
+    l.addCounter(freeRunning, FreeRunning, MSR_PKG_ENERGY_STATUS, 0, 0, 0, 32, 100. * energyUnitsPerJoule);
+    l.addCounter(freeRunning, FreeRunning, MSR_PP0_ENERGY_STATUS, 0, 0, 0, 32, 60. * energyUnitsPerJoule);
+    l.addCounter(freeRunning, FreeRunning, MSR_DRAM_ENERGY_STATUS, 0, 0, 0, 32, 20. * dramEnergyUnitsPerJoule);
+
+    // core PMU: the global control enables the counters, no freeze or reset bits
+    const uint32 core = l.addBox(IA32_CR_PERF_GLOBAL_CTRL, (7ULL << 32) + 0xff, 0, 0, 0);
+    const double fixedRates[] = { instructionsPerCycle * busyFraction * tscHz, busyFraction * tscHz, busyFraction * tscHz };
+    for (uint32 i = 0; i < 3; ++i)
+    {
+        l.addCounter(core, CoreBox, INST_RETIRED_ADDR + i, IA32_CR_FIXED_CTR_CTRL, 3ULL << (4 * i), 1ULL << (32 + i), 48, fixedRates[i]);
+    }
+    for (uint32 i = 0; i < 8; ++i)
+    {
+        l.addCounter(core, CoreBox, IA32_PMC0 + i, IA32_PERFEVTSEL0_ADDR + i, 1ULL << 22, 1ULL << i, 48);
+    }
+
+    // per socket uncore PMUs (every logical core has its own copy, PCM uses those of the socket reference core)
+    const uint64 freeze = UNC_PMON_UNIT_CTL_FRZ, resetCounters = UNC_PMON_UNIT_CTL_RST_COUNTERS, resetControls = UNC_PMON_UNIT_CTL_RST_CONTROL;
+    for (uint32 cha = 0; cha < coresPerSocket; ++cha)
+    {
+        const uint32 box = l.addBox(HSX_C0_MSR_PMON_BOX_CTL + HSX_CBO_MSR_STEP * cha, 0, freeze, resetCounters, resetControls);
+        for (uint32 i = 0; i < 4; ++i)
+        {
+            l.addCounter(box, CHABox, HSX_C0_MSR_PMON_CTR0 + HSX_CBO_MSR_STEP * cha + i, HSX_C0_MSR_PMON_CTL0 + HSX_CBO_MSR_STEP * cha + i, CBO_MSR_PMON_CTL_EN, 0, 48);
+        }
+    }
+    for (uint32 stack = 0; stack < iioStacks; ++stack)
+    {
+        const uint32 box = l.addBox(SKX_IIO_CBDMA_UNIT_CTL + SKX_IIO_PM_REG_STEP * stack, 0, freeze, resetCounters, resetControls);
+        for (uint32 i = 0; i < 4; ++i)
+        {
+            l.addCounter(box, IIOBox, SKX_IIO_CBDMA_CTR0 + SKX_IIO_PM_REG_STEP * stack + i, SKX_IIO_CBDMA_CTL0 + SKX_IIO_PM_REG_STEP * stack + i, IIO_MSR_PMON_CTL_EN, 0, 48);
+        }
+    }
+    const uint32 pcu = l.addBox(HSX_PCU_MSR_PMON_BOX_CTL_ADDR, 0, freeze, resetCounters, resetControls);
+    for (uint32 i = 0; i < 4; ++i)
+    {
+        l.addCounter(pcu, PCUBox, HSX_PCU_MSR_PMON_CTR0_ADDR + i, HSX_PCU_MSR_PMON_CTL0_ADDR + i, PCU_MSR_PMON_CTL_EN, 0, 48);
+    }
+    const uint32 ubox = l.addBox(0, 0, 0, 0, 0);
+    l.addCounter(ubox, UBOXBox, UCLK_FIXED_CTR_ADDR, UCLK_FIXED_CTL_ADDR, UCLK_FIXED_CTL_EN, 0, 48, uncoreRatio * 100e6);
+    l.addCounter(ubox, UBOXBox, UBOX_MSR_PMON_CTR0_ADDR, UBOX_MSR_PMON_CTL0_ADDR, 1ULL << 22, 0, 48);
+    l.addCounter(ubox, UBOXBox, UBOX_MSR_PMON_CTR1_ADDR, UBOX_MSR_PMON_CTL1_ADDR, 1ULL << 22, 0, 48);
+
+    l.readOnly[PLATFORM_INFO_ADDR] = uint64(nominalRatio) << 8;
+    l.readOnly[MSR_RAPL_POWER_UNIT] = 0xA0E03;           // 1/8 W power, 2^-14 J energy and ~1 ms time units
+    l.readOnly[MSR_PKG_POWER_INFO] = 150 * 8;            // 150 W TDP
+    l.readOnly[MSR_IA32_THERM_STATUS] = (1ULL << 31) + (40ULL << 16); // valid reading, 40 degrees below TjMax
+    l.readOnly[MSR_PACKAGE_THERM_STATUS] = 35ULL << 16;
+    l.readOnly[MSR_IA32_BIOS_SIGN_ID] = 0x2000065ULL << 32; // microcode level
+    l.readOnly[NCUPMONConfig] = coresPerSocket;
+}
+
+void SimulatedHardware::buildPCILayouts()
+{
+    const uint64 freeze = UNC_PMON_UNIT_CTL_FRZ, resetCounters = UNC_PMON_UNIT_CTL_RST_COUNTERS, resetControls = UNC_PMON_UNIT_CTL_RST_CONTROL;
+    struct PMU
+    {
+        Layout & layout;
+        BoxKind kind;
+        uint64 boxCtl;
+        std::vector<uint64> ctl, ctr;
+        uint64 enable;
+    };
+    const PMU pmus[] = {
+        { imcLayout, IMCBox, XPF_MC_CH_PCI_PMON_BOX_CTL_ADDR,
+            { XPF_MC_CH_PCI_PMON_CTL0_ADDR, XPF_MC_CH_PCI_PMON_CTL1_ADDR, XPF_MC_CH_PCI_PMON_CTL2_ADDR, XPF_MC_CH_PCI_PMON_CTL3_ADDR },
+            { XPF_MC_CH_PCI_PMON_CTR0_ADDR, XPF_MC_CH_PCI_PMON_CTR1_ADDR, XPF_MC_CH_PCI_PMON_CTR2_ADDR, XPF_MC_CH_PCI_PMON_CTR3_ADDR },
+            MC_CH_PCI_PMON_CTL_EN },
+        { m2mLayout, M2MBox, SKX_M2M_PCI_PMON_BOX_CTL_ADDR,
+            { SKX_M2M_PCI_PMON_CTL0_ADDR, SKX_M2M_PCI_PMON_CTL1_ADDR, SKX_M2M_PCI_PMON_CTL2_ADDR, SKX_M2M_PCI_PMON_CTL3_ADDR },
+            { SKX_M2M_PCI_PMON_CTR0_ADDR, SKX_M2M_PCI_PMON_CTR1_ADDR, SKX_M2M_PCI_PMON_CTR2_ADDR, SKX_M2M_PCI_PMON_CTR3_ADDR },
+            M2M_PCI_PMON_CTL_EN },
+        { upiLayout, UPIBox, U_L_PCI_PMON_BOX_CTL_ADDR,
+            { U_L_PCI_PMON_CTL0_ADDR, U_L_PCI_PMON_CTL1_ADDR, U_L_PCI_PMON_CTL2_ADDR, U_L_PCI_PMON_CTL3_ADDR },
+            { U_L_PCI_PMON_CTR0_ADDR, U_L_PCI_PMON_CTR1_ADDR, U_L_PCI_PMON_CTR2_ADDR, U_L_PCI_PMON_CTR3_ADDR },
+            Q_P_PCI_PMON_CTL_EN },
+        { m3upiLayout, M3UPIBox, M3UPI_PCI_PMON_BOX_CTL_ADDR,
+            { M3UPI_PCI_PMON_CTL0_ADDR, M3UPI_PCI_PMON_CTL1_ADDR, M3UPI_PCI_PMON_CTL2_ADDR },
+            { M3UPI_PCI_PMON_CTR0_ADDR, M3UPI_PCI_PMON_CTR1_ADDR, M3UPI_PCI_PMON_CTR2_ADDR },
+            1ULL << 22 }
+    };
+    for (const auto & pmu : pmus)
+    {
+        const uint32 box = pmu.layout.addBox(pmu.boxCtl, 0, freeze, resetCounters, resetControls);
+        for (size_t i = 0; i < pmu.ctr.size(); ++i)
+        {
+            pmu.layout.addCounter(box, pmu.kind, pmu.ctr[i], pmu.ctl[i], pmu.enable, 0, 48);
+        }
+    }
+    imcLayout.addCounter(0, IMCBox, XPF_MC_CH_PCI_PMON_FIXED_CTR_ADDR, XPF_MC_CH_PCI_PMON_FIXED_CTL_ADDR, MC_CH_PCI_PMON_FIXED_CTL_EN, 0, 48, dramClockHz);
+}
+
+void SimulatedHardware::addPCIFunction(const uint32 socket, const uint32 bus, const uint32 device, const uint32 function, const uint32 deviceId, const Layout & layout)
+{
+    std::unique_ptr<PciFunction> fn(new PciFunction());
+    fn->deviceId = deviceId;
+    fn->regs.layout = &layout;
+    fn->regs.traceScope = (int32)socket;
+    fn->regs.traceDevFn = uint64((device << 3) + function) << 32;
+    pciFunctions[(bus << 8) + (device << 3) + function] = std::move(fn);
+}
+
+void SimulatedHardware::loadTrace(const std::string & fileName)
+{
+    std::ifstream file(fileName);
+    if (!file.is_open())
+    {
+        throw std::runtime_error("PCM error: can not open PCM_SIMULATE_TRACE file " + fileName);
+    }
+    std::string line;
+    for (size_t lineNumber = 1; std::getline(file, line); ++lineNumber)
+    {
+        const auto comment = line.find('#');
+        if (comment != std::string::npos) line.resize(comment);
+        std::istringstream tokens(line);
+        std::vector<std::string> t;
+        std::string token;
+        while (tokens >> token) t.push_back(token);
+        if (t.empty()) continue;
+
+        auto invalid = [&]() { return std::runtime_error("PCM error: invalid line " + std::to_string(lineNumber) + " in " + fileName + ": " + line); };
+        auto number = [&](const std::string & str) -> double
+        {
+            char * end = nullptr;
+            const double value = (str.find("0x") == 0 || str.find("0X") == 0) ? (double)std::strtoull(str.c_str(), &end, 16) : std::strtod(str.c_str(), &end);
+            if (str.empty() || *end != 0) throw invalid();
+            return value;
+        };
+        auto scope = [&](const std::string & str) { return (str == "*") ? -1 : (int32)number(str); };
+        TraceKey key;
+        double value = 0.;
+        if (t.size() == 5 && t[1] == "msr")
+        {
+            key = TraceKey(false, scope(t[2]), (uint64)number(t[3]));
+            value = number(t[4]);
+        }
+        else if (t.size() == 6 && t[1] == "pci")
+        {
+            const auto devFn = split(t[3], '.');
+            if (devFn.size() != 2) throw invalid();
+            const uint64 device = (uint64)number(devFn[0]), function = (uint64)number(devFn[1]);
+            key = TraceKey(true, scope(t[2]), (((device << 3) + function) << 32) + (uint64)number(t[4]));
+            value = number(t[5]);
+        }
+        else
+        {
+            throw invalid();
+        }
+        traces[key].samples.push_back(std::make_pair(number(t[0]), value));
+    }
+    for (auto & trace : traces)
+    {
+        auto & samples = trace.second.samples;
+        std::stable_sort(samples.begin(), samples.end(),
+            [](const std::pair<double, double> & a, const std::pair<double, double> & b) { return a.first < b.first; });
+    }
+}
+
+double SimulatedHardware::Trace::at(const double t) const
+{
+    if (samples.size() < 2 || t <= samples.front().first)
+    {
+        return samples.front().second;
+    }
+    auto next = std::upper_bound(samples.begin(), samples.end(), t,
+        [](const double value, const std::pair<double, double> & s) { return value < s.first; });
+    if (next == samples.end()) --next; // extrapolate with the last segment
+    const auto prev = next - 1;
+    const double dt = next->first - prev->first;
+    return (dt > 0.) ? prev->second + (next->second - prev->second) * (t - prev->first) / dt : next->second;
+}
+
+uint64 SimulatedHardware::RegisterFile::get(const uint64 address) const
+{
+    const auto v = values.find(address);
+    if (v != values.end()) return v->second;
+    const auto r = layout->readOnly.find(address);
+    return (r != layout->readOnly.end()) ? r->second : 0ULL;
+}
+
+void SimulatedHardware::getTopology(std::vector<TopologyEntry> & topology) const
+{
+    // numbered like Linux does on Xeon servers: first threads of all cores of all sockets, then their siblings
+    topology.resize(getNumCPUs());
+    int32 os_id = 0;
+    for (uint32 t = 0; t < threadsPerCore; ++t)
+    {
+        for (uint32 s = 0; s < numSockets; ++s)
+        {
+            for (uint32 c = 0; c < coresPerSocket; ++c)
+            {
+                TopologyEntry & entry = topology[os_id];
+                entry.os_id = os_id++;
+                entry.thread_id = (int32)t;
+                entry.core_id = (int32)c;
+                entry.tile_id = (int32)(s * coresPerSocket + c);
+                entry.die_id = 0;
+                entry.socket = (int32)s;
+            }
+        }
+    }
+}
+
+void SimulatedHardware::cpuid(const uint32 leaf, const uint32 subleaf, PCM_CPUID_INFO & info) const
+{
+    std::fill(info.array, info.array + 4, 0);
+    uint32 smtShift = 0, coreShift = 0;
+    while ((1U << smtShift) < threadsPerCore) ++smtShift;
+    while ((1U << coreShift) < coresPerSocket) ++coreShift;
+    switch (leaf)
+    {
+    case 0:
+        info.reg.eax = 0x16;
+        std::memcpy(&info.reg.ebx, "Genu", 4);
+        std::memcpy(&info.reg.edx, "ineI", 4);
+        std::memcpy(&info.reg.ecx, "ntel", 4);
+        break;
+    case 1:
+        info.reg.eax = 0x50654; // family 6, model 0x55 (Skylake-SP), stepping 4
+        info.reg.ebx = (std::min)(coresPerSocket * threadsPerCore, 255U) << 16;
+        info.reg.edx = 1U << 4; // TSC
+        break;
+    case 4:
+        if (subleaf == 2) info.reg.eax = ((threadsPerCore - 1) << 14) + (2 << 5) + 3; // unified L2 shared by the threads of a core
+        break;
+    case 0xa:
+        info.reg.eax = 4 + ((threadsPerCore > 1 ? 4 : 8) << 8) + (48 << 16) + (7 << 24); // perfmon v4, 48-bit counters
+        info.reg.edx = 3 + (48 << 5);
+        break;
+    case 0xb:
+        if (subleaf == 0)
+        {
+            info.reg.eax = smtShift;
+            info.reg.ebx = threadsPerCore;
+            info.reg.ecx = 1 << 8;
+        }
+        else if (subleaf == 1)
+        {
+            info.reg.eax = smtShift + coreShift;
+            info.reg.ebx = coresPerSocket * threadsPerCore;
+            info.reg.ecx = (2 << 8) + 1;
+        }
+        break;
+    case 0x16:
+        info.reg.eax = nominalRatio * 100;
+        info.reg.ebx = nominalRatio * 100;
+        info.reg.ecx = 100;
+        break;
+    case 0x80000000:
+        info.reg.eax = 0x80000004;
+        break;
+    case 0x80000002:
+    case 0x80000003:
+    case 0x80000004:
+        {
+            static const char brand[48] = "Intel(R) Xeon(R) CPU (simulated) @ 2.00GHz"; // nominalRatio
+            std::memcpy(info.array, brand + 16 * (leaf - 0x80000002), 16);
+        }
+        break;
+    }
+}
+
+double SimulatedHardware::eventRate(const BoxKind kind, const uint64 ctl) const
+{
+    const uint32 event = (uint32)extract_bits(ctl, 0, 7), umask = (uint32)extract_bits(ctl, 8, 15);
+    const double coreCyclesHz = busyFraction * nominalHz();
+    switch (kind)
+    {
+    case CoreBox:
+        if (event == 0x3c) return coreCyclesHz;                        // CPU_CLK_UNHALTED
+        if (event == 0xc0) return instructionsPerCycle * coreCyclesHz; // INST_RETIRED
+        break;
+    case IMCBox:
+        if (event == 0x04) // CAS_COUNT
+        {
+            return ((umask & 0x03) ? readCASPerSecond : 0.) + ((umask & 0x0c) ? writeCASPerSecond : 0.);
+        }
+        break;
+    case UPIBox:
+        switch (event)
+        {
+        case 0x01: // CLOCKTICKS
+        case 0x26: // TxL0_POWER_CYCLES
+            return upiClockHz;
+        case 0x21: // L1_POWER_CYCLES
+        case 0x27: // TxL0P_POWER_CYCLES
+            return 0.;
+        case 0x02: // TxL_FLITS
+        case 0x03: // RxL_FLITS
+            return 0.2 * upiClockHz;
+        }
+        break;
+    case CHABox:
+    case M2MBox:
+    case PCUBox:
+        if (event == 0) return uncoreRatio * 100e6; // CLOCKTICKS
+        break;
+    default:
+        break;
+    }
+    // any other event: between 1 and 100 million per second, derived from the event code
+    return 1e6 * double(1 + (event * 131 + umask * 17) % 100);
+}
+
+double SimulatedHardware::rate(const RegisterFile & f, const CounterDef & d) const
+{
+    const BoxDef & box = f.layout->boxes[d.box];
+    if (box.ctl)
+    {
+        const uint64 boxCtl = f.get(box.ctl);
+        if ((boxCtl & box.freeze) || (d.boxEnable && (boxCtl & d.boxEnable) == 0))
+        {
+            return 0.;
+        }
+    }
+    if (d.ctl == 0)
+    {
+        return d.fixedRate;
+    }
+    const uint64 ctl = f.get(d.ctl);
+    if ((ctl & d.ctlEnable) == 0)
+    {
+        return 0.;
+    }
+    return (d.fixedRate > 0.) ? d.fixedRate : eventRate(d.kind, ctl);
+}
+
+const SimulatedHardware::Trace * SimulatedHardware::findTrace(const RegisterFile & f, const bool pci, const uint64 address) const
+{
+    if (traces.empty())
+    {
+        return nullptr;
+    }
+    for (const int32 scope : { f.traceScope, -1 })
+    {
+        const auto t = traces.find(TraceKey(pci, scope, f.traceDevFn + address));
+        if (t != traces.end()) return &(t->second);
+    }
+    return nullptr;
+}
+
+uint64 SimulatedHardware::counterValue(RegisterFile & f, const uint64 address, const CounterDef & d, const Trace * trace, const double t)
+{
+    const CounterState & s = f.counters[address];
+    const double delta = trace ? (trace->at(t) - trace->at(s.since)) : rate(f, d) * (t - s.since);
+    return (s.base + (uint64)(std::max)(delta, 0.)) & d.mask;
+}
+
+void SimulatedHardware::setCounter(RegisterFile & f, const uint64 address, const uint64 value, const double t)
+{
+    CounterState & s = f.counters[address];
+    s.base = value & f.layout->counters.at(address).mask;
+    s.since = t;
+}
+
+uint64 SimulatedHardware::read(RegisterFile & f, const bool pci, const uint64 address, const double t)
+{
+    const auto c = f.layout->counters.find(address);
+    const Trace * trace = findTrace(f, pci, address);
+    if (c != f.layout->counters.end())
+    {
+        return counterValue(f, address, c->second, trace, t);
+    }
+    return trace ? (uint64)trace->at(t) : f.get(address);
+}
+
+void SimulatedHardware::writeControl(RegisterFile & f, const uint32 box, const uint64 address, const uint64 value, const bool pci, const double t)
+{
+    const BoxDef & b = f.layout->boxes[box];
+    // the counters advance with the old settings until now
+    for (const auto ctr : b.counters)
+    {
+        setCounter(f, ctr, counterValue(f, ctr, f.layout->counters.at(ctr), findTrace(f, pci, ctr), t), t);
+    }
+    f.values[address] = value;
+    if (address == b.ctl)
+    {
+        for (const auto ctr : b.counters)
+        {
+            if (value & b.resetCounters) setCounter(f, ctr, 0, t);
+            const auto ctl = f.layout->counters.at(ctr).ctl;
+            if ((value & b.resetControls) && ctl) f.values[ctl] = 0;
+        }
+    }
+}
+
+int32 SimulatedHardware::readMSR(const uint32 cpu, const uint64 address, uint64 * value)
+{
+    if (cpu >= cpus.size()) return 0;
+    RegisterFile & f = *cpus[cpu];
+    std::lock_guard<std::mutex> _(f.mutex);
+    *value = read(f, false, address, now());
+    return sizeof(uint64);
+}
+
+int32 SimulatedHardware::writeMSR(const uint32 cpu, const uint64 address, const uint64 value)
+{
+    if (cpu >= cpus.size()) return 0;
+    RegisterFile & f = *cpus[cpu];
+    std::lock_guard<std::mutex> _(f.mutex);
+    const double t = now();
+    if (f.layout->readOnly.count(address))
+    {
+        // ignored
+    }
+    else if (f.layout->counters.count(address))
+    {
+        setCounter(f, address, value, t);
+    }
+    else
+    {
+        const auto control = f.layout->controls.find(address);
+        if (control != f.layout->controls.end())
+        {
+            writeControl(f, control->second, address, value, false, t);
+        }
+        else
+        {
+            f.values[address] = value;
+        }
+    }
+    return sizeof(uint64);
+}
+
+bool SimulatedHardware::pciExists(const uint32 group, const uint32 bus, const uint32 device, const uint32 function) const
+{
+    return group == 0 && bus < 256 && device < 32 && function < 8 && pciFunctions.count((bus << 8) + (device << 3) + function) > 0;
+}
+
+uint32 SimulatedHardware::readPCIDword(PciFunction & fn, const uint64 offset, const double t)
+{
+    // counters are 64-bit registers read as two dwords
+    const auto c = fn.regs.layout->counters.find(offset & ~7ULL);
+    if (c != fn.regs.layout->counters.end())
+    {
+        const uint64 value = counterValue(fn.regs, c->first, c->second, findTrace(fn.regs, true, c->first), t);
+        return (offset & 4) ? uint32(value >> 32) : uint32(value);
+    }
+    if (offset == PCM_PCI_VENDOR_ID_OFFSET)
+    {
+        return PCM_INTEL_PCI_VENDOR_ID + (fn.deviceId << 16);
+    }
+    return (uint32)read(fn.regs, true, offset, t);
+}
+
+void SimulatedHardware::writePCIDword(PciFunction & fn, const uint64 offset, const uint32 value, const double t)
+{
+    RegisterFile & f = fn.regs;
+    const auto c = f.layout->counters.find(offset & ~7ULL);
+    if (c != f.layout->counters.end())
+    {
+        const uint64 old = counterValue(f, c->first, c->second, findTrace(f, true, c->first), t);
+        setCounter(f, c->first, (offset & 4) ? ((old & 0xffffffffULL) + (uint64(value) << 32)) : ((old & ~0xffffffffULL) + value), t);
+        return;
+    }
+    const auto control = f.layout->controls.find(offset);
+    if (control != f.layout->controls.end())
+    {
+        writeControl(f, control->second, offset, value, true, t);
+        return;
+    }
+    if (offset != PCM_PCI_VENDOR_ID_OFFSET)
+    {
+        f.values[offset] = value;
+    }
+}
+
+int32 SimulatedHardware::readPCI(const uint32 bus, const uint32 device, const uint32 function, const uint64 offset, void * buffer, const uint32 size)
+{
+    const auto fn = pciFunctions.find((bus << 8) + (device << 3) + function);
+    if (fn == pciFunctions.end() || (offset % sizeof(uint32)) || (size % sizeof(uint32)))
+    {
+        return 0;
+    }
+    std::lock_guard<std::mutex> _(fn->second->regs.mutex);
+    const double t = now();
+    uint32 * dwords = (uint32 *)buffer;
+    for (uint32 i = 0; i < size / sizeof(uint32); ++i)
+    {
+        dwords[i] = readPCIDword(*fn->second, offset + i * sizeof(uint32), t);
+    }
+    return (int32)size;
+}
+
+int32 SimulatedHardware::writePCI(const uint32 bus, const uint32 device, const uint32 function, const uint64 offset, const void * buffer, const uint32 size)
+{
+    const auto fn = pciFunctions.find((bus << 8) + (device << 3) + function);
+    if (fn == pciFunctions.end() || (offset % sizeof(uint32)) || (size % sizeof(uint32)))
+    {
+        return 0;
+    }
+    std::lock_guard<std::mutex> _(fn->second->regs.mutex);
+    const double t = now();
+    const uint32 * dwords = (const uint32 *)buffer;
+    for (uint32 i = 0; i < size / sizeof(uint32); ++i)
+    {
+        writePCIDword(*fn->second, offset + i * sizeof(uint32), dwords[i], t);
+    }
+    return (int32)size;
+}
+
+#ifdef __linux__
+bool simulatedCPUID(const unsigned leaf, const unsigned subleaf, PCM_CPUID_INFO & info)
+{
+    const auto sim = SimulatedHardware::get();
+    if (sim == nullptr)
+    {
+        return false;
+    }
+    sim->cpuid(leaf, subleaf, info);
+    return true;
+}
+#endif
+
+} // namespace pcm
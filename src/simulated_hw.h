@@ -0,0 +1,160 @@
+// SPDX-License-Identifier: BSD-3-Clause
+// Copyright (c) 2024, Intel Corporation
+
+#pragma once
+
+/*!     \file simulated_hw.h
+        \brief Simulated processor registers for testing PCM at scale without real PMUs
+*/
+
+#include "types.h"
+#include <chrono>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <tuple>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace pcm
+{
+
+struct TopologyEntry;
+
+/*! \brief Register level simulation of a multi-socket Intel Xeon Scalable (Skylake-SP) server
+
+    Enabled on Linux with PCM_SIMULATE=<sockets>x<cores per socket>x<threads per core>[,imc=<channels>][,upi=<links>][,iio=<stacks>].
+    CPUID, the CPU topology, the MSRs of all logical cores and the PCI configuration space of the
+    uncore PMU devices (memory controller channels, M2M, UPI and M3UPI links) are then answered from
+    memory instead of the hardware, so PCM tools run unmodified with any topology on any machine.
+
+    Control registers keep the written values. Enabled counters advance with the time since the
+    start of the process at a fixed rate that depends on the programmed event (box freeze, reset and
+    enable bits are honored), or replay a recorded trace given with PCM_SIMULATE_TRACE=<file>:
+        <seconds> msr <cpu|*> <address> <value>
+        <seconds> pci <socket|*> <device>.<function> <offset> <value>
+    The value of a traced register is interpolated linearly between the samples and extrapolated
+    with the slope of the last two samples.
+
+    MMIO ranges (MMIORange), PMT telemetry (TelemetryArray*) and TPMI (TPMIHandle*) are not
+    simulated: Skylake-SP does not use them for the emulated PMUs. tests/simulate.sh runs pcm,
+    pcm-memory and pcm-raw on the simulator; pcm-sensor-server is not covered.
+*/
+class SimulatedHardware
+{
+public:
+    //! \brief Returns the simulator or nullptr if the simulation is not enabled (always nullptr on other OSes than Linux)
+    static SimulatedHardware * get();
+
+    uint32 getNumSockets() const { return numSockets; }
+    uint32 getNumCPUs() const { return numSockets * coresPerSocket * threadsPerCore; }
+    //! \brief Fills one entry per logical core, indexed by OS id
+    void getTopology(std::vector<TopologyEntry> & topology) const;
+
+    void cpuid(const uint32 leaf, const uint32 subleaf, PCM_CPUID_INFO & info) const;
+
+    //! \return number of bytes read/written like the MSR driver, 0 for an invalid core
+    int32 readMSR(const uint32 cpu, const uint64 address, uint64 * value);
+    int32 writeMSR(const uint32 cpu, const uint64 address, const uint64 value);
+
+    bool pciExists(const uint32 group, const uint32 bus, const uint32 device, const uint32 function) const;
+    //! \brief Accesses size bytes (a multiple of 4) of configuration space at a dword aligned offset
+    //! \return number of bytes read/written
+    int32 readPCI(const uint32 bus, const uint32 device, const uint32 function, const uint64 offset, void * buffer, const uint32 size);
+    int32 writePCI(const uint32 bus, const uint32 device, const uint32 function, const uint64 offset, const void * buffer, const uint32 size);
+
+private:
+    enum BoxKind { CoreBox, FreeRunning, CHABox, IIOBox, PCUBox, UBOXBox, IMCBox, M2MBox, UPIBox, M3UPIBox };
+
+    struct CounterDef
+    {
+        BoxKind kind = FreeRunning;
+        uint32 box = 0;          // index in Layout::boxes
+        uint64 ctl = 0;          // event select register, 0 for free-running counters
+        uint64 ctlEnable = 0;    // bits of the event select register that enable counting
+        uint64 boxEnable = 0;    // bits of the box control register that enable counting (global control of the core PMU)
+        uint64 mask = ~0ULL;     // counter width
+        double fixedRate = 0.;   // events per second of free-running and fixed function counters
+    };
+    struct BoxDef
+    {
+        uint64 ctl = 0;          // box control register, 0 if none
+        uint64 initial = 0;      // value of the box control register after reset
+        uint64 freeze = 0;       // bits of the box control register that stop all counters
+        uint64 resetCounters = 0;
+        uint64 resetControls = 0;
+        std::vector<uint64> counters;
+    };
+    //! \brief Register map shared by all MSR or PCI register files of the same kind
+    struct Layout
+    {
+        std::unordered_map<uint64, CounterDef> counters;  // by counter address
+        std::unordered_map<uint64, uint32> controls;      // box index by event select and box control address
+        std::unordered_map<uint64, uint64> readOnly;      // static identification and status registers
+        std::vector<BoxDef> boxes;
+        uint32 addBox(const uint64 boxCtl, const uint64 initial, const uint64 freeze, const uint64 resetCounters, const uint64 resetControls);
+        void addCounter(const uint32 box, const BoxKind kind, const uint64 ctr, const uint64 ctl, const uint64 ctlEnable, const uint64 boxEnable, const uint32 width, const double fixedRate = 0.);
+    };
+    struct CounterState
+    {
+        uint64 base = 0;   // value at time 'since'
+        double since = 0.;
+    };
+    //! \brief Registers of one logical core (MSRs) or one PCI function (dwords by offset)
+    struct RegisterFile
+    {
+        std::mutex mutex;
+        const Layout * layout = nullptr;
+        int32 traceScope = -1;   // core for MSR traces, socket for PCI traces
+        uint64 traceDevFn = 0;
+        std::unordered_map<uint64, uint64> values;
+        std::unordered_map<uint64, CounterState> counters;
+        uint64 get(const uint64 address) const;
+    };
+    struct PciFunction
+    {
+        uint32 deviceId = 0;
+        RegisterFile regs;
+    };
+    struct Trace
+    {
+        std::vector<std::pair<double, double> > samples; // (seconds, value) sorted by time
+        double at(const double t) const;
+    };
+    typedef std::tuple<bool, int32, uint64> TraceKey; // (PCI, core or socket or -1 for all, address | device/function << 32)
+
+    uint32 numSockets = 1, coresPerSocket = 1, threadsPerCore = 1;
+    uint32 imcChannels = 6, upiLinks = 3, iioStacks = 6;
+    const uint32 nominalRatio = 20;  // 2.0 GHz
+    const uint32 uncoreRatio = 24;
+    const std::chrono::steady_clock::time_point start;
+
+    Layout cpuLayout, imcLayout, m2mLayout, upiLayout, m3upiLayout;
+    std::vector<std::unique_ptr<RegisterFile> > cpus;
+    std::map<uint32, std::unique_ptr<PciFunction> > pciFunctions; // by bus << 8 | device << 3 | function
+    std::map<TraceKey, Trace> traces;
+
+    SimulatedHardware(const std::string & config, const std::string & traceFile);
+    SimulatedHardware(const SimulatedHardware &) = delete;
+    SimulatedHardware & operator = (const SimulatedHardware &) = delete;
+
+    void buildCPULayout();
+    void buildPCILayouts();
+    void addPCIFunction(const uint32 socket, const uint32 bus, const uint32 device, const uint32 function, const uint32 deviceId, const Layout & layout);
+    void loadTrace(const std::string & fileName);
+    double now() const { return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count(); }
+    double nominalHz() const { return nominalRatio * 100e6; }
+    double eventRate(const BoxKind kind, const uint64 ctl) const;
+    double rate(const RegisterFile & f, const CounterDef & d) const;
+    const Trace * findTrace(const RegisterFile & f, const bool pci, const uint64 address) const;
+    uint64 counterValue(RegisterFile & f, const uint64 address, const CounterDef & d, const Trace * trace, const double t);
+    void setCounter(RegisterFile & f, const uint64 address, const uint64 value, const double t);
+    uint64 read(RegisterFile & f, const bool pci, const uint64 address, const double t);
+    void writeControl(RegisterFile & f, const uint32 box, const uint64 address, const uint64 value, const bool pci, const double t);
+    uint32 readPCIDword(PciFunction & fn, const uint64 offset, const double t);
+    void writePCIDword(PciFunction & fn, const uint64 offset, const uint32 value, const double t);
+};
+
+} // namespace pcm
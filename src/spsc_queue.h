@@ -0,0 +1,98 @@
+// SPDX-License-Identifier: BSD-3-Clause
+// Copyright (c) 2024, Intel Corporation
+
+#pragma once
+
+/*!     \file spsc_queue.h
+        \brief Bounded lock-free single-producer single-consumer queue
+*/
+
+#include <vector>
+#include <atomic>
+#include <assert.h>
+#include "types.h"
+
+namespace pcm {
+
+/*! \brief Bounded lock-free queue for one producer thread and one consumer thread
+
+    The slots are allocated once in the constructor and reused, so pushing an element that
+    reuses its storage on assignment (e.g. a vector of the same size) does not allocate.
+    Neither side ever blocks: tryPush fails when the queue is full, tryPop when it is empty.
+*/
+template <class T>
+class SPSCQueue
+{
+    std::vector<T> slots;
+    const size_t mask;
+    alignas(64) std::atomic<size_t> head{0}; // next slot to pop, written by the consumer
+    alignas(64) std::atomic<size_t> tail{0}; // next slot to push, written by the producer
+
+    SPSCQueue() = delete;
+    SPSCQueue(const SPSCQueue &) = delete;
+    SPSCQueue & operator = (const SPSCQueue &) = delete;
+
+    static size_t roundUpToPowerOfTwo(size_t n)
+    {
+        size_t result = 1;
+        while (result < n) result <<= 1;
+        return result;
+    }
+public:
+    //! \param capacity minimum number of elements the queue can hold (rounded up to a power of two)
+    //! \param prototype initial value of the slots (e.g. preallocated vectors)
+    explicit SPSCQueue(const size_t capacity, const T & prototype = T()) :
+        slots(roundUpToPowerOfTwo(capacity < 2 ? 2 : capacity), prototype),
+        mask(slots.size() - 1)
+    {
+    }
+
+    size_t capacity() const { return slots.size(); }
+
+    //! producer side: copies value into the queue, returns false if the queue is full
+    bool tryPush(const T & value)
+    {
+        const size_t t = tail.load(std::memory_order_relaxed);
+        if (t - head.load(std::memory_order_acquire) == slots.size())
+        {
+            return false;
+        }
+        slots[t & mask] = value;
+        tail.store(t + 1, std::memory_order_release);
+        return true;
+    }
+
+    //! producer side: exchanges value with a free slot, returns false if the queue is full
+    //! value receives the storage of a previously popped element, so buffers circulate without allocations
+    bool tryPushSwap(T & value)
+    {
+        const size_t t = tail.load(std::memory_order_relaxed);
+        if (t - head.load(std::memory_order_acquire) == slots.size())
+        {
+            return false;
+        }
+        std::swap(slots[t & mask], value);
+        tail.store(t + 1, std::memory_order_release);
+        return true;
+    }
+
+    //! consumer side: moves the oldest element into value, returns false if the queue is empty
+    bool tryPop(T & value)
+    {
+        const size_t h = head.load(std::memory_order_relaxed);
+        if (h == tail.load(std::memory_order_acquire))
+        {
+            return false;
+        }
+        std::swap(value, slots[h & mask]);
+        head.store(h + 1, std::memory_order_release);
+        return true;
+    }
+
+    bool empty() const
+    {
+        return head.load(std::memory_order_acquire) == tail.load(std::memory_order_acquire);
+    }
+};
+
+} // namespace pcm
@@ -9,8 +9,10 @@
 #include <vector>
 #include <unordered_map>
 #include <assert.h>
-#ifdef __linux__
 #include <algorithm>
+#ifdef __linux__
+#include <unistd.h>
+#include <fcntl.h>
 #endif
 
 namespace pcm {
@@ -18,6 +20,7 @@ namespace pcm {
 constexpr uint32 TPMIInvalidValue = ~0U;
 
 bool TPMIverbose = false;
+bool TPMIprobing = false; // suppresses error messages while checking if direct MMIO access is permitted
 
 class PFSInstances
 {
@@ -60,8 +63,11 @@ public:
                 mmio_memcpy(&(pfsArray[0]), bar + vsec.fields.Address, vsec.fields.NumEntries * sizeof(PFS), true, true);
             } catch (std::runtime_error & e)
             {
-                std::cerr << "Can't read PFS\n";
-                std::cerr << e.what();
+                if (TPMIprobing == false)
+                {
+                    std::cerr << "Can't read PFS\n";
+                    std::cerr << e.what();
+                }
             }
             PFSInstancesSingletonInit->push_back(PFSMapType());
             for (const auto & pfs : pfsArray)
@@ -136,6 +142,7 @@ class TPMIHandleMMIO : public TPMIHandleInterface
     std::vector<Entry> entries;
 public:
     static size_t getNumInstances();
+    static bool isAvailable();
     static void setVerbose(const bool);
     TPMIHandleMMIO(const size_t instance_, const size_t ID_, const size_t offset_, const bool readonly_ = true);
     size_t getNumEntries() const override
@@ -151,6 +158,44 @@ size_t TPMIHandleMMIO::getNumInstances()
     return PFSInstances::get().size();
 }
 
+bool TPMIHandleMMIO::isAvailable()
+{
+    static int available = -1;
+    if (available < 0)
+    {
+        // direct access is permitted if a valid entry can be read through the MMIO mapping
+        auto probe = []()
+        {
+            for (const auto & pfsInstance : PFSInstances::get())
+            {
+                for (const auto & id : pfsInstance)
+                {
+                    for (const auto addr : id.second)
+                    {
+                        uint32 reg0 = TPMIInvalidValue;
+                        mmio_memcpy(&reg0, addr, sizeof(uint32), false, true);
+                        if (reg0 != TPMIInvalidValue)
+                        {
+                            return true;
+                        }
+                    }
+                }
+            }
+            return false;
+        };
+        TPMIprobing = true;
+        try {
+            available = probe() ? 1 : 0;
+        }
+        catch (std::exception &)
+        {
+            available = 0;
+        }
+        TPMIprobing = false;
+    }
+    return available > 0;
+}
+
 void TPMIHandle::setVerbose(const bool v)
 {
     TPMIverbose = v;
@@ -185,6 +230,13 @@ void TPMIHandleMMIO::write64(size_t entryPos, uint64 val)
 }
 
 #ifdef __linux__
+/*
+    TPMI access through the Linux intel_tpmi debugfs interface. The mem_dump file is a text dump of
+    all entries. It is parsed once into an index that stores for each valid entry where the two
+    32-bit words of the requested register are in the text. A read then fetches only these few bytes
+    with pread and converts two hex numbers instead of parsing the whole dump. If the layout of the
+    dump has changed (validation of the fetched text fails) the index is rebuilt.
+*/
 class TPMIHandleDriver : public TPMIHandleInterface
 {
     TPMIHandleDriver(const TPMIHandleDriver&) = delete;
@@ -198,122 +250,202 @@ class TPMIHandleDriver : public TPMIHandleInterface
     const size_t ID;
     const size_t offset;
     // const bool readonly; // not used
-    size_t nentries;
-    struct TPMIEntry {
-        unsigned int offset{0};
-        std::vector<uint32> data;
+    int fd;
+    // location of a hex number in the dump text
+    struct ValueLocation
+    {
+        size_t pos{0};
+        size_t len{0};
+    };
+    // valid entry: index of the entry in the dump (for mem_write) and location of the low and high 32-bit words
+    struct IndexEntry
+    {
+        size_t entry{0};
+        ValueLocation low, high;
     };
+    std::vector<IndexEntry> index;
+    std::vector<char> buffer;
 
-    size_t findValidIndex(const std::vector<TPMIEntry> & entries, const size_t & entryPos)
+    void readAll(std::vector<char> & text)
     {
-        size_t validIndex = 0;
-        for (size_t i = 0; i < entries.size(); ++i)
+        text.clear();
+        char chunk[4096];
+        ssize_t len = 0;
+        off_t pos = 0;
+        while ((len = ::pread(fd, chunk, sizeof(chunk), pos)) > 0)
+        {
+            text.insert(text.end(), chunk, chunk + len);
+            pos += len;
+        }
+    }
+    static bool isHex(const char c)
+    {
+        return (c >= '0' && c <= '9') || (c >= 'a' && c <= 'f') || (c >= 'A' && c <= 'F');
+    }
+    static bool parseHex(const char * str, const size_t len, uint32 & value)
+    {
+        value = 0;
+        for (size_t i = 0; i < len; ++i)
+        {
+            const char c = str[i];
+            if (isHex(c) == false)
+            {
+                return false;
+            }
+            value = (value << 4) | uint32((c <= '9') ? (c - '0') : ((c | 0x20) - 'a' + 10));
+        }
+        return len > 0;
+    }
+    /*
+        mem_dump format:
+        TPMI Instance:<n> offset:<hex offset>
+        <address> <hex value> <hex value> ...
+    */
+    void buildIndex()
+    {
+        index.clear();
+        std::vector<char> text;
+        readAll(text);
+        const size_t i4 = offset / 4;
+        const char * const begin = text.data();
+        const char * const end = text.data() + text.size();
+        const char * p = begin;
+        bool inEntry = false;
+        size_t word = 0;
+        bool valid = false;
+        IndexEntry current;
+        auto finishEntry = [&]()
+        {
+            if (inEntry && valid && word > i4 + 1)
+            {
+                index.push_back(current);
+            }
+        };
+        while (p < end)
         {
-            if (entries[i].data.empty() || entries[i].data[0] == TPMIInvalidValue)
+            const char * eol = std::find(p, end, '\n');
+            const std::string header("TPMI Instance:");
+            if (size_t(eol - p) >= header.size() && std::equal(header.begin(), header.end(), p))
             {
-                // invalid, skip it
-                continue;
+                finishEntry();
+                inEntry = true;
+                word = 0;
+                valid = false;
+                current = IndexEntry();
+                current.entry = (size_t)atoi(std::string(p + header.size(), eol).c_str());
             }
-            if (validIndex == entryPos)
+            else if (inEntry)
             {
-                // found the right instance
-                return i;
+                // skip the address part (first token of the line)
+                const char * t = p;
+                while (t < eol && (*t == ' ' || *t == '\t')) ++t;
+                while (t < eol && *t != ' ' && *t != '\t') ++t;
+                while (t < eol)
+                {
+                    while (t < eol && (*t == ' ' || *t == '\t')) ++t;
+                    const char * tokenEnd = t;
+                    while (tokenEnd < eol && isHex(*tokenEnd)) ++tokenEnd;
+                    if (tokenEnd == t)
+                    {
+                        break;
+                    }
+                    uint32 value = 0;
+                    parseHex(t, tokenEnd - t, value);
+                    if (word == 0)
+                    {
+                        valid = (value != TPMIInvalidValue);
+                    }
+                    if (word == i4 || word == i4 + 1)
+                    {
+                        auto & loc = (word == i4) ? current.low : current.high;
+                        loc.pos = t - begin;
+                        loc.len = tokenEnd - t;
+                    }
+                    ++word;
+                    t = tokenEnd;
+                }
             }
-            ++validIndex;
+            p = (eol == end) ? end : eol + 1;
         }
-        assert(0 && "TPMIHandleDriver: entryPos not found");
-        return 0;
+        finishEntry();
     }
-    std::vector<TPMIEntry> readTPMIFile(std::string filePath)
+    bool readValue(const IndexEntry & e, uint64 & result)
     {
-        filePath += "/mem_dump";
-        std::vector<TPMIEntry> entries;
-        std::ifstream file(filePath);
-        std::string line;
-
-        if (!file.is_open()) {
-            std::cerr << "Error opening file: " << filePath << std::endl;
-            return entries;
+        const size_t first = (std::min)(e.low.pos, e.high.pos);
+        const size_t last = (std::max)(e.low.pos + e.low.len, e.high.pos + e.high.len);
+        // one more byte to check the end of the number
+        buffer.resize(last - first + 1);
+        const ssize_t len = ::pread(fd, buffer.data(), buffer.size(), (off_t)first);
+        if (len < (ssize_t)(last - first))
+        {
+            return false;
         }
-
-        TPMIEntry currentEntry;
-        while (getline(file, line)) {
-            if (line.find("TPMI Instance:") != std::string::npos) {
-                // If we have a previous instance, push it back to the vector
-                if (!currentEntry.data.empty()) {
-                    entries.push_back(currentEntry);
-                    currentEntry.data.clear();
-                }
-
-                std::istringstream iss(line);
-                std::string temp;
-                iss >> temp >> temp >> temp; // Skip "TPMI Instance:"
-                iss >> temp; // Skip entry number
-                iss >> temp >> std::hex >> currentEntry.offset; // Read offset
-            } else {
-                std::istringstream iss(line);
-                std::string address;
-                iss >> address; // Skip the address part
-
-                uint32_t value;
-                while (iss >> std::hex >> value) {
-                    currentEntry.data.push_back(value);
-                }
+        auto fetch = [&](const ValueLocation & loc, uint32 & value)
+        {
+            const size_t rel = loc.pos - first;
+            if (rel + loc.len < (size_t)len && isHex(buffer[rel + loc.len]))
+            {
+                return false; // the number got longer: the layout has changed
             }
+            return parseHex(buffer.data() + rel, loc.len, value);
+        };
+        cvt_ds out;
+        if (fetch(e.low, out.ui32.low) && fetch(e.high, out.ui32.high))
+        {
+            result = out.ui64;
+            return true;
         }
-
-        // Push the last instance if it exists
-        if (!currentEntry.data.empty()) {
-            entries.push_back(currentEntry);
-        }
-
-        return entries;
+        return false;
     }
 public:
     static size_t getNumInstances();
     TPMIHandleDriver(const size_t instance_, const size_t ID_, const size_t offset_, const bool /* readonly_ */ = true) :
         instance(instance_),
         ID(ID_),
-        offset(offset_),
+        offset(offset_)
         // readonly(readonly_), // not used
-        nentries(0)
     {
         assert(available > 0);
         assert(instance < getNumInstances());
-        const auto entries = readTPMIFile(AllIDPaths[instance][ID]);
-        for (auto & e: entries)
+        const auto filePath = AllIDPaths[instance][ID] + "/mem_dump";
+        fd = ::open(filePath.c_str(), O_RDONLY);
+        if (fd < 0)
         {
-            if (e.data.empty() == false && e.data[0] != TPMIInvalidValue)
-            {
-                // count valid entries
-                ++nentries;
-            }
+            std::cerr << "Error opening file: " << filePath << std::endl;
+            throw std::runtime_error("TPMIHandleDriver: can not open " + filePath);
         }
+        buildIndex();
+    }
+    ~TPMIHandleDriver()
+    {
+        ::close(fd);
     }
     size_t getNumEntries() const override
     {
         assert(available > 0);
-        return nentries;
+        return index.size();
     }
     uint64 read64(size_t entryPos) override
     {
         assert(available > 0);
-        assert(instance < getNumInstances());
-        const auto entries = readTPMIFile(AllIDPaths[instance][ID]);
-        size_t i = findValidIndex(entries, entryPos);
-        cvt_ds result;
-        const auto i4 = offset / 4;
-        assert(i4 + 1 < entries[i].data.size());
-        result.ui32.low = entries[i].data[i4];
-        result.ui32.high = entries[i].data[i4 + 1];
-        return result.ui64;
+        assert(entryPos < index.size());
+        uint64 result = 0;
+        if (readValue(index[entryPos], result) == false)
+        {
+            buildIndex();
+            if (entryPos >= index.size() || readValue(index[entryPos], result) == false)
+            {
+                std::cerr << "Error reading TPMI entry " << entryPos << " from " << AllIDPaths[instance][ID] << "/mem_dump\n";
+                return ~0ULL;
+            }
+        }
+        return result;
     }
     void write64(size_t entryPos, uint64 val) override
     {
         assert(available > 0);
-        assert(instance < getNumInstances());
-        const auto entries = readTPMIFile(AllIDPaths[instance][ID]);
-        size_t i = findValidIndex(entries, entryPos);
+        assert(entryPos < index.size());
+        const auto i = index[entryPos].entry;
         cvt_ds out;
         out.ui64 = val;
         const auto path = AllIDPaths[instance][ID] + "/mem_write";
@@ -376,13 +508,31 @@ size_t TPMIHandleDriver::getNumInstances()
 
 #endif
 
+// the direct MMIO path is much cheaper than the driver interface: use the driver only if MMIO is not permitted
+static bool useTPMIDriver()
+{
+#ifdef __linux__
+    static int use = -1;
+    if (use < 0)
+    {
+        use = 0;
+        if (TPMIHandleDriver::getNumInstances())
+        {
+            use = (safe_getenv("PCM_USE_TPMI_DRIVER") == std::string("1") || TPMIHandleMMIO::isAvailable() == false) ? 1 : 0;
+        }
+    }
+    return use == 1;
+#else
+    return false;
+#endif
+}
+
 size_t TPMIHandle::getNumInstances()
 {
     #ifdef __linux__
-    const auto tpmiNInstances = TPMIHandleDriver::getNumInstances();
-    if (tpmiNInstances)
+    if (useTPMIDriver())
     {
-        return tpmiNInstances;
+        return TPMIHandleDriver::getNumInstances();
     }
     #endif
     return TPMIHandleMMIO::getNumInstances();
@@ -391,8 +541,7 @@ size_t TPMIHandle::getNumInstances()
 TPMIHandle::TPMIHandle(const size_t instance_, const size_t ID_, const size_t requestedRelativeOffset, const bool readonly_)
 {
     #ifdef __linux__
-    const auto tpmiNInstances = TPMIHandleDriver::getNumInstances();
-    if (tpmiNInstances)
+    if (useTPMIDriver())
     {
         impl = std::make_shared<TPMIHandleDriver>(instance_, ID_, requestedRelativeOffset, readonly_);
         return;
@@ -1627,12 +1627,20 @@ union PCM_CPUID_INFO
     struct { unsigned int eax, ebx, ecx, edx; } reg;
 };
 
+#ifdef __linux__
+// answers CPUID from the simulated hardware if PCM_SIMULATE is set (simulated_hw.cpp)
+bool simulatedCPUID(const unsigned leaf, const unsigned subleaf, PCM_CPUID_INFO & info);
+#endif
+
 inline void pcm_cpuid(int leaf, PCM_CPUID_INFO& info)
 {
 #ifdef _MSC_VER
     // version for Windows
     __cpuid(info.array, leaf);
 #else
+#ifdef __linux__
+    if (simulatedCPUID((unsigned)leaf, 0, info)) return;
+#endif
     __asm__ __volatile__("cpuid" : \
         "=a" (info.reg.eax), "=b" (info.reg.ebx), "=c" (info.reg.ecx), "=d" (info.reg.edx) : "a" (leaf));
 #endif
@@ -1644,6 +1652,9 @@ inline void pcm_cpuid(const unsigned leaf, const unsigned subleaf, PCM_CPUID_INF
     #ifdef _MSC_VER
     __cpuidex(info.array, leaf, subleaf);
     #else
+    #ifdef __linux__
+    if (simulatedCPUID(leaf, subleaf, info)) return;
+    #endif
     __asm__ __volatile__ ("cpuid" : \
                           "=a" (info.reg.eax), "=b" (info.reg.ebx), "=c" (info.reg.ecx), "=d" (info.reg.edx) : "a" (leaf), "c" (subleaf));
     #endif
@@ -0,0 +1,199 @@
+// SPDX-License-Identifier: BSD-3-Clause
+// Copyright (c) 2024, Intel Corporation
+
+#pragma once
+
+/*!     \file uncore_multiplexer.h
+        \brief Time multiplexing of uncore event groups that do not fit into the hardware counters at once
+*/
+
+#include <vector>
+#include <chrono>
+#include <functional>
+#include <algorithm>
+#include <thread>
+#include <assert.h>
+#include "types.h"
+#include "utils.h"
+
+namespace pcm {
+
+/*! \brief Rotates uncore event groups over the hardware counters
+
+    The measurement interval is split into slices. Each slice has one event group programmed:
+    the counters are read at the beginning and at the end of the slice and the difference is
+    accumulated for that group, then the next group is programmed (round robin). Slice ends are
+    absolute deadlines on a monotonic clock, so the rotation does not drift, and the rotation
+    continues seamlessly across intervals. Counts are scaled by the time each group was actually
+    counting (coverage), which excludes the time spent reprogramming.
+
+    StateType is whatever the read function needs to capture the counter values of one group
+    (e.g. a vector of ServerUncoreCounterState or raw 64-bit values).
+*/
+template <class StateType>
+class UncoreEventMultiplexer
+{
+public:
+    typedef std::chrono::steady_clock Clock;
+    //! programs the counters with the event group
+    typedef std::function<void(const size_t group)> ProgramFunction;
+    //! reads the current counter values of the programmed group
+    typedef std::function<void(const size_t group, StateType & state)> ReadFunction;
+    //! adds the number of events counted between before and after to counts (one entry per event of the group)
+    typedef std::function<void(const size_t group, const StateType & before, const StateType & after, std::vector<uint64> & counts)> DeltaFunction;
+
+    class Result
+    {
+        friend class UncoreEventMultiplexer;
+        std::vector<std::vector<uint64> > counts;
+        std::vector<double> activeTime;
+        double intervalTime = 0.;
+    public:
+        //! length of the interval in seconds
+        double getIntervalTime() const { return intervalTime; }
+        //! time in seconds the group was programmed and counting
+        double getActiveTime(const size_t group) const { return activeTime[group]; }
+        //! fraction of the interval the group was counting
+        double getCoverage(const size_t group) const
+        {
+            return (intervalTime > 0.) ? (std::min)(1., activeTime[group] / intervalTime) : 0.;
+        }
+        //! number of events observed while the group was counting
+        uint64 getRawCount(const size_t group, const size_t event) const { return counts[group][event]; }
+        //! number of events extrapolated to the whole interval
+        uint64 getScaledCount(const size_t group, const size_t event) const
+        {
+            const double coverage = getCoverage(group);
+            return (coverage > 0.) ? uint64(double(counts[group][event]) / coverage) : 0ULL;
+        }
+        //! average coverage over all groups
+        double getAverageCoverage() const
+        {
+            double sum = 0.;
+            for (size_t g = 0; g < activeTime.size(); ++g)
+            {
+                sum += getCoverage(g);
+            }
+            return activeTime.empty() ? 0. : sum / double(activeTime.size());
+        }
+    };
+
+private:
+    std::vector<size_t> eventsPerGroup;
+    ProgramFunction programFunc;
+    ReadFunction readFunc;
+    DeltaFunction deltaFunc;
+    std::chrono::microseconds slice;
+    StateType before, after;
+    Result result;
+    size_t currentGroup = 0;
+    bool started = false;
+    Clock::time_point sliceStart, intervalStart;
+
+    UncoreEventMultiplexer() = delete;
+    UncoreEventMultiplexer(const UncoreEventMultiplexer &) = delete;
+    UncoreEventMultiplexer & operator = (const UncoreEventMultiplexer &) = delete;
+
+    void beginSlice()
+    {
+        if (eventsPerGroup.size() > 1 || started == false)
+        {
+            programFunc(currentGroup);
+        }
+        readFunc(currentGroup, before);
+        sliceStart = Clock::now();
+    }
+
+public:
+    enum { defaultSliceMs = 100 };
+
+    /*! \brief Creates the multiplexer
+        \param eventsPerGroup_ number of event counts produced by the delta function for each group
+        \param program_ programs the event group
+        \param read_ reads the counters of the programmed group
+        \param delta_ accumulates event counts between two reads
+        \param prototype initial value of the state objects (e.g. preallocated vectors)
+        \param slice_ maximum time one group stays programmed before the next one is rotated in
+    */
+    UncoreEventMultiplexer(const std::vector<size_t> & eventsPerGroup_,
+        ProgramFunction program_,
+        ReadFunction read_,
+        DeltaFunction delta_,
+        const StateType & prototype = StateType(),
+        const std::chrono::microseconds slice_ = std::chrono::milliseconds(defaultSliceMs)) :
+        eventsPerGroup(eventsPerGroup_),
+        programFunc(program_),
+        readFunc(read_),
+        deltaFunc(delta_),
+        slice(slice_),
+        before(prototype),
+        after(prototype)
+    {
+        assert(eventsPerGroup.size() > 0);
+        result.counts.resize(eventsPerGroup.size());
+        for (size_t g = 0; g < eventsPerGroup.size(); ++g)
+        {
+            result.counts[g].resize(eventsPerGroup[g], 0ULL);
+        }
+        result.activeTime.resize(eventsPerGroup.size(), 0.);
+    }
+
+    size_t getNumGroups() const { return eventsPerGroup.size(); }
+
+    //! programs the first group and starts counting (called implicitly by the first collect)
+    void start()
+    {
+        currentGroup = 0;
+        beginSlice();
+        started = true;
+        intervalStart = sliceStart;
+    }
+
+    /*! \brief Multiplexes the groups until interval seconds have passed since the end of the previous interval
+        \return counts of all groups in the interval
+    */
+    const Result & collect(const double interval)
+    {
+        if (started == false)
+        {
+            start();
+        }
+        for (auto & c : result.counts)
+        {
+            std::fill(c.begin(), c.end(), 0ULL);
+        }
+        std::fill(result.activeTime.begin(), result.activeTime.end(), 0.);
+
+        const auto end = intervalStart + std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>((std::max)(interval, 0.)));
+        // every group should get at least one slice per interval
+        const auto effectiveSlice = std::chrono::duration_cast<Clock::duration>((std::min)(
+            std::chrono::duration<double>(slice),
+            std::chrono::duration<double>((std::max)(interval, 0.) / double(eventsPerGroup.size()))));
+        Clock::time_point now;
+        do
+        {
+            sleepUntil((std::min)(sliceStart + effectiveSlice, end), getSleepSpin());
+            readFunc(currentGroup, after);
+            now = Clock::now();
+            deltaFunc(currentGroup, before, after, result.counts[currentGroup]);
+            result.activeTime[currentGroup] += std::chrono::duration<double>(now - sliceStart).count();
+            if (eventsPerGroup.size() > 1)
+            {
+                currentGroup = (currentGroup + 1) % eventsPerGroup.size();
+                beginSlice();
+            }
+            else
+            {
+                std::swap(before, after);
+                sliceStart = now;
+            }
+        } while (now < end);
+        result.intervalTime = std::chrono::duration<double>(now - intervalStart).count();
+        intervalStart = now;
+        return result;
+    }
+
+    const Result & getResult() const { return result; }
+};
+
+} // namespace pcm
@@ -6,6 +6,8 @@
 #include <cassert>
 #include <climits>
 #include <algorithm>
+#include <thread>
+#include <cerrno>
 #ifdef _MSC_VER
 #include <windows.h>
 #include <accctrl.h>
@@ -95,6 +97,19 @@ void eraseEnvironmentVariables(const std::vector<std::string>& keepList) {
 
 void (*post_cleanup_callback)(void) = NULL;
 
+std::atomic<bool> mainLoopRunning{false};
+std::atomic<bool> mainLoopStopRequested{false};
+
+//! \brief Asks a running MainLoop to stop, returns false if there is none or a stop was already requested
+static bool requestMainLoopStop()
+{
+    if (mainLoopRunning.load() == false)
+    {
+        return false;
+    }
+    return mainLoopStopRequested.exchange(true) == false;
+}
+
 //! \brief handler of exit() call
 void exit_cleanup(void)
 {
@@ -268,12 +283,13 @@ BOOL sigINT_handler(DWORD fdwCtrlType)
         break;
     }
 
-    // TODO: dump summary, if needed
-
     // in case PCM is blocked just return and summary will be dumped in
     // calling function, if needed
     if (PCM::isInitialized() && PCM::getInstance()->isBlocked()) {
         return FALSE;
+    } else if ((fdwCtrlType == CTRL_C_EVENT || fdwCtrlType == CTRL_BREAK_EVENT) && requestMainLoopStop()) {
+        // the main loop prints the pending output and the summary and exits
+        return TRUE;
     } else {
         exit_cleanup();
         _exit(EXIT_SUCCESS);
@@ -304,12 +320,14 @@ void sigINT_handler(int signum)
 {
     // output for DEBUG only
     std::cerr << "DEBUG: caught signal to interrupt (" << strsignal(signum) << ").\n";
-    // TODO: dump summary, if needed
 
     // in case PCM is blocked just return and summary will be dumped in
     // calling function, if needed
     if (PCM::isInitialized() && PCM::getInstance()->isBlocked()) {
         return;
+    } else if ((signum == SIGINT || signum == SIGTERM) && requestMainLoopStop()) {
+        // the main loop prints the pending output and the summary and exits
+        return;
     } else {
         exit_cleanup();
         if (signum == SIGABRT || signum == SIGSEGV)
@@ -781,26 +799,93 @@ bool match(const std::string& subtoken, const std::string& sname, uint64* result
 
 #define PCM_CALIBRATION_INTERVAL 50 // calibrate clock only every 50th iteration
 
-int calibratedSleep(const double delay, const char* sysCmd, const MainLoop& mainLoop, PCM* m)
+void sleepUntil(const std::chrono::steady_clock::time_point & deadline, const std::chrono::microseconds spin)
 {
-    static uint64 TimeAfterSleep = 0;
-    int delay_ms = int(delay * 1000);
+    const auto wakeUp = deadline - std::chrono::duration_cast<std::chrono::steady_clock::duration>(spin);
+#if defined(__linux__) || defined(__FreeBSD__) || defined(__DragonFly__)
+    // steady_clock is CLOCK_MONOTONIC with the standard libraries of these systems
+    const auto sinceEpoch = std::chrono::duration_cast<std::chrono::nanoseconds>(wakeUp.time_since_epoch()).count();
+    if (sinceEpoch > 0)
+    {
+        struct timespec ts;
+        ts.tv_sec = (time_t)(sinceEpoch / 1000000000LL);
+        ts.tv_nsec = (long)(sinceEpoch % 1000000000LL);
+        while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, nullptr) == EINTR && mainLoopStopRequested.load() == false) { }
+    }
+#else
+    std::this_thread::sleep_until(wakeUp);
+#endif
+    while (std::chrono::steady_clock::now() < deadline && mainLoopStopRequested.load() == false) { }
+}
 
-    if (TimeAfterSleep) delay_ms -= (int)(m->getTickCount() - TimeAfterSleep);
-    if (delay_ms < 0) delay_ms = 0;
+std::chrono::microseconds getSleepSpin()
+{
+    static const std::chrono::microseconds spin(std::max(0, atoi(safe_getenv("PCM_SLEEP_SPIN_US").c_str())));
+    return spin;
+}
 
-    if (sysCmd == NULL || mainLoop.getNumberOfIterations() != 0 || m->isBlocked() == false)
+double SamplingScheduler::sleepUntilNext(const double periodSeconds)
+{
+    const auto newPeriod = std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>((std::max)(periodSeconds, 0.)));
+    const auto before = Clock::now();
+    if (started == false || newPeriod != period)
     {
-        if (delay_ms > 0)
-        {
-            // std::cerr << "DEBUG: sleeping for " << std::dec << delay_ms << " ms...\n";
-            MySleepMs(delay_ms);
-        }
+        period = newPeriod;
+        next = before;
+        started = true;
+    }
+    next += period;
+    if (period.count() > 0 && before - next >= period)
+    {
+        // late by at least a whole period: skip the missed deadlines
+        const auto missed = (before - next) / period;
+        missedDeadlines += (uint64)missed;
+        next += missed * period;
+    }
+    if (next > before)
+    {
+        sleepUntil(next, getSleepSpin());
+    }
+    const auto after = Clock::now();
+    if (after >= next)
+    {
+        // not woken up early by a stop request
+        latenessUs.add(double(std::chrono::duration_cast<std::chrono::microseconds>(after - (std::max)(next, before)).count()));
+    }
+    return std::chrono::duration<double>(after - before).count();
+}
+
+void SamplingScheduler::printStatistics(std::ostream & out) const
+{
+    if (latenessUs.count() == 0)
+    {
+        return;
     }
+    out << "Sampling schedule: " << latenessUs.count() << " intervals of " << std::chrono::duration<double, std::milli>(period).count() << " ms,"
+        << " wake up lateness p50 " << latenessUs.percentile(50) << " us,"
+        << " p99 " << latenessUs.percentile(99) << " us,"
+        << " max " << latenessUs.max() << " us,"
+        << " missed deadlines " << missedDeadlines << "\n";
+}
 
-    TimeAfterSleep = m->getTickCount();
+SamplingScheduler & getSamplingScheduler()
+{
+    static SamplingScheduler scheduler;
+    return scheduler;
+}
 
-    return delay_ms;
+int calibratedSleep(const double delay, const char* sysCmd, const MainLoop& mainLoop, PCM* m)
+{
+    double slept = 0.;
+    if (sysCmd == NULL || mainLoop.getNumberOfIterations() != 0 || m->isBlocked() == false)
+    {
+        slept = getSamplingScheduler().sleepUntilNext(delay);
+    }
+    else
+    {
+        getSamplingScheduler().restart();
+    }
+    return int(slept * 1000.);
 };
 
 void print_help_force_rtm_abort_mode(const int alignment, const char * separator)
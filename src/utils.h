@@ -14,8 +14,10 @@
 #include <fstream>
 #include <time.h>
 #include "types.h"
+#include "simulated_hw.h"
 #include <vector>
 #include <list>
+#include <algorithm>
 #include <chrono>
 #include <math.h>
 #include <assert.h>
@@ -36,6 +38,7 @@
 #endif
 #include <map>
 #include <unordered_map>
+#include <atomic>
 
 #ifdef __linux__
 #include <unistd.h>
@@ -137,6 +140,11 @@ bool check_for_injections(const std::string & str);
 
 void exit_cleanup(void);
 void set_signal_handlers(void);
+//! true while a MainLoop runs: the first SIGINT/SIGTERM (Ctrl-C) then stops the loop instead of exiting,
+//! so the tool prints its pending output and the summary; a second signal exits immediately
+extern std::atomic<bool> mainLoopRunning;
+//! set by the signal handler to stop the running MainLoop after the current iteration
+extern std::atomic<bool> mainLoopStopRequested;
 void set_real_time_priority(const bool & silent);
 void restore_signal_handlers(void);
 #ifndef _MSC_VER
@@ -335,9 +343,9 @@ inline std::istream & operator >> (std::istream && istr, s_expect && s)
     return istr;
 }
 
-inline std::pair<tm, uint64> pcm_localtime() // returns <tm, milliseconds>
+inline std::pair<tm, uint64> pcm_localtime(const std::chrono::system_clock::time_point & time = std::chrono::system_clock::now()) // returns <tm, milliseconds>
 {
-    const auto durationSinceEpoch = std::chrono::system_clock::now().time_since_epoch();
+    const auto durationSinceEpoch = time.time_since_epoch();
     const auto durationSinceEpochInSeconds = std::chrono::duration_cast<std::chrono::seconds>(durationSinceEpoch);
     time_t now = durationSinceEpochInSeconds.count();
     tm result;
@@ -379,7 +387,8 @@ inline void choose(const CsvOutputType outputType, H1 h1Func, H2 h2Func, D dataF
     }
 }
 
-inline void printDateForCSV(const CsvOutputType outputType, std::string separator = std::string(","))
+inline void printDateForCSV(const CsvOutputType outputType, std::string separator = std::string(","),
+    const std::chrono::system_clock::time_point & time = std::chrono::system_clock::now())
 {
     choose(outputType,
         [&separator]() {
@@ -388,8 +397,8 @@ inline void printDateForCSV(const CsvOutputType outputType, std::string separato
         [&separator]() {
             std::cout << "Date" << separator << "Time" << separator;
         },
-        [&separator]() {
-            std::pair<tm, uint64> tt{ pcm_localtime() };
+        [&separator, &time]() {
+            std::pair<tm, uint64> tt{ pcm_localtime(time) };
             std::cout.precision(3);
             char old_fill = std::cout.fill('0');
             std::cout <<
@@ -480,7 +489,8 @@ public:
     {
         unsigned int i = 1;
         // std::cerr << "DEBUG: numberOfIterations: " << numberOfIterations << "\n";
-        while ((i <= numberOfIterations) || (numberOfIterations == 0))
+        mainLoopRunning.store(true);
+        while (((i <= numberOfIterations) || (numberOfIterations == 0)) && mainLoopStopRequested.load() == false)
         {
             if (body() == false)
             {
@@ -488,6 +498,7 @@ public:
             }
             ++i;
         }
+        mainLoopRunning.store(false);
     }
 };
 
@@ -511,6 +522,136 @@ struct StackedBarItem {
 
 void drawStackedBar(const std::string & label, std::vector<StackedBarItem> & h, const int width = 80);
 
+//! \brief Histogram of non-negative values with logarithmically spaced buckets
+//!
+//! Each power of two is split into 2^subBucketBits equal buckets, so percentiles are
+//! reported with a relative error below 1/2^subBucketBits. Values below 1 share bucket 0.
+class LogHistogram
+{
+    enum {
+        subBucketBits = 3,
+        subBuckets = 1 << subBucketBits,
+        maxExponent = 64
+    };
+    std::vector<uint64> buckets;
+    uint64 numValues = 0;
+    double maxValue = 0.;
+
+    static size_t bucketIndex(const double value)
+    {
+        if (value < 1.)
+        {
+            return 0;
+        }
+        int exponent = 0;
+        const double mantissa = frexp(value, &exponent); // value = mantissa * 2^exponent, mantissa in [0.5, 1)
+        if (exponent > maxExponent)
+        {
+            exponent = maxExponent;
+        }
+        const size_t sub = (std::min)(size_t((2. * mantissa - 1.) * subBuckets), size_t(subBuckets - 1));
+        return 1 + size_t(exponent - 1) * subBuckets + sub;
+    }
+    static double bucketUpperBound(const size_t index)
+    {
+        if (index == 0)
+        {
+            return 1.;
+        }
+        const size_t exponent = (index - 1) / subBuckets;
+        const size_t sub = (index - 1) % subBuckets;
+        return ldexp(1. + double(sub + 1) / subBuckets, int(exponent));
+    }
+public:
+    LogHistogram() : buckets(1 + maxExponent * subBuckets, 0ULL) {}
+    void add(const double value)
+    {
+        buckets[bucketIndex(value)]++;
+        ++numValues;
+        if (value > maxValue)
+        {
+            maxValue = value;
+        }
+    }
+    void merge(const LogHistogram & other)
+    {
+        for (size_t i = 0; i < buckets.size(); ++i)
+        {
+            buckets[i] += other.buckets[i];
+        }
+        numValues += other.numValues;
+        maxValue = (std::max)(maxValue, other.maxValue);
+    }
+    void reset()
+    {
+        std::fill(buckets.begin(), buckets.end(), 0ULL);
+        numValues = 0;
+        maxValue = 0.;
+    }
+    uint64 count() const { return numValues; }
+    double max() const { return maxValue; }
+    //! \brief Returns the upper bound of the bucket containing the p-th percentile (p in [0, 100])
+    double percentile(const double p) const
+    {
+        if (numValues == 0)
+        {
+            return 0.;
+        }
+        const uint64 rank = (std::max)(uint64(1), uint64(ceil(p / 100. * double(numValues))));
+        uint64 seen = 0;
+        for (size_t i = 0; i < buckets.size(); ++i)
+        {
+            seen += buckets[i];
+            if (seen >= rank)
+            {
+                return (std::min)(bucketUpperBound(i), maxValue);
+            }
+        }
+        return maxValue;
+    }
+};
+
+//! \brief Sleeps until an absolute deadline of std::chrono::steady_clock
+//!
+//! Uses clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME) where available, so that the wake up
+//! time does not depend on when the sleep started. The last spin microseconds before the
+//! deadline are busy-waited to hide the timer slack of the kernel.
+void sleepUntil(const std::chrono::steady_clock::time_point & deadline, const std::chrono::microseconds spin = std::chrono::microseconds(0));
+
+//! \brief Returns the busy-wait time before sampling deadlines (environment variable PCM_SLEEP_SPIN_US, default 0)
+std::chrono::microseconds getSleepSpin();
+
+/*! \brief Schedules periodic samples on absolute deadlines
+
+    The k-th deadline is start + k * period, so the time spent reading and printing between
+    the sleeps does not accumulate into drift. If a sample is late by a whole period or more,
+    the missed deadlines are skipped instead of taking a burst of samples to catch up.
+    The lateness of every wake up is recorded.
+*/
+class SamplingScheduler
+{
+    typedef std::chrono::steady_clock Clock;
+    Clock::duration period{0};
+    Clock::time_point next;
+    bool started = false;
+    uint64 missedDeadlines = 0;
+    LogHistogram latenessUs;
+public:
+    //! \brief Sleeps until the next deadline
+    //! \param periodSeconds sampling period, a change of the period restarts the schedule
+    //! \return time slept in seconds
+    double sleepUntilNext(const double periodSeconds);
+    //! \brief Restarts the schedule at the next call of sleepUntilNext
+    void restart() { started = false; }
+    const LogHistogram & getLatenessUs() const { return latenessUs; }
+    uint64 getMissedDeadlines() const { return missedDeadlines; }
+    //! \brief Prints the lateness percentiles and missed deadlines (nothing if no interval was scheduled)
+    void printStatistics(std::ostream & out) const;
+};
+
+//! \brief The scheduler used by calibratedSleep
+SamplingScheduler & getSamplingScheduler();
+
 // emulates scanf %i for hex 0x prefix otherwise assumes dec (no oct support)
 bool match(const std::string& subtoken, const std::string& sname, uint64* result);
 
@@ -715,6 +856,12 @@ public:
     TemporalThreadAffinity(const uint32 core_id, bool checkStatus = true, const bool restore_ = true)
         : set_size(CPU_ALLOC_SIZE(maxCPUs)), restore(restore_)
     {
+        if (SimulatedHardware::get())
+        {
+            // simulated cores do not exist in the OS scheduler
+            restore = false;
+            return;
+        }
         assert(core_id < maxCPUs);
         old_affinity = CPU_ALLOC(maxCPUs);
         assert(old_affinity);
@@ -14,25 +14,29 @@
 #include "cpucounters.h"
 #include "utils.h"
 #include "bw.h"
-#include "mutex.h"
 #include <memory>
-#ifndef _MSC_VER
-// the header can not be included into code using CLR
-#include <thread>
-#else
-namespace std {
-     class thread;
- }
-#endif
+#include <atomic>
+#include <vector>
 
 namespace pcm {
 
+class CoreTaskQueue;
+
+/*! \brief Extends a narrow hardware counter to 64 bits
+
+    The raw counter must be read at least once per wrap-around period. Instead of a thread per
+    counter, all extenders are registered with one shared overflow tracking service that wakes up
+    at the earliest deadline, batches all counters due around that time and reads them grouped by
+    core on the core task queue workers.
+*/
 class CounterWidthExtender
 {
 public:
     struct AbstractRawCounter
     {
         virtual uint64 operator () () = 0;
+        //! core the counter should be read on, or -1 if any core will do
+        virtual int32 getCore() { return -1; }
         virtual ~AbstractRawCounter() { }
     };
 
@@ -41,6 +45,7 @@ public:
         std::shared_ptr<SafeMsrHandle> msr;
         uint64 msr_addr;
         MsrHandleCounter(std::shared_ptr<SafeMsrHandle> msr_, uint64 msr_addr_) : msr(msr_), msr_addr(msr_addr_) { }
+        int32 getCore() override { return msr->getCoreId(); }
         uint64 operator () ()
         {
             uint64 value = 0;
@@ -67,6 +72,7 @@ public:
     {
         std::shared_ptr<SafeMsrHandle> msr;
         MBLCounter(std::shared_ptr<SafeMsrHandle> msr_) : msr(msr_) { }
+        int32 getCore() override { return msr->getCoreId(); }
         uint64 operator () ()
         {
             msr->lock();
@@ -90,6 +96,7 @@ public:
     {
         std::shared_ptr<SafeMsrHandle> msr;
         MBTCounter(std::shared_ptr<SafeMsrHandle> msr_) : msr(msr_) { }
+        int32 getCore() override { return msr->getCoreId(); }
         uint64 operator () ()
         {
             msr->lock();
@@ -110,13 +117,13 @@ public:
     };
 
 private:
-    std::thread * UpdateThread;
-
-    Mutex CounterMutex;
+    uint64 serviceId; // registration handle in the overflow tracking service
 
     AbstractRawCounter * raw_counter;
-    uint64 extended_value;
-    uint64 last_raw_value;
+    // seqlock protected state: an odd sequence number marks an update in progress
+    std::atomic<uint64> sequence{0};
+    std::atomic<uint64> extended_value{0};
+    std::atomic<uint64> last_raw_value{0};
     uint64 counter_width;
     uint32 watchdog_delay_ms;
 
@@ -124,27 +131,43 @@ private:
     CounterWidthExtender(CounterWidthExtender &);                     // forbidden
     CounterWidthExtender & operator = (const CounterWidthExtender &); // forbidden
 
-
-    uint64 internal_read()
+    uint64 delta(const uint64 new_raw_value, const uint64 old_raw_value) const
     {
-        uint64 result = 0, new_raw_value = 0;
-        CounterMutex.lock();
-
-        new_raw_value = (*raw_counter)();
-        if (new_raw_value < last_raw_value)
+        if (new_raw_value < old_raw_value)
         {
-            extended_value += ((1ULL << counter_width) - last_raw_value) + new_raw_value;
-        }
-        else
-        {
-            extended_value += (new_raw_value - last_raw_value);
+            return ((1ULL << counter_width) - old_raw_value) + new_raw_value;
         }
+        return new_raw_value - old_raw_value;
+    }
 
-        last_raw_value = new_raw_value;
+    /*
+        Readers never block each other: the state is snapshotted before the raw counter is read
+        (so the raw value is never older than the snapshot) and the result is computed from the
+        snapshot. The new state is published only if no other reader has published in the
+        meantime, otherwise the other (equally recent) state is kept.
+    */
+    uint64 internal_read()
+    {
+        uint64 seq = 0, last = 0, extended = 0;
+        do
+        {
+            seq = sequence.load(std::memory_order_acquire);
+            last = last_raw_value.load(std::memory_order_relaxed);
+            extended = extended_value.load(std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_acquire);
+        } while ((seq & 1ULL) || seq != sequence.load(std::memory_order_relaxed));
 
-        result = extended_value;
+        const uint64 new_raw_value = (*raw_counter)();
+        const uint64 result = extended + delta(new_raw_value, last);
 
-        CounterMutex.unlock();
+        if (sequence.load(std::memory_order_relaxed) == seq &&
+            sequence.compare_exchange_strong(seq, seq + 1, std::memory_order_acquire, std::memory_order_relaxed))
+        {
+            std::atomic_thread_fence(std::memory_order_release);
+            last_raw_value.store(new_raw_value, std::memory_order_relaxed);
+            extended_value.store(result, std::memory_order_relaxed);
+            sequence.store(seq + 2, std::memory_order_release);
+        }
         return result;
     }
 
@@ -157,11 +180,23 @@ public:
     {
         return internal_read();
     }
+    uint32 getWatchdogDelayMs() const { return watchdog_delay_ms; }
+    int32 getCore() { return raw_counter->getCore(); }
+    //! lets the overflow tracking service read per-core counters on the core task queue workers
+    static void setCoreTaskQueues(const std::vector<std::shared_ptr<CoreTaskQueue> > & queues);
     void reset()
     {
-        CounterMutex.lock();
-        extended_value = last_raw_value = (*raw_counter)();
-        CounterMutex.unlock();
+        const uint64 new_raw_value = (*raw_counter)();
+        uint64 seq = 0;
+        do
+        {
+            // an update in progress takes only a few stores
+            seq = sequence.load(std::memory_order_relaxed) & ~1ULL;
+        } while (!sequence.compare_exchange_weak(seq, seq + 1, std::memory_order_acquire, std::memory_order_relaxed));
+        std::atomic_thread_fence(std::memory_order_release);
+        last_raw_value.store(new_raw_value, std::memory_order_relaxed);
+        extended_value.store(new_raw_value, std::memory_order_relaxed);
+        sequence.store(seq + 2, std::memory_order_release);
     }
 };
 
@@ -0,0 +1,200 @@
+// SPDX-License-Identifier: BSD-3-Clause
+// Copyright (c) 2024, Intel Corporation
+
+// Self-overhead benchmark of the PCM sampling APIs: wall latency distribution, system calls,
+// heap allocations and register accesses per sample, with the time split into dispatch, MSR,
+// PCI config, MMIO and aggregation phases (see src/overhead_stats.h). Prints CSV, one line per API.
+// Optionally measures GET /metrics of a running pcm-sensor-server.
+// Usage: overhead_bench [-n samples] [-m host:port]
+
+#include "../src/cpucounters.h"
+#include "../src/utils.h"
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <iostream>
+#include <iomanip>
+#include <new>
+#include <string>
+#include <vector>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <sys/socket.h>
+
+using namespace pcm;
+
+// heap allocations of the whole process
+std::atomic<uint64> allocations{0};
+
+void * operator new(size_t size)
+{
+    ++allocations;
+    void * p = malloc(size ? size : 1);
+    if (p == nullptr) throw std::bad_alloc();
+    return p;
+}
+void operator delete(void * p) noexcept { free(p); }
+void operator delete(void * p, size_t) noexcept { free(p); }
+
+// read and write system calls of the process (all threads) from /proc/self/io
+uint64 readSyscalls(const int fd)
+{
+    char buffer[512];
+    const ssize_t len = pread(fd, buffer, sizeof(buffer) - 1, 0);
+    if (len <= 0) return 0;
+    buffer[len] = 0;
+    uint64 result = 0;
+    for (const char * field : { "syscr: ", "syscw: " })
+    {
+        const char * pos = strstr(buffer, field);
+        if (pos) result += strtoull(pos + strlen(field), nullptr, 10);
+    }
+    return result;
+}
+
+struct Result
+{
+    std::string name;
+    LogHistogram wallNs;
+    double syscalls = 0., allocations = 0.;
+    double calls[OverheadStats::NumKinds] = { 0. };
+    double us[OverheadStats::NumKinds] = { 0. };
+};
+
+Result measure(const std::string & name, const size_t samples, const std::function<void()> & f, const int ioFd)
+{
+    Result r;
+    r.name = name;
+    for (int i = 0; i < 3; ++i) f(); // warm up (first use allocations, page faults)
+    OverheadStats::reset();
+    uint64 syscalls = 0, allocs = 0;
+    for (size_t i = 0; i < samples; ++i)
+    {
+        const uint64 syscallsBefore = readSyscalls(ioFd);
+        const uint64 allocsBefore = allocations.load();
+        const auto start = std::chrono::steady_clock::now();
+        f();
+        const auto end = std::chrono::steady_clock::now();
+        allocs += allocations.load() - allocsBefore;
+        syscalls += readSyscalls(ioFd) - syscallsBefore;
+        r.wallNs.add(double(std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count()));
+    }
+    r.syscalls = double(syscalls) / double(samples);
+    r.allocations = double(allocs) / double(samples);
+    for (int k = 0; k < OverheadStats::NumKinds; ++k)
+    {
+        r.calls[k] = double(OverheadStats::getCalls((OverheadStats::Kind)k)) / double(samples);
+        r.us[k] = double(OverheadStats::getNanoseconds((OverheadStats::Kind)k)) / 1000. / double(samples);
+    }
+    return r;
+}
+
+void print(const Result & r, const Result & baseline, PCM * m)
+{
+    // the reads of /proc/self/io are in the baseline
+    std::cout << r.name << "," << m->getNumCores() << "," << m->getNumSockets() << "," << r.wallNs.count()
+              << "," << r.wallNs.percentile(50) / 1000. << "," << r.wallNs.percentile(99) / 1000. << "," << r.wallNs.max() / 1000.
+              << "," << (std::max)(0., r.syscalls - baseline.syscalls) << "," << r.allocations;
+    for (const auto k : { OverheadStats::MSRAccess, OverheadStats::PCICFGAccess, OverheadStats::MMIOAccess })
+    {
+        std::cout << "," << r.calls[k] << "," << r.us[k];
+    }
+    std::cout << "," << r.us[OverheadStats::DispatchPhase] << "," << r.us[OverheadStats::AggregationPhase] << "\n";
+}
+
+// GET /metrics with a new connection per request, like a Prometheus scraper
+bool getMetrics(const std::string & host, const std::string & port)
+{
+    addrinfo hints, * addr = nullptr;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    if (getaddrinfo(host.c_str(), port.c_str(), &hints, &addr) != 0 || addr == nullptr)
+    {
+        return false;
+    }
+    const int fd = socket(addr->ai_family, addr->ai_socktype, addr->ai_protocol);
+    bool ok = fd >= 0 && connect(fd, addr->ai_addr, addr->ai_addrlen) == 0;
+    freeaddrinfo(addr);
+    if (ok)
+    {
+        const std::string request = "GET /metrics HTTP/1.1\r\nHost: " + host + "\r\nConnection: close\r\n\r\n";
+        ok = write(fd, request.c_str(), request.size()) == (ssize_t)request.size();
+        char buffer[65536];
+        while (ok && read(fd, buffer, sizeof(buffer)) > 0) { }
+    }
+    if (fd >= 0) ::close(fd);
+    return ok;
+}
+
+int main(int argc, char * argv[])
+{
+    size_t samples = 1000;
+    std::string metricsHost, metricsPort;
+    for (int i = 1; i < argc; ++i)
+    {
+        if (strcmp(argv[i], "-n") == 0 && i + 1 < argc)
+        {
+            samples = (size_t)atoll(argv[++i]);
+        }
+        else if (strcmp(argv[i], "-m") == 0 && i + 1 < argc)
+        {
+            const std::string hostPort = argv[++i];
+            const auto colon = hostPort.rfind(':');
+            metricsHost = hostPort.substr(0, colon);
+            metricsPort = (colon == std::string::npos) ? "9738" : hostPort.substr(colon + 1);
+        }
+        else
+        {
+            std::cerr << "Usage: " << argv[0] << " [-n samples] [-m host:port]\n";
+            return 1;
+        }
+    }
+    if (samples == 0) samples = 1;
+
+    PCM * m = PCM::getInstance();
+    if (m->program() != PCM::Success)
+    {
+        std::cerr << "Can not program PCM\n";
+        return 1;
+    }
+    const int ioFd = ::open("/proc/self/io", O_RDONLY);
+    OverheadStats::enable(true);
+
+    SystemCounterState systemState;
+    std::vector<SocketCounterState> socketStates;
+    std::vector<CoreCounterState> coreStates;
+    ServerUncoreCounterState serverState;
+
+    const Result baseline = measure("baseline", samples, []() {}, ioFd);
+    std::cout << "API,Cores,Sockets,Samples,Wall p50 (us),Wall p99 (us),Wall max (us),Syscalls/sample,Allocations/sample,"
+                 "MSR accesses/sample,MSR us/sample,PCICFG accesses/sample,PCICFG us/sample,MMIO accesses/sample,MMIO us/sample,"
+                 "Dispatch us/sample,Aggregation us/sample\n";
+    print(measure("getAllCounterStates", samples, [&]() { m->getAllCounterStates(systemState, socketStates, coreStates); }, ioFd), baseline, m);
+    print(measure("getAllCounterStates(core only)", samples, [&]() { m->getAllCounterStates(systemState, socketStates, coreStates, false); }, ioFd), baseline, m);
+    print(measure("getUncoreCounterStates", samples, [&]() { m->getUncoreCounterStates(systemState, socketStates); }, ioFd), baseline, m);
+    if (m->hasPCICFGUncore())
+    {
+        for (uint32 s = 0; s < m->getNumSockets(); ++s)
+        {
+            print(measure("getServerUncoreCounterState(" + std::to_string(s) + ")", samples, [&]() { m->readServerUncoreCounterState(s, serverState); }, ioFd), baseline, m);
+        }
+    }
+    if (!metricsHost.empty())
+    {
+        bool ok = true;
+        const Result r = measure("GET /metrics", samples, [&]() { ok = getMetrics(metricsHost, metricsPort) && ok; }, ioFd);
+        if (!ok)
+        {
+            std::cerr << "GET /metrics from " << metricsHost << ":" << metricsPort << " failed\n";
+        }
+        print(r, baseline, m);
+    }
+    OverheadStats::enable(false);
+    if (ioFd >= 0) ::close(ioFd);
+    m->cleanup();
+    return 0;
+}
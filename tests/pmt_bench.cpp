@@ -0,0 +1,73 @@
+// SPDX-License-Identifier: BSD-3-Clause
+// Copyright (c) 2024, Intel Corporation
+
+// Benchmark of PMT telemetry reads: bytes read and time per sample when loading the whole
+// telemetry region vs. only the qwords that are actually used.
+// Usage: pmt_bench <guid> [qword offset]... [-n samples]
+
+#include "../src/pmt.h"
+#include "../src/utils.h"
+#include <chrono>
+#include <vector>
+#include <iostream>
+#include <iomanip>
+#include <string.h>
+
+using namespace pcm;
+
+void run(const char * name, TelemetryArray & array, const size_t samples)
+{
+    const auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < samples; ++i)
+    {
+        array.load();
+    }
+    const double us = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count() / double(samples);
+    std::cout << std::setw(10) << name << std::setw(16) << array.loadSize() << std::setw(16) << std::fixed << std::setprecision(2) << us << "\n";
+}
+
+int main(int argc, char * argv[])
+{
+    if (argc < 2)
+    {
+        std::cerr << "Usage: " << argv[0] << " <guid> [qword offset]... [-n samples]\n";
+        return 1;
+    }
+    const size_t guid = (size_t)read_number(argv[1]);
+    std::vector<size_t> offsets;
+    size_t samples = 1000;
+    for (int i = 2; i < argc; ++i)
+    {
+        if (strcmp(argv[i], "-n") == 0 && i + 1 < argc)
+        {
+            samples = (size_t)read_number(argv[++i]);
+        }
+        else
+        {
+            offsets.push_back((size_t)read_number(argv[i]));
+        }
+    }
+    if (offsets.empty())
+    {
+        offsets.push_back(0);
+    }
+    const size_t instances = TelemetryArray::numInstances(guid);
+    if (instances == 0)
+    {
+        std::cerr << "No PMT telemetry instances found for guid 0x" << std::hex << guid << std::dec << "\n";
+        return 1;
+    }
+    std::cout << "      load    bytes/sample       us/sample\n";
+    for (size_t inst = 0; inst < instances; ++inst)
+    {
+        TelemetryArray array(guid, inst);
+        std::cout << "instance " << inst << ":\n";
+        run("full", array, samples);
+        for (const auto o : offsets)
+        {
+            array.require(o);
+        }
+        run("partial", array, samples);
+    }
+    return 0;
+}
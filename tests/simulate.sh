@@ -0,0 +1,56 @@
+#!/bin/bash
+# SPDX-License-Identifier: BSD-3-Clause
+# Copyright (c) 2024, Intel Corporation
+
+# Runs the tools against simulated hardware (PCM_SIMULATE), needs neither root rights nor PMU access
+
+export BIN_DIR="${BIN_DIR:-build/bin}"
+export PCM_SIMULATE="2x4x2"
+
+pushd $BIN_DIR
+
+# checks that the output file $1 of tool $2 contains the pattern $3 at least $4 times
+check_output() {
+    count=$(grep -c -E "$3" "$1")
+    if [ "$count" -lt "$4" ]; then
+        echo "Error in $2: expected at least $4 lines matching '$3', found $count"
+        cat "$1"
+        exit 1
+    fi
+}
+
+echo Testing pcm with PCM_SIMULATE=$PCM_SIMULATE
+./pcm 1 -i=2 > sim_pcm.txt 2>&1
+if [ "$?" -ne "0" ]; then
+    echo "Error in pcm"
+    cat sim_pcm.txt
+    exit 1
+fi
+check_output sim_pcm.txt pcm "simulated" 1
+# one line per socket and a total line in each of the two samples
+check_output sim_pcm.txt pcm "^ SKT    1 " 2
+check_output sim_pcm.txt pcm "^ TOTAL  \* " 2
+check_output sim_pcm.txt pcm "Instructions retired: +[1-9]" 2
+
+echo Testing pcm-memory with PCM_SIMULATE=$PCM_SIMULATE
+./pcm-memory 1 -i=2 > sim_pcm_memory.txt 2>&1
+if [ "$?" -ne "0" ]; then
+    echo "Error in pcm-memory"
+    cat sim_pcm_memory.txt
+    exit 1
+fi
+check_output sim_pcm_memory.txt pcm-memory "NODE 1 Mem Read \(MB/s\) : +[1-9]" 2
+check_output sim_pcm_memory.txt pcm-memory "System Memory Throughput\(MB/s\): +[1-9]" 2
+
+echo Testing pcm-raw with PCM_SIMULATE=$PCM_SIMULATE
+./pcm-raw -e core/config=0x3c,name=cycles/ 1 -i=2 > sim_pcm_raw.txt 2>&1
+if [ "$?" -ne "0" ]; then
+    echo "Error in pcm-raw"
+    cat sim_pcm_raw.txt
+    exit 1
+fi
+# all 16 logical cores in the header and two samples with non-zero cycles of the last core
+check_output sim_pcm_raw.txt pcm-raw "SKT1CORE15," 1
+check_output sim_pcm_raw.txt pcm-raw "^[0-9-]+,[0-9:.]+,[0-9]+,([0-9]+,){15}[1-9][0-9]*,$" 2
+
+popd
@@ -0,0 +1,124 @@
+// SPDX-License-Identifier: BSD-3-Clause
+// Copyright (c) 2024, Intel Corporation
+
+// Contention microbenchmark for CounterWidthExtender: many threads read the same extender
+// concurrently. Compares the lock-free extender with a mutex based reference implementation
+// and checks that the extended values are monotonic per thread and exact at the end.
+// Usage: width_extender_bench [max threads] [ms per run] [ns per raw counter read]
+
+#include "../src/cpucounters.h"
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <vector>
+#include <iostream>
+#include <iomanip>
+
+using namespace pcm;
+
+typedef std::chrono::steady_clock Clock;
+const Clock::time_point startTime = Clock::now();
+std::chrono::nanoseconds readCost(500);
+
+// simulated 24-bit hardware counter ticking every 128 ns (wraps every ~2 seconds);
+// a read takes readCost like an MSR read through the driver
+thread_local uint64 lastTrueValue = 0; // full 64-bit value behind the last raw read of this thread
+uint64 readSimulatedCounter()
+{
+    const auto now = Clock::now();
+    while (Clock::now() - now < readCost) { }
+    lastTrueValue = uint64(std::chrono::duration_cast<std::chrono::nanoseconds>(now - startTime).count()) / 128ULL;
+    return lastTrueValue & ((1ULL << 24) - 1);
+}
+
+struct SimulatedCounter : public CounterWidthExtender::AbstractRawCounter
+{
+    uint64 operator () () override { return readSimulatedCounter(); }
+};
+
+// the previous mutex based implementation
+class MutexWidthExtender
+{
+    std::mutex m;
+    uint64 extended_value, last_raw_value;
+public:
+    MutexWidthExtender()
+    {
+        extended_value = last_raw_value = readSimulatedCounter();
+    }
+    uint64 read()
+    {
+        std::lock_guard<std::mutex> lock(m);
+        const uint64 new_raw_value = readSimulatedCounter();
+        if (new_raw_value < last_raw_value)
+        {
+            extended_value += ((1ULL << 24) - last_raw_value) + new_raw_value;
+        }
+        else
+        {
+            extended_value += new_raw_value - last_raw_value;
+        }
+        last_raw_value = new_raw_value;
+        return extended_value;
+    }
+};
+
+template <class Extender>
+bool run(const char * name, Extender & extender, const unsigned threads, const std::chrono::milliseconds duration)
+{
+    std::atomic<bool> stop{false};
+    std::atomic<bool> monotonic{true};
+    std::atomic<uint64> reads{0};
+    std::vector<std::thread> workers;
+    const uint64 first_value = extender.read();
+    const uint64 first_true_value = lastTrueValue;
+    const auto start = std::chrono::steady_clock::now();
+    for (unsigned t = 0; t < threads; ++t)
+    {
+        workers.emplace_back([&]() {
+            uint64 last = 0, n = 0;
+            while (stop.load(std::memory_order_relaxed) == false)
+            {
+                const uint64 v = extender.read();
+                if (v < last) monotonic = false;
+                last = v;
+                ++n;
+            }
+            reads += n;
+        });
+    }
+    std::this_thread::sleep_for(duration);
+    stop = true;
+    for (auto & w : workers) w.join();
+    const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    // the extended value has to advance exactly like the simulated 64-bit counter
+    const uint64 final_value = extender.read();
+    const bool exact = final_value - first_value == lastTrueValue - first_true_value;
+    std::cout << std::setw(8) << name << std::setw(9) << threads
+              << std::setw(16) << std::fixed << std::setprecision(2) << double(reads.load()) / seconds / 1e6
+              << std::setw(12) << (monotonic ? "yes" : "NO")
+              << std::setw(8) << (exact ? "yes" : "NO") << "\n";
+    return monotonic && exact;
+}
+
+int main(int argc, char * argv[])
+{
+    const unsigned maxThreads = (argc > 1) ? (unsigned)atoi(argv[1]) : (std::max)(2U, std::thread::hardware_concurrency());
+    const std::chrono::milliseconds duration((argc > 2) ? atoi(argv[2]) : 500);
+    if (argc > 3) readCost = std::chrono::nanoseconds(atoi(argv[3]));
+    bool ok = true;
+    std::cout << "    impl  threads   Mreads/sec  monotonic   exact\n";
+    for (unsigned threads = 1; threads <= maxThreads; threads *= 2)
+    {
+        {
+            MutexWidthExtender extender;
+            ok = run("mutex", extender, threads, duration) && ok;
+        }
+        {
+            CounterWidthExtender extender(new SimulatedCounter(), 24, 1000);
+            ok = run("seqlock", extender, threads, duration) && ok;
+        }
+    }
+    return ok ? 0 : 1;
+}